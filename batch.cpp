@@ -0,0 +1,316 @@
+#include "batch.hpp"
+
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LRONE_BATCH_X86
+#endif
+
+namespace lrone {
+
+const char *BatchKernelName(BatchKernel kernel) {
+  switch (kernel) {
+  case BatchKernel::Scalar:
+    return "scalar";
+  case BatchKernel::AVX2:
+    return "AVX2";
+  }
+  return "unknown";
+}
+
+BatchKernel DetectBatchKernel() {
+#ifdef LRONE_BATCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return BatchKernel::AVX2;
+#endif
+  return BatchKernel::Scalar;
+}
+
+namespace {
+
+// kinds of the packed actions in their lowest two bits
+enum : int32_t { ErrorAction, ShiftAction, ReduceAction, AcceptAction };
+
+// lanes that have no input left are parked in state 0 on position 0
+constexpr uint32_t NoInput = std::numeric_limits<uint32_t>::max();
+
+#ifdef LRONE_BATCH_X86
+__attribute__((target("avx2"))) inline __m256i Load(const int32_t *values) {
+  return _mm256_load_si256(reinterpret_cast<const __m256i *>(values));
+}
+__attribute__((target("avx2"))) inline void Store(int32_t *values, __m256i v) {
+  _mm256_store_si256(reinterpret_cast<__m256i *>(values), v);
+}
+#endif
+
+} // namespace
+
+BatchParser::BatchParser(const LRTable &table, const Grammar &grammar)
+    : terminals(grammar.terminals.size()),
+      nonTerminals(grammar.nonTerminals.size()),
+      stacks(size_t(this->depth) * Lanes, 0) {
+  PROFILE_FUNC;
+  const size_t states = table.actions.size();
+  this->actions.resize(states * this->terminals);
+  this->goTo.resize(states * this->nonTerminals);
+  for (size_t s = 0; s < states; ++s) {
+    for (size_t t = 0; t < this->terminals; ++t) {
+      const auto &action = table.actions[s][t];
+      int32_t packed = ErrorAction;
+      switch (action.type) {
+      case LRAction::Type::Error:
+        break;
+      case LRAction::Type::Shift:
+        packed = int32_t(action.num << 2) | ShiftAction;
+        break;
+      case LRAction::Type::Reduce:
+        packed = int32_t(action.num << 2) | ReduceAction;
+        break;
+      case LRAction::Type::Accept:
+        packed = AcceptAction;
+        break;
+      }
+      this->actions[s * this->terminals + t] = packed;
+    }
+    for (size_t nt = 0; nt < this->nonTerminals; ++nt)
+      this->goTo[s * this->nonTerminals + nt] = table.goTo[s][nt];
+  }
+  for (const auto &[lhs, rhs] : grammar.rules) {
+    this->ruleLength.push_back(rhs.size());
+    this->ruleLHS.push_back(lhs);
+  }
+}
+
+size_t BatchParser::TableBytes() const {
+  return (this->actions.size() + this->goTo.size() + this->ruleLength.size() +
+          this->ruleLHS.size()) *
+         sizeof(int32_t);
+}
+
+void BatchParser::Grow() {
+  // depth major, so the stacks keep their place
+  this->depth *= 2;
+  this->stacks.resize(size_t(this->depth) * Lanes, 0);
+}
+
+void BatchParser::Parse(
+    std::span<const uint32_t> terminals, std::span<const uint32_t> starts,
+    std::vector<BatchResult> &results, BatchKernel kernel) {
+  PROFILE_FUNC;
+  results.assign(starts.size(), BatchResult{});
+  if (starts.empty())
+    return;
+#ifdef LRONE_BATCH_X86
+  // gather indices are signed 32-bit
+  constexpr size_t limit = std::numeric_limits<int32_t>::max();
+  if (kernel == BatchKernel::AVX2 && terminals.size() <= limit &&
+      this->actions.size() <= limit && this->goTo.size() <= limit) {
+    this->ParseAVX2(terminals, starts, results);
+    return;
+  }
+#else
+  (void)kernel;
+#endif
+  this->ParseScalar(terminals, starts, results);
+}
+
+void BatchParser::ParseScalar(
+    std::span<const uint32_t> terminals, std::span<const uint32_t> starts,
+    std::vector<BatchResult> &results) {
+  uint32_t state[Lanes], top[Lanes], position[Lanes], reductions[Lanes];
+  uint32_t input[Lanes];
+  size_t next = 0;
+
+  auto refill = [&](unsigned int lane) {
+    state[lane] = 0;
+    top[lane] = 0;
+    reductions[lane] = 0;
+    this->stacks[lane] = 0;
+    if (next < starts.size()) {
+      input[lane] = next;
+      position[lane] = starts[next++];
+    } else {
+      input[lane] = NoInput;
+      position[lane] = 0;
+    }
+  };
+  unsigned int active = 0;
+  for (unsigned int lane = 0; lane < Lanes; ++lane) {
+    refill(lane);
+    active += input[lane] != NoInput;
+  }
+
+  while (active > 0) {
+    for (unsigned int lane = 0; lane < Lanes; ++lane) {
+      if (input[lane] == NoInput)
+        continue;
+      const int32_t action =
+          this->actions[size_t(state[lane]) * this->terminals +
+                        terminals[position[lane]]];
+      const uint32_t num = uint32_t(action) >> 2;
+      switch (action & 3) {
+      case ShiftAction:
+        state[lane] = num;
+        ++position[lane];
+        break;
+      case ReduceAction: {
+        const uint32_t below = top[lane] - this->ruleLength[num];
+        state[lane] =
+            this->goTo[size_t(this->stacks[below * Lanes + lane]) *
+                           this->nonTerminals +
+                       this->ruleLHS[num]];
+        top[lane] = below;
+        ++reductions[lane];
+      } break;
+      default: {
+        auto &result = results[input[lane]];
+        result.accepted = (action & 3) == AcceptAction;
+        result.errorPosition =
+            result.accepted ? 0 : position[lane] - starts[input[lane]];
+        result.reductions = reductions[lane];
+        refill(lane);
+        if (input[lane] == NoInput)
+          --active;
+        continue;
+      }
+      }
+      if (++top[lane] == this->depth)
+        this->Grow();
+      this->stacks[top[lane] * Lanes + lane] = state[lane];
+    }
+  }
+}
+
+#ifdef LRONE_BATCH_X86
+__attribute__((target("avx2"))) void BatchParser::ParseAVX2(
+    std::span<const uint32_t> terminals, std::span<const uint32_t> starts,
+    std::vector<BatchResult> &results) {
+  const auto *input = reinterpret_cast<const int *>(terminals.data());
+  const auto *actions = reinterpret_cast<const int *>(this->actions.data());
+  const auto *goTo = reinterpret_cast<const int *>(this->goTo.data());
+  const auto *ruleLength =
+      reinterpret_cast<const int *>(this->ruleLength.data());
+  const auto *ruleLHS = reinterpret_cast<const int *>(this->ruleLHS.data());
+
+  static_assert(Lanes == 8, "one lane per 32-bit element of a register");
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i terminalCount = _mm256_set1_epi32(this->terminals);
+  const __m256i nonTerminalCount = _mm256_set1_epi32(this->nonTerminals);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i three = _mm256_set1_epi32(3);
+  const __m256i zero = _mm256_setzero_si256();
+
+  // lane registers are spilled to these when a lane finishes
+  alignas(32) int32_t state[Lanes], top[Lanes], position[Lanes];
+  alignas(32) int32_t reductions[Lanes], active[Lanes];
+  uint32_t inputOf[Lanes];
+  size_t next = 0;
+  unsigned int running = Lanes;
+
+  auto refill = [&](unsigned int lane) {
+    state[lane] = 0;
+    top[lane] = 0;
+    reductions[lane] = 0;
+    this->stacks[lane] = 0;
+    if (next < starts.size()) {
+      inputOf[lane] = next;
+      position[lane] = starts[next++];
+      active[lane] = -1;
+    } else {
+      inputOf[lane] = NoInput;
+      position[lane] = 0;
+      active[lane] = 0;
+      --running;
+    }
+  };
+  for (unsigned int lane = 0; lane < Lanes; ++lane)
+    refill(lane);
+
+  __m256i vState = Load(state), vTop = Load(top), vPosition = Load(position);
+  __m256i vReductions = Load(reductions), vActive = Load(active);
+  __m256i depthLimit = _mm256_set1_epi32(this->depth - 1);
+  alignas(32) int32_t slot[Lanes], value[Lanes];
+
+  while (running > 0) {
+    const __m256i terminal = _mm256_i32gather_epi32(input, vPosition, 4);
+    const __m256i action = _mm256_i32gather_epi32(
+        actions,
+        _mm256_add_epi32(_mm256_mullo_epi32(vState, terminalCount), terminal),
+        4);
+    const __m256i type = _mm256_and_si256(action, three);
+    const __m256i num = _mm256_srli_epi32(action, 2);
+    const __m256i shift =
+        _mm256_and_si256(_mm256_cmpeq_epi32(type, one), vActive);
+    const __m256i reduce = _mm256_and_si256(
+        _mm256_cmpeq_epi32(type, _mm256_set1_epi32(ReduceAction)), vActive);
+    const __m256i finished =
+        _mm256_andnot_si256(_mm256_or_si256(shift, reduce), vActive);
+
+    // the goTo of reducing lanes from the state below the popped symbols
+    const __m256i length =
+        _mm256_mask_i32gather_epi32(zero, ruleLength, num, reduce, 4);
+    const __m256i lhs =
+        _mm256_mask_i32gather_epi32(zero, ruleLHS, num, reduce, 4);
+    const __m256i below = _mm256_sub_epi32(vTop, length);
+    const __m256i belowState = _mm256_mask_i32gather_epi32(
+        zero, this->stacks.data(),
+        _mm256_add_epi32(_mm256_slli_epi32(below, 3), lanes), reduce, 4);
+    const __m256i target = _mm256_mask_i32gather_epi32(
+        zero, goTo,
+        _mm256_add_epi32(
+            _mm256_mullo_epi32(belowState, nonTerminalCount), lhs),
+        reduce, 4);
+
+    const __m256i moved = _mm256_or_si256(shift, reduce);
+    vState = _mm256_blendv_epi8(
+        _mm256_blendv_epi8(vState, num, shift), target, reduce);
+    vTop = _mm256_sub_epi32(_mm256_blendv_epi8(vTop, below, reduce), moved);
+    vPosition = _mm256_sub_epi32(vPosition, shift);
+    vReductions = _mm256_sub_epi32(vReductions, reduce);
+
+    // AVX2 has no scatter, the new top states are stored lane by lane
+    if (_mm256_movemask_epi8(_mm256_cmpgt_epi32(vTop, depthLimit))) {
+      this->Grow();
+      depthLimit = _mm256_set1_epi32(this->depth - 1);
+    }
+    Store(slot, _mm256_add_epi32(_mm256_slli_epi32(vTop, 3), lanes));
+    Store(value, vState);
+    int32_t *stacks = this->stacks.data();
+    for (unsigned int mask = _mm256_movemask_ps(_mm256_castsi256_ps(moved));
+         mask != 0; mask &= mask - 1) {
+      const unsigned int lane = __builtin_ctz(mask);
+      stacks[slot[lane]] = value[lane];
+    }
+
+    const unsigned int done =
+        _mm256_movemask_ps(_mm256_castsi256_ps(finished));
+    if (done == 0) [[likely]]
+      continue;
+    Store(state, vState);
+    Store(top, vTop);
+    Store(position, vPosition);
+    Store(reductions, vReductions);
+    Store(active, vActive);
+    alignas(32) int32_t types[Lanes];
+    Store(types, type);
+    for (unsigned int mask = done; mask != 0; mask &= mask - 1) {
+      const unsigned int lane = __builtin_ctz(mask);
+      auto &result = results[inputOf[lane]];
+      result.accepted = types[lane] == AcceptAction;
+      result.errorPosition =
+          result.accepted ? 0 : position[lane] - starts[inputOf[lane]];
+      result.reductions = reductions[lane];
+      refill(lane);
+    }
+    vState = Load(state);
+    vTop = Load(top);
+    vPosition = Load(position);
+    vReductions = Load(reductions);
+    vActive = Load(active);
+  }
+}
+#endif
+
+} // namespace lrone
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "lrone.hpp"
+
+#include "table.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace lrone {
+
+enum class BatchKernel { Scalar, AVX2 };
+
+const char *BatchKernelName(BatchKernel kernel);
+// best kernel supported by the running CPU
+BatchKernel DetectBatchKernel();
+
+// Outcome of one input of a batch, the same as LRParser reports for it
+struct BatchResult {
+  bool accepted;
+  // position of the terminal that did not fit, counted from the start of the
+  // input
+  uint32_t errorPosition;
+  uint32_t reductions;
+
+  bool operator==(const BatchResult &rhs) const = default;
+};
+
+// Parser for many short inputs. Lanes of them advance in lockstep on one
+// thread, each lane does one shift or one reduction with its goTo per step.
+// The lane stacks are stored interleaved, depth after depth, and the table
+// is packed into flat arrays of 32-bit entries so that the AVX2 kernel can
+// look up all lanes with gathers. A lane whose input is accepted or rejected
+// takes the next input, so lanes only idle at the end of the batch. Both
+// kernels give the same results as LRParser.
+class BatchParser {
+public:
+  static constexpr unsigned int Lanes = 8;
+
+  // the table has to be complete, rows of a lazy table are not built
+  BatchParser(const LRTable &table, const Grammar &grammar);
+
+  // Parse every input of a concatenation, input i starts at starts[i] and
+  // ends with its $. Without AVX2 or with more than 2^31 terminals or table
+  // entries the scalar kernel is used.
+  void Parse(
+      std::span<const uint32_t> terminals, std::span<const uint32_t> starts,
+      std::vector<BatchResult> &results, BatchKernel kernel);
+
+  // bytes of the packed table
+  size_t TableBytes() const;
+
+private:
+  void ParseScalar(
+      std::span<const uint32_t> terminals, std::span<const uint32_t> starts,
+      std::vector<BatchResult> &results);
+#if defined(__x86_64__) || defined(__i386__)
+  __attribute__((target("avx2"))) void ParseAVX2(
+      std::span<const uint32_t> terminals, std::span<const uint32_t> starts,
+      std::vector<BatchResult> &results);
+#endif
+  // double the depth of the lane stacks
+  void Grow();
+
+  // action of state s on terminal t at s * terminals + t: 0 error,
+  // target << 2 | 1 shift, rule << 2 | 2 reduce, 3 accept
+  std::vector<int32_t> actions;
+  std::vector<int32_t> goTo;
+  std::vector<int32_t> ruleLength;
+  std::vector<int32_t> ruleLHS;
+  uint32_t terminals;
+  uint32_t nonTerminals;
+  uint32_t depth = 64;
+  // state of lane l at depth d in stacks[d * Lanes + l], kept between calls
+  std::vector<int32_t> stacks;
+};
+
+} // namespace lrone
@@ -0,0 +1,107 @@
+#include "benchmark.hpp"
+
+#include "output.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <numeric>
+#include <sched.h>
+#include <thread>
+
+namespace lrone {
+
+void PhaseStats::Summarize() {
+  if (this->samples.empty())
+    return;
+  auto sorted = this->samples;
+  std::sort(sorted.begin(), sorted.end());
+  const size_t n = sorted.size();
+
+  this->min = sorted.front();
+  this->median =
+      n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  this->mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / n;
+  // smallest sample with at least 99% of the samples at or below it
+  this->p99 = sorted[(99 * n + 99) / 100 - 1];
+
+  double squares = 0;
+  for (auto sample : sorted)
+    squares += (sample - this->mean) * (sample - this->mean);
+  this->stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+}
+
+void Benchmark::Display(const PhaseStats &stats) {
+  std::cout << stats.name << " time: " << stats.median << " us";
+  if (stats.samples.size() > 1) {
+    std::cout << " (median of " << stats.samples.size() << ", min "
+              << stats.min << ", mean " << stats.mean << ", p99 " << stats.p99
+              << ", stddev " << stats.stddev << ")";
+  }
+}
+
+// microseconds with a fixed number of decimals, OutputBuffer only formats
+// integers
+static std::string_view FormatMicroseconds(char (&buffer)[32], double value) {
+  auto length = std::snprintf(buffer, sizeof(buffer), "%.3f", value);
+  return std::string_view(buffer, std::max(length, 0));
+}
+
+bool Benchmark::WriteJSON(const char *filename) const {
+  OutputBuffer out(filename);
+  if (!out.IsOpen()) {
+    auto &err = Err();
+    err.Color(ANSI_COLOR_RED) << "Failed to write benchmark file: " << filename;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    return false;
+  }
+
+  char number[32];
+  out << "{\n  \"warmup\": " << this->warmup
+      << ",\n  \"iterations\": " << this->iterations
+      << ",\n  \"cpu\": " << this->cpu << ",\n  \"hardwareThreads\": "
+      << std::thread::hardware_concurrency() << ",\n  \"compiler\": ";
+  out.JSONString(__VERSION__);
+#ifdef NDEBUG
+  out << ",\n  \"assertions\": false";
+#else
+  out << ",\n  \"assertions\": true";
+#endif
+  for (const auto &[key, value] : this->properties) {
+    out << ",\n  ";
+    out.JSONString(key) << ": ";
+    out.JSONString(value);
+  }
+
+  out << ",\n  \"unit\": \"us\",\n  \"phases\": [";
+  for (size_t i = 0; i < this->phases.size(); ++i) {
+    const auto &stats = this->phases[i];
+    out << (i ? ",\n" : "\n") << "    {\"name\": ";
+    out.JSONString(stats.name);
+    out << ", \"min\": " << FormatMicroseconds(number, stats.min);
+    out << ", \"median\": " << FormatMicroseconds(number, stats.median);
+    out << ", \"mean\": " << FormatMicroseconds(number, stats.mean);
+    out << ", \"p99\": " << FormatMicroseconds(number, stats.p99);
+    out << ", \"stddev\": " << FormatMicroseconds(number, stats.stddev);
+    out << ",\n     \"samples\": [";
+    for (size_t s = 0; s < stats.samples.size(); ++s) {
+      out << (s ? ", " : "") << FormatMicroseconds(number, stats.samples[s]);
+    }
+    out << "]}";
+  }
+  out << "\n  ]\n}\n";
+  return true;
+}
+
+bool PinToCPU(unsigned int cpu) {
+  if (cpu >= CPU_SETSIZE)
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+} // namespace lrone
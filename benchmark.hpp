@@ -0,0 +1,81 @@
+#pragma once
+
+#include "lrone.hpp"
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lrone {
+
+// Timings of one phase in microseconds
+struct PhaseStats {
+  std::string name;
+  std::vector<double> samples; // in the order they were measured
+  double min = 0;
+  double median = 0;
+  double mean = 0;
+  double p99 = 0; // nearest rank
+  double stddev = 0; // of the sample, 0 for a single run
+
+  void Summarize();
+};
+
+// Repeated measurement of the phases of a run with the monotonic
+// steady_clock. Every phase runs warmup times untimed and then iterations
+// times timed. Outside of benchmark mode it is constructed with 0 and 1 so
+// every phase runs exactly once.
+class Benchmark {
+public:
+  Benchmark(unsigned int warmup, unsigned int iterations)
+      : warmup(warmup), iterations(iterations) {}
+
+  // setup runs untimed before every run, for example to reset the state the
+  // previous run left behind
+  template <typename Setup, typename Run>
+  const PhaseStats &Measure(const char *name, Setup setup, Run run) {
+    for (unsigned int i = 0; i < this->warmup; ++i) {
+      setup();
+      run();
+    }
+    auto &stats = this->phases.emplace_back();
+    stats.name = name;
+    stats.samples.reserve(this->iterations);
+    for (unsigned int i = 0; i < this->iterations; ++i) {
+      setup();
+      auto start = std::chrono::steady_clock::now();
+      run();
+      auto end = std::chrono::steady_clock::now();
+      stats.samples.push_back(
+          std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    stats.Summarize();
+    return stats;
+  }
+  template <typename Run>
+  const PhaseStats &Measure(const char *name, Run run) {
+    return this->Measure(name, [] {}, run);
+  }
+
+  // "<name> time: <median> us (min ..., mean ..., p99 ..., stddev ...)"
+  // without a line break, a single run only shows its time
+  static void Display(const PhaseStats &stats);
+
+  // settings, the given properties and every phase with its samples
+  bool WriteJSON(const char *filename) const;
+
+  const unsigned int warmup;
+  const unsigned int iterations;
+  int cpu = -1; // pinned CPU or -1
+  // strings describing the run, such as the grammar and input files
+  std::vector<std::pair<std::string, std::string>> properties;
+  std::deque<PhaseStats> phases;
+};
+
+// Restrict the calling thread and the threads it starts afterwards to one
+// CPU, false if that is not possible
+bool PinToCPU(unsigned int cpu);
+
+} // namespace lrone
@@ -0,0 +1,155 @@
+#include "context.hpp"
+
+#include <cctype>
+#include <sstream>
+
+namespace lrone {
+
+Context::Context(const ContextOptions &options) : options(options) {}
+
+Context::~Context() = default;
+
+Error Context::LoadGrammar(std::string_view text) {
+  PROFILE_FUNC;
+  if (this->options.lazy &&
+      (this->options.unitElimination || this->options.minimal)) {
+    return {
+        Error::Code::InvalidOptions,
+        "A lazy table cannot bypass unit rules or be minimal"};
+  }
+
+  // the parser and the terminal names refer to the previous grammar
+  this->parser.reset();
+  this->lazy.reset();
+  this->terminalIds.clear();
+  this->lexer = {};
+
+  std::istringstream grammarFile{std::string(text)};
+  this->grammar = Grammar(grammarFile);
+  this->reduction = {};
+  if (this->options.reduce || this->options.renumber) {
+    auto warnings = std::move(this->grammar.warnings);
+    this->grammar =
+        ReduceGrammar(this->grammar, this->options.renumber, this->reduction);
+    this->grammar.warnings = std::move(warnings);
+  }
+  this->grammar.Calculate();
+  if (auto error = Lexer::Build(this->grammar, this->lexer))
+    return error;
+
+  if (this->options.lazy) {
+    this->lazy = std::make_unique<LazyTable>(this->grammar);
+    this->parser = std::make_unique<LRParser>(*this->lazy, this->grammar);
+  } else {
+    this->table = this->options.minimal ? GenerateMinimalTable(this->grammar)
+                                        : GenerateTable(this->grammar);
+    if (this->options.unitElimination)
+      EliminateUnitRules(this->table, this->grammar);
+    this->parser = std::make_unique<LRParser>(this->table, this->grammar);
+  }
+
+  // $ ends every input and is not looked up by name
+  for (uint32_t t = 1; t < this->grammar.terminals.size(); ++t)
+    this->terminalIds.emplace(this->grammar.terminals[t], t);
+  for (const auto &name : this->grammar.removedTerminals)
+    this->terminalIds.emplace(name, this->grammar.removedTerminal);
+  return {};
+}
+
+Error Context::LoadGrammarFile(const std::string &filename) {
+  std::string text;
+  if (auto error = Grammar::ReadFile(filename, text))
+    return error;
+  return this->LoadGrammar(text);
+}
+
+Error Context::Terminals(
+    std::string_view text, std::vector<uint32_t> &input) const {
+  if (!this->parser)
+    return {Error::Code::NoGrammar, "No grammar loaded"};
+
+  if (this->lexer.Enabled())
+    return this->lexer.Lex(text, input);
+
+  input.clear();
+  auto isSpace = [](char c) {
+    return std::isspace(static_cast<unsigned char>(c)) != 0;
+  };
+  for (size_t start = 0; start < text.size();) {
+    if (isSpace(text[start])) {
+      ++start;
+      continue;
+    }
+    size_t end = start;
+    while (end < text.size() && !isSpace(text[end]))
+      ++end;
+    auto name = text.substr(start, end - start);
+    auto terminal = this->terminalIds.find(name);
+    if (terminal == this->terminalIds.end()) {
+      return {
+          Error::Code::UnknownTerminal,
+          "Unknown terminal in input: " + std::string(name)};
+    }
+    input.push_back(terminal->second);
+    start = end;
+  }
+  input.push_back(0); // $
+  return {};
+}
+
+Error Context::Parse(std::span<const uint32_t> input, ParseResult &result) {
+  PROFILE_FUNC;
+  result = {};
+  if (!this->parser)
+    return {Error::Code::NoGrammar, "No grammar loaded"};
+
+  if (input.empty() || input.back() != 0) {
+    return {Error::Code::InvalidInput, "Input does not end with $"};
+  }
+  const size_t terminalCount = this->grammar.terminals.size();
+  for (size_t i = 0; i + 1 < input.size(); ++i) {
+    if (input[i] == 0 || input[i] >= terminalCount) {
+      return {
+          Error::Code::InvalidInput,
+          "Invalid terminal id " + std::to_string(input[i]) + " at position " +
+              std::to_string(i)};
+    }
+  }
+
+  auto &parser = *this->parser;
+  result.accepted = parser.Parse<DepthParse<SilentParse>>(input);
+  result.reductions = parser.reductions;
+  result.maxDepth = parser.maxDepth;
+  if (!result.accepted) {
+    result.errorPosition = parser.errorPosition;
+    result.errorState = parser.errorState;
+  }
+  return {};
+}
+
+Error Context::Start(ParseState &state) {
+  if (!this->parser)
+    return {Error::Code::NoGrammar, "No grammar loaded"};
+  state = ParseState(*this->parser);
+  return {};
+}
+
+std::string Context::Describe(
+    std::span<const uint32_t> input, const ParseResult &result) const {
+  if (result.accepted || !this->parser ||
+      result.errorPosition >= input.size())
+    return {};
+
+  const auto &row = this->Table().actions[result.errorState];
+  auto message = "Found terminal " +
+                 this->grammar.terminals[input[result.errorPosition]] +
+                 " at position " + std::to_string(result.errorPosition) +
+                 " expected one of";
+  for (unsigned int t = 0; t < row.size(); ++t) {
+    if (row[t].type != LRAction::Type::Error)
+      message += ' ' + this->grammar.terminals[t];
+  }
+  return message;
+}
+
+} // namespace lrone
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "lrone.hpp"
+
+#include "grammar.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "table.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace lrone {
+
+// terminal ids are passed as uint32_t, the parser stores them as unsigned int
+static_assert(sizeof(unsigned int) == sizeof(uint32_t));
+
+struct ContextOptions {
+  bool unitElimination = false; // see EliminateUnitRules
+  bool reduce = false;          // see ReduceGrammar
+  bool renumber = false;        // reduce and order symbols by use
+  bool lazy = false;            // build table rows while parsing
+  bool minimal = false;         // see GenerateMinimalTable
+};
+
+// Outcome of Context::Parse
+struct ParseResult {
+  bool accepted = false;
+  // position of the terminal that did not fit and the state it was found in
+  size_t errorPosition = 0;
+  uint32_t errorState = 0;
+  size_t reductions = 0;
+  size_t maxDepth = 0;
+};
+
+// Grammar, parsing table and parser of one embedding of the library. Nothing
+// is printed and nothing exits, failures are returned as Error. Contexts share
+// no state, so every thread can parse with its own. A context keeps its
+// parser stacks between calls and is not safe to share between threads.
+class Context {
+public:
+  explicit Context(const ContextOptions &options = {});
+  ~Context();
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
+
+  // replace the grammar and build its parsing table, problems in the grammar
+  // that were skipped are listed in grammar.warnings
+  Error LoadGrammar(std::string_view text);
+  Error LoadGrammarFile(const std::string &filename);
+
+  // ids of the tokens of the text followed by $. Without %token definitions
+  // the tokens are terminal names separated by whitespace and the text itself
+  // can not contain $.
+  Error Terminals(std::string_view text, std::vector<uint32_t> &input) const;
+  // the input has to end with $ (0) and contain it nowhere else, a rejected
+  // input is no error
+  Error Parse(std::span<const uint32_t> input, ParseResult &result);
+  // incremental parse of a new input that can be forked to try continuations,
+  // the state must not outlive the grammar loaded now
+  Error Start(ParseState &state);
+  // "Found terminal ... at position ... expected one of ..." for a rejected
+  // input
+  std::string Describe(
+      std::span<const uint32_t> input, const ParseResult &result) const;
+
+  bool Loaded() const { return this->parser != nullptr; }
+  // rows of a lazy table are only complete for the states visited so far
+  const LRTable &Table() const { return *this->parser->table; }
+
+  const ContextOptions options;
+  Grammar grammar;
+  // what the reduce option removed
+  GrammarReduction reduction;
+
+private:
+  LRTable table;
+  std::unique_ptr<LazyTable> lazy;
+  std::unique_ptr<LRParser> parser;
+  Lexer lexer;
+  // keys point into grammar.terminals
+  std::unordered_map<std::string_view, uint32_t> terminalIds;
+};
+
+} // namespace lrone
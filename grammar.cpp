@@ -1,8 +1,11 @@
 #include "grammar.hpp"
 
+#include "output.hpp"
+
 #include <fstream>
-#include <iomanip>
 #include <map>
+#include <set>
+#include <sstream>
 
 namespace lrone {
 
@@ -11,20 +14,149 @@ bool Symbol::operator==(const Symbol &rhs) const {
 }
 
 void Symbol::Display(const Grammar &grammar) const {
+  auto &out = Out();
   switch (this->type) {
   case Symbol::Type::Terminal:
-    std::cout << ANSI_COLOR_MAGENTA << grammar.terminals[this->id]
-              << ANSI_COLOR_RESET;
+    out.Color(ANSI_COLOR_MAGENTA) << grammar.terminals[this->id];
+    out.Color(ANSI_COLOR_RESET);
     break;
   case Symbol::Type::NonTerminal:
-    std::cout << ANSI_COLOR_CYAN << grammar.nonTerminals[this->id]
-              << ANSI_COLOR_RESET;
+    out.Color(ANSI_COLOR_CYAN) << grammar.nonTerminals[this->id];
+    out.Color(ANSI_COLOR_RESET);
     break;
   }
 }
 
 Grammar::Grammar() { AddTerminal("EOF"); }
 
+namespace {
+
+// Lowers the EBNF operators of one rule line to helper non-terminals. Items
+// naming a symbol are always taken as that symbol, so the operators only apply
+// where they cannot be confused with terminals like ( or +. Repetitions are
+// left recursive so that the parse stack does not grow with the list length.
+struct EBNFLowering {
+  Grammar &grammar;
+  std::map<std::string, unsigned long> &terminalsMap;
+  std::map<std::string, unsigned long> &nonTerminalsMap;
+  const std::vector<std::string> &items;
+  size_t position = 0;
+
+  // helper non-terminal with the given name, returns false in second if it
+  // already existed and must not get its rules again
+  std::pair<Symbol, bool> Helper(const std::string &name) {
+    if (nonTerminalsMap.contains(name))
+      return {{Symbol::Type::NonTerminal, nonTerminalsMap[name]}, false};
+    unsigned long id = grammar.nonTerminals.size();
+    nonTerminalsMap[name] = id;
+    grammar.AddNonTerminal(name);
+    return {{Symbol::Type::NonTerminal, id}, true};
+  }
+
+  // X+ → X | X+ X, X* → ε | X+, X? → ε | X where X is a sequence
+  Symbol Repeat(
+      const std::vector<Symbol> &sequence, const std::string &name, char op) {
+    auto [helper, created] = Helper(name + op);
+    if (!created)
+      return helper;
+    switch (op) {
+    case '+': {
+      grammar.AddRule(helper.id, sequence);
+      auto rhs = sequence;
+      rhs.insert(rhs.begin(), helper);
+      grammar.AddRule(helper.id, rhs);
+    } break;
+    case '*':
+      grammar.AddRule(helper.id, {});
+      grammar.AddRule(helper.id, {Repeat(sequence, name, '+')});
+      break;
+    case '?':
+      grammar.AddRule(helper.id, {});
+      grammar.AddRule(helper.id, sequence);
+      break;
+    }
+    return helper;
+  }
+
+  static bool IsOperator(char c) { return c == '*' || c == '+' || c == '?'; }
+  static bool IsClose(const std::string &item) {
+    return item == ")" || (item.size() == 2 && item[0] == ')' &&
+                           IsOperator(item[1]));
+  }
+
+  bool Lookup(const std::string &name, Symbol &symbol) {
+    if (terminalsMap.contains(name)) {
+      symbol = {Symbol::Type::Terminal, terminalsMap[name]};
+      return true;
+    }
+    if (nonTerminalsMap.contains(name)) {
+      symbol = {Symbol::Type::NonTerminal, nonTerminalsMap[name]};
+      return true;
+    }
+    return false;
+  }
+
+  // sequences separated by | up to the end of the line or a closing ')',
+  // which is left unconsumed
+  std::vector<std::vector<Symbol>> Alternatives(bool inGroup) {
+    std::vector<std::vector<Symbol>> alternatives(1);
+    while (position < items.size()) {
+      const auto &item = items[position];
+      Symbol symbol;
+      if (Lookup(item, symbol)) {
+        alternatives.back().push_back(symbol);
+      } else if (item == "|") {
+        alternatives.emplace_back();
+      } else if (IsClose(item)) {
+        return alternatives;
+      } else if (item == "(") {
+        auto first = ++position;
+        auto group = Alternatives(true);
+        if (position == items.size()) {
+          grammar.warnings.push_back("Missing ')' for group, ignoring");
+          return alternatives;
+        }
+
+        std::string name = "(";
+        for (auto i = first; i < position; ++i)
+          name += (i == first ? "" : " ") + items[i];
+        name += ')';
+        const auto &close = items[position];
+        auto &sequence = alternatives.back();
+        if (group.size() == 1 && close.size() == 1) {
+          // plain sequence, no helper needed
+          sequence.insert(sequence.end(), group[0].begin(), group[0].end());
+        } else if (group.size() == 1) {
+          sequence.push_back(Repeat(group[0], name, close[1]));
+        } else {
+          auto [helper, created] = Helper(name);
+          if (created) {
+            for (const auto &rhs : group)
+              grammar.AddRule(helper.id, rhs);
+          }
+          if (close.size() == 2)
+            helper = Repeat({helper}, name, close[1]);
+          sequence.push_back(helper);
+        }
+      } else if (
+          item.size() > 1 && IsOperator(item.back()) &&
+          Lookup(item.substr(0, item.size() - 1), symbol)) {
+        auto name = item.substr(0, item.size() - 1);
+        alternatives.back().push_back(Repeat({symbol}, name, item.back()));
+      } else {
+        grammar.warnings.push_back(
+            "Unknown symbol '" + item + "', ignoring");
+      }
+      ++position;
+    }
+    if (inGroup)
+      position = items.size(); // no closing ')'
+    return alternatives;
+  }
+};
+
+} // namespace
+
 Grammar::Grammar(std::istream &grammarFile) {
   PROFILE_FUNC;
   AddTerminal("$");
@@ -42,10 +174,9 @@ Grammar::Grammar(std::istream &grammarFile) {
       auto name = std::string(start, end);
 
       if (terminalsMap.contains(name)) {
-        std::cerr << ANSI_COLOR_YELLOW
-                  << "Warning: Attempted to insert new terminal symbol '"
-                  << name << "' when existing terminal with same name exists"
-                  << ANSI_COLOR_RESET << std::endl;
+        this->warnings.push_back(
+            "Attempted to insert new terminal symbol '" + name +
+            "' when existing terminal with same name exists");
       }
 
       terminalsMap[name] = terminalsMap.size();
@@ -69,18 +200,15 @@ Grammar::Grammar(std::istream &grammarFile) {
       auto name = std::string(start, end);
 
       if (terminalsMap.contains(name)) {
-        std::cerr << ANSI_COLOR_YELLOW
-                  << "Warning: Attempted to insert new non-terminal symbol '"
-                  << name << "' when existing terminal with same name exists"
-                  << ANSI_COLOR_RESET << std::endl;
+        this->warnings.push_back(
+            "Attempted to insert new non-terminal symbol '" + name +
+            "' when existing terminal with same name exists");
       }
 
       if (nonTerminalsMap.contains(name)) {
-        std::cerr << ANSI_COLOR_YELLOW
-                  << "Warning: Attempted to insert new non-terminal symbol '"
-                  << name
-                  << "' when existing non-terminal with same name exists"
-                  << ANSI_COLOR_RESET << std::endl;
+        this->warnings.push_back(
+            "Attempted to insert new non-terminal symbol '" + name +
+            "' when existing non-terminal with same name exists");
       }
       nonTerminalsMap[name] = nonTerminalsMap.size();
       this->AddNonTerminal(std::string(start, end));
@@ -91,12 +219,66 @@ Grammar::Grammar(std::istream &grammarFile) {
 
   AddRule(0, std::vector<Symbol>{{.type = Symbol::Type::NonTerminal, .id = 1}});
 
+  unsigned int precedenceLevel = 0;
   while (!grammarFile.eof()) {
     std::string rule;
     std::getline(grammarFile, rule);
     if (rule.length() == 0)
       continue;
 
+    if (rule[0] == '%') { // precedence declaration or token definition
+      auto start = rule.begin();
+      auto end = std::find(start, rule.end(), ' ');
+      auto directive = std::string(start, end);
+      if (directive == "%token" || directive == "%skip") {
+        // the pattern is the rest of the line and may contain spaces
+        std::string name;
+        if (directive == "%token" && end != rule.end()) {
+          start = end + 1;
+          end = std::find(start, rule.end(), ' ');
+          name = std::string(start, end);
+        }
+        auto pattern = end == rule.end() ? std::string()
+                                         : std::string(end + 1, rule.end());
+        if (pattern.empty()) {
+          this->warnings.push_back(
+              "Missing pattern, ignoring line '" + rule + "'");
+        } else if (directive == "%token" && !terminalsMap.contains(name)) {
+          this->warnings.push_back(
+              "Unknown terminal '" + name + "' in token definition, ignoring");
+        } else {
+          this->tokenDefinitions.push_back({name, pattern});
+        }
+        continue;
+      }
+      Precedence precedence{
+          Precedence::Associativity::Left, ++precedenceLevel};
+      if (directive == "%right") {
+        precedence.associativity = Precedence::Associativity::Right;
+      } else if (directive == "%nonassoc") {
+        precedence.associativity = Precedence::Associativity::NonAssoc;
+      } else if (directive != "%left") {
+        this->warnings.push_back(
+            "Unknown directive '" + directive + "', ignoring line '" + rule +
+            "'");
+        continue;
+      }
+
+      while (end != rule.end()) {
+        start = end + 1;
+        end = std::find(start, rule.end(), ' ');
+        auto name = std::string(start, end);
+        if (terminalsMap.contains(name)) {
+          this->terminalPrecedence[terminalsMap[name]] = precedence;
+        } else {
+          this->warnings.push_back(
+              "Unknown terminal '" + name +
+              "' in precedence declaration, ignoring");
+        }
+      }
+      continue;
+    }
+
     // find LHS
     unsigned long lhs;
     auto start = rule.begin();
@@ -105,51 +287,72 @@ Grammar::Grammar(std::istream &grammarFile) {
     if (nonTerminalsMap.contains(nt)) {
       lhs = nonTerminalsMap[nt];
     } else {
-      std::cerr << ANSI_COLOR_RED << "Unknown non-terminal '" << nt
-                << "', ignoring rule '" << rule << ANSI_COLOR_RESET
-                << std::endl;
+      this->warnings.push_back(
+          "Unknown non-terminal '" + nt + "', ignoring rule '" + rule + "'");
       continue;
     }
 
-    // find RHS
-    std::vector<Symbol> rhs;
+    // split RHS into items, the terminal following %prec is taken out
+    std::vector<std::string> items;
+    unsigned long precedenceTerminal = 0;
+    bool precedenceNext = false;
     start = end + 1;
     while (end != rule.end()) {
       end = std::find(start, rule.end(), ' ');
       auto item = std::string(start, end);
-      if (terminalsMap.contains(item)) {
-        rhs.push_back(
-            {.type = Symbol::Type::Terminal, .id = terminalsMap[item]});
-      } else if (nonTerminalsMap.contains(item)) {
-        rhs.push_back(
-            {.type = Symbol::Type::NonTerminal, .id = nonTerminalsMap[item]});
+      if (precedenceNext) { // terminal following %prec
+        precedenceNext = false;
+        if (terminalsMap.contains(item)) {
+          precedenceTerminal = terminalsMap[item];
+        } else {
+          this->warnings.push_back(
+              "Unknown terminal '" + item + "' after %prec, ignoring");
+        }
+      } else if (item == "%prec") {
+        precedenceNext = true;
       } else {
-        std::cerr << ANSI_COLOR_RED << "Unknown symbol '" << item
-                  << "', ignoring" << ANSI_COLOR_RESET << std::endl;
+        items.push_back(item);
       }
 
       start = end + 1;
     }
 
-    this->AddRule(lhs, rhs);
+    EBNFLowering lowering{*this, terminalsMap, nonTerminalsMap, items};
+    auto alternatives = lowering.Alternatives(false);
+    if (lowering.position != items.size()) {
+      this->warnings.push_back(
+          "Unbalanced ')' in rule '" + rule + "', ignoring the rest");
+    }
+    for (const auto &rhs : alternatives) {
+      this->AddRule(lhs, rhs, precedenceTerminal);
+    }
   }
 }
 
-Grammar Grammar::FromFile(const std::string &filename) {
+Error Grammar::ReadFile(const std::string &filename, std::string &text) {
   std::ifstream grammarFile(filename);
   if (!grammarFile.is_open()) {
-    std::cerr << ANSI_COLOR_RED << "Failed to open Grammar file: " << filename
-              << ANSI_COLOR_RESET << std::endl;
-    std::exit(EXIT_FAILURE);
+    return {
+        Error::Code::OpenFailed, "Failed to open Grammar file: " + filename};
   }
-  std::cout << ANSI_COLOR_GREEN << "Loading grammar from file: " << filename
-            << ANSI_COLOR_RESET << std::endl;
+  std::ostringstream contents;
+  contents << grammarFile.rdbuf();
+  text = std::move(contents).str();
+  return {};
+}
 
-  return Grammar(grammarFile);
+Error Grammar::FromFile(const std::string &filename, Grammar &grammar) {
+  std::string text;
+  if (auto error = ReadFile(filename, text))
+    return error;
+  std::istringstream grammarFile(text);
+  grammar = Grammar(grammarFile);
+  return {};
 }
 
 void Grammar::AddTerminal(const std::string &name) {
   terminals.push_back(name);
+  terminalPrecedence.push_back({Precedence::Associativity::NonAssoc, 0});
 }
 
 void Grammar::AddNonTerminal(const std::string &name) {
@@ -157,66 +360,8 @@ void Grammar::AddNonTerminal(const std::string &name) {
   first.push_back({});
 }
 
-static unsigned int first_nt_recursion_depth = 0;
-
 std::vector<unsigned int> Grammar::FirstNonTerminal(unsigned int nt) const {
-  PROFILE_FUNC;
-  if (!this->first[nt].empty())
-    return this->first[nt];
-
-  first_nt_recursion_depth += 1;
-
-  if (first_nt_recursion_depth > 100) {
-    std::cerr << "Infinite recursion detected while determining FIRST()"
-              << std::endl;
-    std::exit(EXIT_FAILURE);
-  }
-
-  std::vector<unsigned int> result;
-
-  for (const auto &rule : this->rules) {
-    if (rule.first != nt)
-      continue;
-
-    if (rule.second.size() == 0) { // null production
-      result.push_back(0);         // null terminal
-      continue;
-    }
-
-    for (const auto &symbol : rule.second) {
-      switch (symbol.type) {
-      case Symbol::Type::Terminal:
-        // nothing following a terminal can be in first
-        result.push_back(symbol.id);
-        goto donerule;
-      case Symbol::Type::NonTerminal:
-        if (symbol.id == nt) { // same production recursion
-          goto donerule;       // ignore
-        }
-        auto start = this->FirstNonTerminal(symbol.id);
-        auto null_index = std::find(start.begin(), start.end(), 0);
-        if (null_index == start.end()) {
-          // null not in start so nothing following can be in start
-          result.insert(result.end(), start.begin(), start.end());
-          goto donerule;
-        } else {
-          // null in start so consider next symbols
-          start.erase(null_index);
-          result.insert(result.end(), start.begin(), start.end());
-        }
-        break;
-      }
-    }
-  donerule:
-    continue;
-  }
-
-  // remove duplicates
-  std::sort(result.begin(), result.end());
-  result.erase(std::unique(result.begin(), result.end()), result.end());
-
-  first_nt_recursion_depth -= 1;
-  return result;
+  return this->first[nt];
 }
 
 std::vector<unsigned int> Grammar::First(
@@ -259,48 +404,506 @@ done:
   return result;
 }
 
-void Grammar::AddRule(const unsigned int lhs, const std::vector<Symbol> &rhs) {
+void Grammar::AddRule(
+    const unsigned int lhs, const std::vector<Symbol> &rhs,
+    unsigned long precedenceTerminal) {
   rules.push_back({lhs, rhs});
+  rulePrecedenceTerminal.push_back(precedenceTerminal);
+}
+
+Precedence Grammar::RulePrecedence(unsigned long rule) const {
+  if (this->rulePrecedenceTerminal[rule] != 0)
+    return this->terminalPrecedence[this->rulePrecedenceTerminal[rule]];
+
+  const auto &rhs = this->rules[rule].second;
+  for (auto it = rhs.rbegin(); it != rhs.rend(); ++it) {
+    if (it->type == Symbol::Type::Terminal &&
+        this->terminalPrecedence[it->id].level != 0)
+      return this->terminalPrecedence[it->id];
+  }
+  return {Precedence::Associativity::NonAssoc, 0};
 }
 
 void Grammar::Calculate() {
+  this->Calculate(std::vector<bool>(this->nonTerminals.size(), true));
+}
+
+// The sets grow until no rule adds to them, so left recursion of any depth
+// needs no special case. 0 stands for the empty string, $ never appears in
+// a rule.
+void Grammar::Calculate(const std::vector<bool> &recompute) {
   PROFILE_FUNC;
-  for (unsigned int i = 0; i < this->first.size(); i++) {
-    this->first[i] = FirstNonTerminal(i);
+  const auto count = this->nonTerminals.size();
+  std::vector<TerminalSet> sets(count, TerminalSet(this->terminals.size()));
+  for (size_t nt = 0; nt < count; ++nt) {
+    if (!recompute[nt]) {
+      for (auto terminal : this->first[nt])
+        sets[nt].Set(terminal);
+    }
+  }
+
+  // OR without the empty string, returns true if anything was added
+  auto mergeNonEmpty = [](TerminalSet &to, const TerminalSet &from) {
+    uint64_t added = 0;
+    for (size_t i = 0; i < to.words.size(); ++i) {
+      auto bits = from.words[i] & ~to.words[i];
+      if (i == 0)
+        bits &= ~uint64_t(1);
+      to.words[i] |= bits;
+      added |= bits;
+    }
+    return added != 0;
+  };
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (const auto &[lhs, rhs] : this->rules) {
+      if (!recompute[lhs])
+        continue;
+      auto &set = sets[lhs];
+      bool empty = true;
+      for (const auto &symbol : rhs) {
+        if (symbol.type == Symbol::Type::Terminal) {
+          if (!set.Test(symbol.id)) {
+            set.Set(symbol.id);
+            changed = true;
+          }
+          empty = false;
+          break;
+        }
+        changed |= mergeNonEmpty(set, sets[symbol.id]);
+        if (!sets[symbol.id].Test(0)) {
+          empty = false;
+          break;
+        }
+      }
+      if (empty && !set.Test(0)) {
+        set.Set(0);
+        changed = true;
+      }
+    }
   }
+
+  for (size_t nt = 0; nt < count; ++nt) {
+    if (!recompute[nt])
+      continue;
+    this->first[nt].clear();
+    sets[nt].ForEach(
+        [&](unsigned int terminal) { this->first[nt].push_back(terminal); });
+  }
+}
+
+template <typename T> static size_t VectorBytes(const std::vector<T> &v) {
+  return v.capacity() * sizeof(T);
+}
+
+static size_t StringBytes(const std::string &s) {
+  // short strings are stored inline
+  return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+}
+
+size_t Grammar::MemoryUsage() const {
+  size_t bytes = VectorBytes(this->terminals) +
+                 VectorBytes(this->nonTerminals) + VectorBytes(this->rules) +
+                 VectorBytes(this->first) +
+                 VectorBytes(this->terminalPrecedence) +
+                 VectorBytes(this->rulePrecedenceTerminal);
+  for (const auto &name : this->terminals)
+    bytes += StringBytes(name);
+  for (const auto &name : this->nonTerminals)
+    bytes += StringBytes(name);
+  for (const auto &rule : this->rules)
+    bytes += VectorBytes(rule.second);
+  for (const auto &set : this->first)
+    bytes += VectorBytes(set);
+  return bytes;
+}
+
+std::vector<unsigned long> Grammar::RightRecursiveRules() const {
+  PROFILE_FUNC;
+  const auto count = this->nonTerminals.size();
+  std::vector<bool> nullable(count, false);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (const auto &rule : this->rules) {
+      if (nullable[rule.first])
+        continue;
+      if (std::all_of(
+              rule.second.begin(), rule.second.end(), [&](const Symbol &s) {
+                return s.type == Symbol::Type::NonTerminal && nullable[s.id];
+              })) {
+        nullable[rule.first] = true;
+        changed = true;
+      }
+    }
+  }
+
+  // A reaches B if some rule of A ends in B up to nullable symbols, every
+  // step of such a chain leaves the parse stack as it is
+  std::vector<std::vector<unsigned int>> tails(count);
+  for (const auto &rule : this->rules) {
+    for (auto it = rule.second.rbegin(); it != rule.second.rend(); ++it) {
+      if (it->type != Symbol::Type::NonTerminal)
+        break;
+      tails[rule.first].push_back(it->id);
+      if (!nullable[it->id])
+        break;
+    }
+  }
+
+  // A rule of A ending in B makes A reach B, so B reaches back to A exactly
+  // if both are in one strongly connected component. Tarjan's algorithm
+  // finds them in linear time, with an explicit stack of (node, next edge).
+  constexpr unsigned int Unvisited = ~0u;
+  std::vector<unsigned int> component(count, Unvisited);
+  std::vector<unsigned int> index(count, Unvisited), low(count);
+  std::vector<unsigned int> open;
+  std::vector<std::pair<unsigned int, size_t>> path;
+  unsigned int visited = 0, components = 0;
+  for (unsigned int root = 0; root < count; ++root) {
+    if (index[root] != Unvisited)
+      continue;
+    path.push_back({root, 0});
+    index[root] = low[root] = visited++;
+    open.push_back(root);
+    while (!path.empty()) {
+      auto &[node, edge] = path.back();
+      if (edge < tails[node].size()) {
+        const auto next = tails[node][edge++];
+        if (index[next] == Unvisited) {
+          index[next] = low[next] = visited++;
+          open.push_back(next);
+          path.push_back({next, 0});
+        } else if (component[next] == Unvisited) {
+          low[node] = std::min(low[node], index[next]);
+        }
+        continue;
+      }
+      const auto done = node;
+      path.pop_back();
+      if (!path.empty())
+        low[path.back().first] = std::min(low[path.back().first], low[done]);
+      if (low[done] == index[done]) {
+        unsigned int member;
+        do {
+          member = open.back();
+          open.pop_back();
+          component[member] = components;
+        } while (member != done);
+        ++components;
+      }
+    }
+  }
+
+  // a rule grows the stack if it reaches back to its LHS through a tail
+  // after symbols that cannot all be empty
+  std::vector<unsigned long> result;
+  for (unsigned long r = 0; r < this->rules.size(); ++r) {
+    const auto &[lhs, rhs] = this->rules[r];
+    // precedence resolves the recursion with reduces unless right associative
+    auto precedence = this->RulePrecedence(r);
+    if (precedence.level != 0 &&
+        precedence.associativity != Precedence::Associativity::Right)
+      continue;
+    for (size_t i = rhs.size(); i-- > 0;) {
+      const auto &symbol = rhs[i];
+      if (symbol.type != Symbol::Type::NonTerminal)
+        break;
+      bool prefixNullable = std::all_of(
+          rhs.begin(), rhs.begin() + i, [&](const Symbol &s) {
+            return s.type == Symbol::Type::NonTerminal && nullable[s.id];
+          });
+      if (!prefixNullable &&
+          component[symbol.id] == component[lhs]) {
+        result.push_back(r);
+        break;
+      }
+      if (!nullable[symbol.id])
+        break;
+    }
+  }
+  return result;
+}
+
+Grammar ReduceGrammar(
+    const Grammar &grammar, bool renumber, GrammarReduction &reduction) {
+  PROFILE_FUNC;
+  const auto terminalCount = grammar.terminals.size();
+  const auto nonTerminalCount = grammar.nonTerminals.size();
+  const auto ruleCount = grammar.rules.size();
+  reduction = GrammarReduction();
+
+  // productive non-terminals, a rule becomes productive once the last
+  // non-terminal occurrence on its right hand side did
+  std::vector<bool> productive(nonTerminalCount, false);
+  std::vector<unsigned int> pending(ruleCount, 0);
+  std::vector<std::vector<unsigned long>> occurrences(nonTerminalCount);
+  std::vector<unsigned long> work;
+  for (unsigned long r = 0; r < ruleCount; ++r) {
+    for (const auto &symbol : grammar.rules[r].second) {
+      if (symbol.type == Symbol::Type::NonTerminal) {
+        occurrences[symbol.id].push_back(r);
+        ++pending[r];
+      }
+    }
+    if (pending[r] == 0 && !productive[grammar.rules[r].first]) {
+      productive[grammar.rules[r].first] = true;
+      work.push_back(grammar.rules[r].first);
+    }
+  }
+  while (!work.empty()) {
+    auto nt = work.back();
+    work.pop_back();
+    for (auto r : occurrences[nt]) {
+      if (--pending[r] == 0 && !productive[grammar.rules[r].first]) {
+        productive[grammar.rules[r].first] = true;
+        work.push_back(grammar.rules[r].first);
+      }
+    }
+  }
+
+  // reachable from the start through rules of productive symbols only
+  std::vector<std::vector<unsigned long>> rulesOf(nonTerminalCount);
+  for (unsigned long r = 0; r < ruleCount; ++r) {
+    if (pending[r] == 0)
+      rulesOf[grammar.rules[r].first].push_back(r);
+  }
+  std::vector<bool> reachable(nonTerminalCount, false);
+  for (unsigned long nt : {0ul, 1ul}) {
+    if (nt < nonTerminalCount && !reachable[nt]) {
+      reachable[nt] = true;
+      work.push_back(nt);
+    }
+  }
+  while (!work.empty()) {
+    auto nt = work.back();
+    work.pop_back();
+    for (auto r : rulesOf[nt]) {
+      for (const auto &symbol : grammar.rules[r].second) {
+        if (symbol.type == Symbol::Type::NonTerminal &&
+            !reachable[symbol.id]) {
+          reachable[symbol.id] = true;
+          work.push_back(symbol.id);
+        }
+      }
+    }
+  }
+
+  // S' and the start symbol are kept even if the language is empty
+  std::vector<bool> keepNonTerminal(nonTerminalCount, false);
+  for (unsigned long nt = 0; nt < nonTerminalCount; ++nt) {
+    if (nt <= 1 || (productive[nt] && reachable[nt])) {
+      keepNonTerminal[nt] = true;
+    } else if (!productive[nt]) {
+      reduction.unproductive.push_back(nt);
+    } else {
+      reduction.unreachable.push_back(nt);
+    }
+  }
+
+  // remaining rules without repetitions, and how often each symbol is used
+  std::vector<unsigned long> terminalUses(terminalCount, 0);
+  std::vector<unsigned long> nonTerminalUses(nonTerminalCount, 0);
+  std::set<std::vector<unsigned long>> seen;
+  for (unsigned long r = 0; r < ruleCount; ++r) {
+    const auto &rule = grammar.rules[r];
+    if (r != 0 && (pending[r] != 0 || !reachable[rule.first])) {
+      reduction.uselessRules.push_back(r);
+      continue;
+    }
+    std::vector<unsigned long> key{rule.first};
+    for (const auto &symbol : rule.second) {
+      key.push_back(
+          symbol.type == Symbol::Type::Terminal ? symbol.id
+                                                : ~symbol.id);
+    }
+    if (!seen.insert(std::move(key)).second) {
+      reduction.duplicateRules.push_back(r);
+      continue;
+    }
+    reduction.rules.push_back(r);
+    for (const auto &symbol : rule.second) {
+      if (symbol.type == Symbol::Type::Terminal)
+        ++terminalUses[symbol.id];
+      else
+        ++nonTerminalUses[symbol.id];
+    }
+  }
+
+  // $ stays, and terminals named by %prec keep their precedence
+  std::vector<bool> keepTerminal(terminalCount, false);
+  keepTerminal[0] = true;
+  for (unsigned long t = 0; t < terminalCount; ++t) {
+    if (terminalUses[t] != 0)
+      keepTerminal[t] = true;
+  }
+  for (auto r : reduction.rules)
+    keepTerminal[grammar.rulePrecedenceTerminal[r]] = true;
+
+  // ids in the reduced grammar, the fixed ones first
+  auto order = [&](const std::vector<bool> &keep,
+                   const std::vector<unsigned long> &uses, unsigned long fixed,
+                   std::vector<unsigned long> &ids) {
+    for (unsigned long id = 0; id < keep.size(); ++id) {
+      if (keep[id])
+        ids.push_back(id);
+    }
+    if (renumber) {
+      std::stable_sort(
+          ids.begin() + std::min<size_t>(fixed, ids.size()), ids.end(),
+          [&](auto a, auto b) { return uses[a] > uses[b]; });
+    }
+    std::vector<unsigned long> newIds(keep.size(), 0);
+    for (unsigned long i = 0; i < ids.size(); ++i)
+      newIds[ids[i]] = i;
+    return newIds;
+  };
+  auto newTerminal =
+      order(keepTerminal, terminalUses, 1, reduction.terminals);
+  auto newNonTerminal =
+      order(keepNonTerminal, nonTerminalUses, 2, reduction.nonTerminals);
+  for (unsigned long t = 0; t < terminalCount; ++t) {
+    if (!keepTerminal[t])
+      reduction.unusedTerminals.push_back(t);
+  }
+
+  Grammar reduced;
+  reduced.terminals.clear();
+  reduced.terminalPrecedence.clear();
+  for (auto t : reduction.terminals) {
+    reduced.terminals.push_back(grammar.terminals[t]);
+    reduced.terminalPrecedence.push_back(grammar.terminalPrecedence[t]);
+  }
+  // one column of errors for all unused terminals, its name cannot be read
+  // from an input as it contains a space
+  if (!reduction.unusedTerminals.empty()) {
+    reduced.removedTerminal = reduced.terminals.size();
+    reduced.terminals.push_back("<unused terminal>");
+    reduced.terminalPrecedence.push_back({});
+    for (auto t : reduction.unusedTerminals)
+      reduced.removedTerminals.push_back(grammar.terminals[t]);
+  }
+  for (auto nt : reduction.nonTerminals)
+    reduced.AddNonTerminal(grammar.nonTerminals[nt]);
+  // definitions refer to terminals by name, removed ones included
+  reduced.tokenDefinitions = grammar.tokenDefinitions;
+  for (auto r : reduction.rules) {
+    const auto &rule = grammar.rules[r];
+    std::vector<Symbol> rhs = rule.second;
+    for (auto &symbol : rhs) {
+      symbol.id = symbol.type == Symbol::Type::Terminal
+                      ? newTerminal[symbol.id]
+                      : newNonTerminal[symbol.id];
+    }
+    reduced.AddRule(
+        newNonTerminal[rule.first], rhs,
+        newTerminal[grammar.rulePrecedenceTerminal[r]]);
+  }
+  return reduced;
+}
+
+Grammar PermuteTerminals(
+    const Grammar &grammar, const std::vector<unsigned int> &order) {
+  std::vector<unsigned int> newId(order.size());
+  for (unsigned int t = 0; t < order.size(); ++t)
+    newId[order[t]] = t;
+
+  Grammar permuted = grammar;
+  for (unsigned int t = 0; t < order.size(); ++t) {
+    permuted.terminals[t] = grammar.terminals[order[t]];
+    permuted.terminalPrecedence[t] = grammar.terminalPrecedence[order[t]];
+  }
+  for (auto &rule : permuted.rules) {
+    for (auto &symbol : rule.second) {
+      if (symbol.type == Symbol::Type::Terminal)
+        symbol.id = newId[symbol.id];
+    }
+  }
+  for (auto &terminal : permuted.rulePrecedenceTerminal)
+    terminal = newId[terminal];
+  permuted.removedTerminal = newId[grammar.removedTerminal];
+  // 0 stands for the empty string here and stays 0 since $ does
+  for (auto &set : permuted.first) {
+    for (auto &terminal : set)
+      terminal = newId[terminal];
+    std::sort(set.begin(), set.end());
+  }
+  return permuted;
+}
+
+void GrammarReduction::Display(const Grammar &original) const {
+  auto &out = Out();
+  auto symbols = [&](const char *title,
+                     const std::vector<unsigned long> &ids,
+                     const std::vector<std::string> &names) {
+    if (ids.empty())
+      return;
+    out << title << ':';
+    for (auto id : ids)
+      out << ' ' << names[id];
+    out << '\n';
+  };
+  auto rules = [&](const char *title, const std::vector<unsigned long> &ids) {
+    if (ids.empty())
+      return;
+    out << title << ":\n";
+    for (auto r : ids) {
+      const auto &rule = original.rules[r];
+      out.Right(r, 5) << "│" << original.nonTerminals[rule.first] << " →";
+      for (const auto &symbol : rule.second) {
+        out << ' '
+            << (symbol.type == Symbol::Type::Terminal
+                    ? original.terminals[symbol.id]
+                    : original.nonTerminals[symbol.id]);
+      }
+      out << '\n';
+    }
+  };
+
+  out << "Grammar reduction\n═════════════════\n";
+  symbols(
+      "Non-terminals deriving no terminal string", this->unproductive,
+      original.nonTerminals);
+  symbols(
+      "Unreachable non-terminals", this->unreachable, original.nonTerminals);
+  symbols("Unused terminals", this->unusedTerminals, original.terminals);
+  rules("Rules removed with them", this->uselessRules);
+  rules("Duplicate rules", this->duplicateRules);
+  out << this->terminals.size() << " terminals, " << this->nonTerminals.size()
+      << " non-terminals and " << this->rules.size() << " rules left\n\n";
+  out.Flush();
 }
 
 void Grammar::Display() const {
+  auto &out = Out();
   // terminals
-  std::cout << "Terminals" << std::endl << "═════════" << std::endl;
+  out << "Terminals\n═════════\n";
 
-  int i = 0;
+  unsigned int i = 0;
   for (auto &terminal : this->terminals) {
-    std::cout << std::right << std::setw(3) << i++ << "│" << std::left
-              << terminal << std::endl;
+    out.Right(i++, 3) << "│" << terminal << '\n';
   }
-  std::cout << std::endl;
+  out << '\n';
 
   // Non-terminals
-  std::cout << "Non-Terminals (First)" << std::endl
-            << "═════════════════════" << std::endl;
+  out << "Non-Terminals (First)\n═════════════════════\n";
 
   i = 0;
   for (auto &nonterminal : this->nonTerminals) {
-    std::cout << std::right << std::setw(3) << i << "│" << std::left
-              << nonterminal << "\t\t";
+    out.Right(i, 3) << "│" << nonterminal << "\t\t";
 
     for (auto terminal : this->FirstNonTerminal(i)) {
-      auto t = this->terminals[terminal];
       if (terminal == 0)
-        t = "ε";
-      std::cout << t << " ";
+        out << "ε";
+      else
+        out << this->terminals[terminal];
+      out << ' ';
     }
 
-    std::cout << std::endl;
+    out << '\n';
     i++;
   }
-  std::cout << std::endl;
+  out << '\n';
 
   // rules
   unsigned int lhsmaxlen = 0;
@@ -311,19 +914,19 @@ void Grammar::Display() const {
     }
   }
 
-  std::cout << "Rules" << std::endl << "═════" << std::endl;
+  out << "Rules\n═════\n";
 
   i = 0;
   for (auto &rule : this->rules) {
-    std::cout << std::right << std::setw(3) << i++ << "│ "
-              << std::setw(lhsmaxlen) << this->nonTerminals[rule.first] << " → "
-              << std::left;
+    out.Right(i++, 3) << "│ ";
+    out.Right(this->nonTerminals[rule.first], lhsmaxlen) << " → ";
     for (auto &symbol : rule.second) {
       symbol.Display(*this);
-      std::cout << ' ';
+      out << ' ';
     }
-    std::cout << std::endl;
+    out << '\n';
   }
-  std::cout << std::endl;
+  out << '\n';
+  out.Flush();
 }
 }; // namespace lrone
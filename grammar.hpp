@@ -2,7 +2,10 @@
 #include "lrone.hpp"
 
 #include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <iostream>
+#include <memory_resource>
 #include <string>
 #include <vector>
 
@@ -18,29 +21,179 @@ struct Symbol {
   bool operator==(const Symbol &rhs) const;
 };
 
+// Fixed-width set of terminal ids stored as 64-bit words so that lookahead
+// sets can be merged and compared a word at a time. The words can be placed
+// in a memory resource, copies without one use the default heap.
+class TerminalSet {
+public:
+  TerminalSet() = default;
+  explicit TerminalSet(
+      size_t terminalCount,
+      std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+      : words((terminalCount + 63) / 64, 0, resource) {}
+  TerminalSet(const TerminalSet &other, std::pmr::memory_resource *resource)
+      : words(other.words, resource) {}
+
+  inline void Set(unsigned int terminal) {
+    words[terminal / 64] |= uint64_t(1) << (terminal % 64);
+  }
+  inline bool Test(unsigned int terminal) const {
+    return (words[terminal / 64] >> (terminal % 64)) & 1;
+  }
+  inline void Reset(unsigned int terminal) {
+    words[terminal / 64] &= ~(uint64_t(1) << (terminal % 64));
+  }
+
+  // OR the other set into this one, returns true if any bit was added
+  inline bool Merge(const TerminalSet &other) {
+    uint64_t added = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+      added |= other.words[i] & ~words[i];
+      words[i] |= other.words[i];
+    }
+    return added != 0;
+  }
+
+  // call f(terminal) for every terminal in the set in ascending order
+  template <typename F> inline void ForEach(F f) const {
+    for (size_t i = 0; i < words.size(); ++i) {
+      for (uint64_t w = words[i]; w != 0; w &= w - 1) {
+        f(static_cast<unsigned int>(i * 64 + std::countr_zero(w)));
+      }
+    }
+  }
+
+  // true if both sets have a terminal in common
+  inline bool Intersects(const TerminalSet &other) const {
+    for (size_t i = 0; i < words.size(); ++i) {
+      if (words[i] & other.words[i])
+        return true;
+    }
+    return false;
+  }
+
+  inline size_t Count() const {
+    size_t count = 0;
+    for (auto w : words)
+      count += std::popcount(w);
+    return count;
+  }
+
+  inline size_t Hash() const {
+    size_t h = 0;
+    for (auto w : words)
+      h = (h ^ w) * 0x100000001b3;
+    return h;
+  }
+
+  bool operator==(const TerminalSet &rhs) const = default;
+
+  std::pmr::vector<uint64_t> words;
+};
+
+// Operator precedence from %left, %right and %nonassoc lines, later lines
+// bind tighter. Level 0 means no precedence was declared.
+struct Precedence {
+  enum class Associativity { Left, Right, NonAssoc } associativity;
+  unsigned int level;
+};
+
+// Pattern of a terminal from a %token line, or of text between tokens from a
+// %skip line when terminal is empty. See Lexer.
+struct TokenDefinition {
+  std::string terminal;
+  std::string pattern;
+};
+
 class Grammar {
 public:
   typedef std::pair<unsigned long, std::vector<Symbol>> Rule;
   Grammar();
   Grammar(std::istream &grammarFile);
-  static Grammar FromFile(const std::string &filename);
+  static Error FromFile(const std::string &filename, Grammar &grammar);
+  // whole grammar file
+  static Error ReadFile(const std::string &filename, std::string &text);
 
   void AddTerminal(const std::string &name);
   void AddNonTerminal(const std::string &name);
-  void AddRule(const unsigned int lhs, const std::vector<Symbol> &rhs);
+  void AddRule(
+      const unsigned int lhs, const std::vector<Symbol> &rhs,
+      unsigned long precedenceTerminal = 0);
+
+  // precedence of a rule, taken from %prec or its last terminal
+  Precedence RulePrecedence(unsigned long rule) const;
 
+  // set computed by Calculate, 0 stands for the empty string
   std::vector<unsigned int> FirstNonTerminal(unsigned int nonterminal) const;
   std::vector<unsigned int> First(
       const std::vector<Symbol>::const_iterator start,
       const std::vector<Symbol>::const_iterator end) const;
 
+  // FIRST of every non-terminal
   void Calculate();
+  // only of the non-terminals marked, the FIRST sets of the others are used
+  // as they are
+  void Calculate(const std::vector<bool> &recompute);
+  // heap bytes held by the grammar
+  size_t MemoryUsage() const;
+  // rules whose right recursion keeps symbols on the parse stack for every
+  // repetition, so the stack grows with the input length
+  std::vector<unsigned long> RightRecursiveRules() const;
   void Display() const;
 
   std::vector<std::string> terminals;
   std::vector<std::string> nonTerminals;
   std::vector<Rule> rules;
   std::vector<std::vector<unsigned int>> first;
+  std::vector<Precedence> terminalPrecedence;
+  // terminal named by %prec for each rule, 0 if none
+  std::vector<unsigned long> rulePrecedenceTerminal;
+  // %token and %skip lines in file order
+  std::vector<TokenDefinition> tokenDefinitions;
+  // Names of the terminals removed by ReduceGrammar. The input reads all of
+  // them as removedTerminal, which no rule uses, so the parser rejects them
+  // like any other terminal out of place.
+  std::vector<std::string> removedTerminals;
+  unsigned int removedTerminal = 0;
+  // problems found while reading the grammar, the parts concerned were
+  // skipped
+  std::vector<std::string> warnings;
 };
 
+// Result of ReduceGrammar, ids refer to the original grammar
+struct GrammarReduction {
+  // original id of every symbol and rule of the reduced grammar, the terminal
+  // standing for the unused ones has none
+  std::vector<unsigned long> terminals;
+  std::vector<unsigned long> nonTerminals;
+  std::vector<unsigned long> rules;
+
+  // removed symbols and rules
+  std::vector<unsigned long> unproductive; // derive no terminal string
+  std::vector<unsigned long> unreachable;  // not reachable from the start
+  std::vector<unsigned long> unusedTerminals;
+  std::vector<unsigned long> uselessRules; // using a removed non-terminal
+  std::vector<unsigned long> duplicateRules;
+
+  // every removed symbol and rule by name
+  void Display(const Grammar &original) const;
+};
+
+// Copy of the grammar without non-terminals that cannot derive a terminal
+// string or cannot be reached from the start symbol, their rules, terminals
+// no remaining rule uses and repeated rules. The language stays the same.
+// The unused terminals are replaced by one last terminal in
+// Grammar::removedTerminals, so inputs naming them are still read.
+// $, S' and the start symbol keep their ids and the remaining rules keep
+// their order. With renumber the other symbols are ordered by their number
+// of uses in the rules, so the most used ones get the first columns of the
+// parsing table. FIRST is not calculated.
+Grammar ReduceGrammar(
+    const Grammar &grammar, bool renumber, GrammarReduction &reduction);
+
+// Copy of the grammar in which terminal order[i] gets the id i, FIRST sets
+// included. $ has to stay first.
+Grammar PermuteTerminals(
+    const Grammar &grammar, const std::vector<unsigned int> &order);
+
 } // namespace lrone
@@ -0,0 +1,131 @@
+#include "latency.hpp"
+
+#include "context.hpp"
+#include "output.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace lrone {
+
+std::vector<double> SpawnLatencies(
+    const char *grammarFile, const std::string &input, const char *inputFile,
+    unsigned int repeat) {
+  std::vector<double> latencies;
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(
+      &actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  posix_spawn_file_actions_addopen(
+      &actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+  std::string grammarArg = grammarFile;
+  std::string inputArg = inputFile ? inputFile : input;
+  // a single timed run per phase like any one-off invocation
+  char *args[] = {
+      const_cast<char *>("lrone"),
+      const_cast<char *>("-b"),
+      const_cast<char *>("-r"),
+      const_cast<char *>("1,0"),
+      const_cast<char *>("-g"),
+      grammarArg.data(),
+      const_cast<char *>(inputFile ? "-f" : "-s"),
+      inputArg.data(),
+      nullptr};
+  for (unsigned int i = 0; i < repeat; ++i) {
+    auto timeStart = std::chrono::steady_clock::now();
+    pid_t pid;
+    if (posix_spawn(
+            &pid, "/proc/self/exe", &actions, nullptr, args, environ) != 0)
+      break;
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    auto timeEnd = std::chrono::steady_clock::now();
+    latencies.push_back(
+        std::chrono::duration<double, std::micro>(timeEnd - timeStart)
+            .count());
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  return latencies;
+}
+
+void ReportLatency(const char *label, std::vector<double> &samples) {
+  if (samples.empty())
+    return;
+  std::sort(samples.begin(), samples.end());
+  auto p99 = std::min(samples.size() - 1, samples.size() * 99 / 100);
+  std::cout << label << " latency p50: " << samples[samples.size() / 2]
+            << " us, p99: " << samples[p99] << " us (" << samples.size()
+            << " requests)" << std::endl;
+}
+
+int RunLibraryBenchmark(
+    const char *grammarFile, const std::string &input, const char *inputFile,
+    unsigned int repeat) {
+  Context context;
+  std::vector<uint32_t> terminals;
+  ParseResult result;
+  auto loadAndParse = [&](Context &context) {
+    if (auto error = context.LoadGrammarFile(grammarFile))
+      return error;
+    if (auto error = context.Terminals(input, terminals))
+      return error;
+    return context.Parse(terminals, result);
+  };
+  if (auto error = loadAndParse(context)) {
+    auto &err = Err();
+    err.Color(ANSI_COLOR_RED) << error.message;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    return EXIT_FAILURE;
+  }
+  if (result.accepted) {
+    auto &out = Out();
+    out.Color(ANSI_COLOR_GREEN) << "Input accepted!";
+    out.Color(ANSI_COLOR_RESET) << '\n';
+    out.Flush();
+  } else {
+    auto &out = Out();
+    out.Color(ANSI_COLOR_RED) << "Error: "
+                              << context.Describe(terminals, result);
+    out.Color(ANSI_COLOR_RESET) << '\n';
+    out.Flush();
+  }
+
+  // from the input text to the result like the server and the program, once
+  // with the table resident and once starting from the grammar file
+  std::vector<double> warmLatencies;
+  for (unsigned int i = 0; i < repeat; ++i) {
+    auto timeStart = std::chrono::steady_clock::now();
+    context.Terminals(input, terminals);
+    context.Parse(terminals, result);
+    auto timeEnd = std::chrono::steady_clock::now();
+    warmLatencies.push_back(
+        std::chrono::duration<double, std::micro>(timeEnd - timeStart)
+            .count());
+  }
+  std::vector<double> coldLatencies;
+  for (unsigned int i = 0; i < repeat; ++i) {
+    auto timeStart = std::chrono::steady_clock::now();
+    {
+      Context fresh;
+      loadAndParse(fresh);
+    }
+    auto timeEnd = std::chrono::steady_clock::now();
+    coldLatencies.push_back(
+        std::chrono::duration<double, std::micro>(timeEnd - timeStart)
+            .count());
+  }
+  auto spawnLatencies = SpawnLatencies(grammarFile, input, inputFile, repeat);
+
+  ReportLatency("In-process parse", warmLatencies);
+  ReportLatency("In-process load and parse", coldLatencies);
+  ReportLatency("Spawned CLI", spawnLatencies);
+  return result.accepted ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace lrone
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "lrone.hpp"
+
+#include <string>
+#include <vector>
+
+namespace lrone {
+
+// Time of starting the command line program for the input until it exits, in
+// microseconds for each of repeat runs. Its output is discarded. The program
+// reads inputFile if given and input otherwise.
+std::vector<double> SpawnLatencies(
+    const char *grammarFile, const std::string &input, const char *inputFile,
+    unsigned int repeat);
+
+// Print the median and p99 of the samples, sorting them
+void ReportLatency(const char *label, std::vector<double> &samples);
+
+// Compare parsing the input through the library in this process, once with
+// the grammar resident and once loading it for every parse, with spawning the
+// command line program for it. Every variant is repeated.
+int RunLibraryBenchmark(
+    const char *grammarFile, const std::string &input, const char *inputFile,
+    unsigned int repeat);
+
+} // namespace lrone
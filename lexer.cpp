@@ -0,0 +1,559 @@
+#include "lexer.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace lrone {
+
+namespace {
+
+constexpr uint32_t None = ~0u;
+
+typedef std::bitset<256> ByteSet;
+
+// Thompson automaton of all patterns, every state has either one byte
+// transition or up to two empty ones
+struct NFA {
+  struct State {
+    ByteSet bytes;
+    uint32_t target = None;
+    uint32_t epsilon[2] = {None, None};
+    uint32_t accept = None; // priority of the pattern ending here
+  };
+
+  // part of the automaton from start to end, end has no transitions yet
+  struct Fragment {
+    uint32_t start;
+    uint32_t end;
+  };
+
+  uint32_t Add() {
+    this->states.emplace_back();
+    return this->states.size() - 1;
+  }
+  void Epsilon(uint32_t from, uint32_t to) {
+    auto &state = this->states[from];
+    state.epsilon[state.epsilon[0] == None ? 0 : 1] = to;
+  }
+  Fragment Bytes(const ByteSet &bytes) {
+    auto start = this->Add();
+    auto end = this->Add();
+    this->states[start].bytes = bytes;
+    this->states[start].target = end;
+    return {start, end};
+  }
+  Fragment Concatenate(Fragment a, Fragment b) {
+    this->Epsilon(a.end, b.start);
+    return {a.start, b.end};
+  }
+  Fragment Literal(std::string_view text) {
+    Fragment result{this->Add(), 0};
+    result.end = result.start;
+    for (unsigned char c : text) {
+      ByteSet byte;
+      byte.set(c);
+      result = this->Concatenate(result, this->Bytes(byte));
+    }
+    return result;
+  }
+
+  std::vector<State> states;
+};
+
+ByteSet Range(unsigned char first, unsigned char last) {
+  ByteSet bytes;
+  for (unsigned int c = first; c <= last; ++c)
+    bytes.set(c);
+  return bytes;
+}
+
+// Recursive descent over one pattern adding its states to the automaton
+class PatternParser {
+public:
+  PatternParser(std::string_view pattern, NFA &nfa)
+      : pattern(pattern), nfa(nfa) {}
+
+  // empty error on success
+  NFA::Fragment Parse(std::string &error) {
+    auto fragment = this->Alternation();
+    if (this->error.empty() && this->position < this->pattern.size())
+      this->Fail("unbalanced ')'");
+    error = this->error;
+    return fragment;
+  }
+
+private:
+  bool AtEnd() const { return this->position >= this->pattern.size(); }
+  char Peek() const { return this->pattern[this->position]; }
+  void Fail(const std::string &message) {
+    if (this->error.empty()) {
+      this->error =
+          message + " at offset " + std::to_string(this->position);
+    }
+    this->position = this->pattern.size();
+  }
+
+  NFA::Fragment Alternation() {
+    auto fragment = this->Sequence();
+    while (!this->AtEnd() && this->Peek() == '|') {
+      ++this->position;
+      auto other = this->Sequence();
+      auto start = this->nfa.Add();
+      auto end = this->nfa.Add();
+      this->nfa.Epsilon(start, fragment.start);
+      this->nfa.Epsilon(start, other.start);
+      this->nfa.Epsilon(fragment.end, end);
+      this->nfa.Epsilon(other.end, end);
+      fragment = {start, end};
+    }
+    return fragment;
+  }
+
+  NFA::Fragment Sequence() {
+    auto start = this->nfa.Add();
+    NFA::Fragment fragment{start, start};
+    while (!this->AtEnd() && this->Peek() != '|' && this->Peek() != ')')
+      fragment = this->nfa.Concatenate(fragment, this->Repetition());
+    return fragment;
+  }
+
+  NFA::Fragment Repetition() {
+    auto fragment = this->Atom();
+    while (!this->AtEnd() && (this->Peek() == '*' || this->Peek() == '+' ||
+                              this->Peek() == '?')) {
+      const char op = this->pattern[this->position++];
+      auto start = this->nfa.Add();
+      auto end = this->nfa.Add();
+      this->nfa.Epsilon(start, fragment.start);
+      if (op != '+')
+        this->nfa.Epsilon(start, end);
+      if (op != '?')
+        this->nfa.Epsilon(fragment.end, fragment.start);
+      this->nfa.Epsilon(fragment.end, end);
+      fragment = {start, end};
+    }
+    return fragment;
+  }
+
+  NFA::Fragment Atom() {
+    const char c = this->pattern[this->position++];
+    switch (c) {
+    case '(': {
+      auto fragment = this->Alternation();
+      if (this->AtEnd() || this->Peek() != ')') {
+        this->Fail("missing ')'");
+      } else {
+        ++this->position;
+      }
+      return fragment;
+    }
+    case '[':
+      return this->nfa.Bytes(this->Class());
+    case '.':
+      return this->nfa.Bytes(~Range('\n', '\n'));
+    case '*':
+    case '+':
+    case '?':
+      this->Fail(std::string("nothing to repeat before '") + c + "'");
+      return this->nfa.Bytes({});
+    case '\\':
+      return this->nfa.Bytes(this->Escape());
+    default:
+      return this->nfa.Bytes(Range(c, c));
+    }
+  }
+
+  // after a backslash
+  ByteSet Escape() {
+    if (this->AtEnd()) {
+      this->Fail("trailing '\\'");
+      return {};
+    }
+    const unsigned char c = this->pattern[this->position++];
+    const ByteSet digits = Range('0', '9');
+    const ByteSet word =
+        digits | Range('a', 'z') | Range('A', 'Z') | Range('_', '_');
+    const ByteSet space = Range(' ', ' ') | Range('\t', '\r');
+    switch (c) {
+    case 'n':
+      return Range('\n', '\n');
+    case 't':
+      return Range('\t', '\t');
+    case 'r':
+      return Range('\r', '\r');
+    case 'f':
+      return Range('\f', '\f');
+    case 'v':
+      return Range('\v', '\v');
+    case 'd':
+      return digits;
+    case 'D':
+      return ~digits;
+    case 'w':
+      return word;
+    case 'W':
+      return ~word;
+    case 's':
+      return space;
+    case 'S':
+      return ~space;
+    case 'x': {
+      auto hex = [](char h) -> int {
+        if (h >= '0' && h <= '9')
+          return h - '0';
+        if (h >= 'a' && h <= 'f')
+          return h - 'a' + 10;
+        if (h >= 'A' && h <= 'F')
+          return h - 'A' + 10;
+        return -1;
+      };
+      if (this->position + 2 > this->pattern.size() ||
+          hex(this->pattern[this->position]) < 0 ||
+          hex(this->pattern[this->position + 1]) < 0) {
+        this->Fail("invalid \\x escape");
+        return {};
+      }
+      unsigned char value = hex(this->pattern[this->position]) * 16 +
+                            hex(this->pattern[this->position + 1]);
+      this->position += 2;
+      return Range(value, value);
+    }
+    default:
+      return Range(c, c);
+    }
+  }
+
+  // after '[' up to and including ']'
+  ByteSet Class() {
+    ByteSet bytes;
+    bool negate = !this->AtEnd() && this->Peek() == '^';
+    if (negate)
+      ++this->position;
+    bool first = true;
+    while (true) {
+      if (this->AtEnd()) {
+        this->Fail("missing ']'");
+        return {};
+      }
+      unsigned char c = this->pattern[this->position++];
+      if (c == ']' && !first)
+        break;
+      first = false;
+
+      ByteSet item;
+      if (c == '\\') {
+        item = this->Escape();
+      } else {
+        item = Range(c, c);
+      }
+      // a range between two single bytes
+      if (item.count() == 1 && this->position + 1 < this->pattern.size() &&
+          this->Peek() == '-' && this->pattern[this->position + 1] != ']') {
+        ++this->position;
+        unsigned char last = this->pattern[this->position++];
+        if (last == '\\') {
+          auto escaped = this->Escape();
+          if (escaped.count() != 1) {
+            this->Fail("invalid range");
+            return {};
+          }
+          for (last = 0; !escaped.test(last); ++last) {
+          }
+        }
+        unsigned char firstByte = 0;
+        while (!item.test(firstByte))
+          ++firstByte;
+        if (last < firstByte) {
+          this->Fail("invalid range");
+          return {};
+        }
+        item = Range(firstByte, last);
+      }
+      bytes |= item;
+    }
+    return negate ? ~bytes : bytes;
+  }
+
+  std::string_view pattern;
+  size_t position = 0;
+  NFA &nfa;
+  std::string error;
+};
+
+// NFA states reachable from the given ones without reading a byte, sorted
+void EpsilonClosure(const NFA &nfa, std::vector<uint32_t> &states) {
+  std::vector<bool> seen(nfa.states.size(), false);
+  for (auto state : states)
+    seen[state] = true;
+  for (size_t i = 0; i < states.size(); ++i) {
+    for (auto next : nfa.states[states[i]].epsilon) {
+      if (next != None && !seen[next]) {
+        seen[next] = true;
+        states.push_back(next);
+      }
+    }
+  }
+  std::sort(states.begin(), states.end());
+}
+
+} // namespace
+
+Error Lexer::Build(const Grammar &grammar, Lexer &lexer) {
+  PROFILE_FUNC;
+  lexer = Lexer();
+  if (grammar.tokenDefinitions.empty())
+    return {};
+  lexer.terminalCount = grammar.terminals.size();
+
+  // token accepted by each pattern in the order of priority
+  std::vector<uint32_t> tokens;
+  std::vector<std::string> names; // for errors
+  NFA nfa;
+  // the DFA starts in all of them at once
+  std::vector<uint32_t> starts;
+  auto addPattern = [&](NFA::Fragment fragment, uint32_t token,
+                        const std::string &name) {
+    starts.push_back(fragment.start);
+    nfa.states[fragment.end].accept = tokens.size();
+    tokens.push_back(token);
+    names.push_back(name);
+  };
+
+  // terminals removed from the grammar are read as the one standing for
+  // them, which has no text of its own
+  std::unordered_map<std::string_view, uint32_t> terminalIds;
+  std::unordered_set<std::string_view> defined;
+  for (const auto &definition : grammar.tokenDefinitions)
+    defined.insert(definition.terminal);
+  auto addTerminal = [&](const std::string &name, uint32_t t) {
+    terminalIds.emplace(name, t);
+    if (!defined.contains(name))
+      addPattern(nfa.Literal(name), t, name);
+  };
+  for (uint32_t t = 1; t < grammar.terminals.size(); ++t) {
+    if (grammar.removedTerminals.empty() || t != grammar.removedTerminal)
+      addTerminal(grammar.terminals[t], t);
+  }
+  for (const auto &name : grammar.removedTerminals)
+    addTerminal(name, grammar.removedTerminal);
+
+  bool skips = false;
+  for (const auto &definition : grammar.tokenDefinitions) {
+    std::string error;
+    auto fragment = PatternParser(definition.pattern, nfa).Parse(error);
+    const auto &name =
+        definition.terminal.empty() ? "%skip" : definition.terminal;
+    if (!error.empty()) {
+      return {
+          Error::Code::InvalidPattern,
+          "Invalid pattern for " + name + ": " + error};
+    }
+
+    uint32_t token = Skip;
+    if (!definition.terminal.empty()) {
+      auto found = terminalIds.find(definition.terminal);
+      if (found != terminalIds.end()) {
+        token = found->second;
+      } else {
+        token = lexer.terminalCount + lexer.unknown.size();
+        lexer.unknown.push_back(definition.terminal);
+      }
+    } else {
+      skips = true;
+    }
+    addPattern(fragment, token, name);
+  }
+  if (!skips) {
+    std::string error;
+    addPattern(
+        PatternParser("[ \\t\\r\\n]+", nfa).Parse(error), Skip, "%skip");
+  }
+
+  // bytes that no pattern tells apart share a class
+  std::array<uint16_t, 256> byteClass{};
+  unsigned int classCount = 1;
+  for (const auto &state : nfa.states) {
+    if (state.target == None)
+      continue;
+    std::map<std::pair<uint16_t, bool>, uint16_t> split;
+    for (unsigned int b = 0; b < 256; ++b) {
+      auto key = std::make_pair(byteClass[b], bool(state.bytes.test(b)));
+      byteClass[b] = split.try_emplace(key, split.size()).first->second;
+    }
+    classCount = split.size();
+  }
+  std::vector<uint8_t> representative(classCount);
+  for (unsigned int b = 256; b-- > 0;)
+    representative[byteClass[b]] = b;
+
+  // subset construction, state 0 is the empty set and stays dead
+  std::vector<std::vector<uint32_t>> sets{{}, starts};
+  EpsilonClosure(nfa, sets[1]);
+  std::map<std::vector<uint32_t>, uint32_t> setIds{{sets[0], 0}, {sets[1], 1}};
+  std::vector<std::vector<uint32_t>> dfa;
+  std::vector<uint32_t> priority;
+  for (size_t s = 0; s < sets.size(); ++s) {
+    uint32_t best = None;
+    for (auto state : sets[s])
+      best = std::min(best, nfa.states[state].accept);
+    priority.push_back(best);
+
+    std::vector<uint32_t> row(classCount, 0);
+    for (unsigned int c = 0; c < classCount && s != 0; ++c) {
+      std::vector<uint32_t> moved;
+      for (auto state : sets[s]) {
+        const auto &from = nfa.states[state];
+        if (from.target != None && from.bytes.test(representative[c]))
+          moved.push_back(from.target);
+      }
+      if (moved.empty())
+        continue;
+      EpsilonClosure(nfa, moved);
+      auto [found, added] = setIds.try_emplace(moved, sets.size());
+      if (added)
+        sets.push_back(std::move(moved));
+      row[c] = found->second;
+    }
+    dfa.push_back(std::move(row));
+  }
+  if (priority[1] != None) {
+    return {
+        Error::Code::InvalidPattern,
+        "Pattern for " + names[priority[1]] + " matches the empty string"};
+  }
+
+  // Moore's refinement from the partition by accepted token until
+  // equivalent states share a block
+  const size_t stateCount = dfa.size();
+  std::vector<uint32_t> block(stateCount);
+  size_t blockCount = 0;
+  {
+    std::map<uint32_t, uint32_t> byToken;
+    for (size_t s = 0; s < stateCount; ++s) {
+      auto token = priority[s] == None ? None : tokens[priority[s]];
+      block[s] = byToken.try_emplace(token, byToken.size()).first->second;
+    }
+    blockCount = byToken.size();
+  }
+  while (true) {
+    std::map<std::vector<uint32_t>, uint32_t> signatures;
+    std::vector<uint32_t> refined(stateCount);
+    for (size_t s = 0; s < stateCount; ++s) {
+      std::vector<uint32_t> signature{block[s]};
+      for (auto target : dfa[s])
+        signature.push_back(block[target]);
+      refined[s] =
+          signatures.try_emplace(signature, signatures.size()).first->second;
+    }
+    block = std::move(refined);
+    if (signatures.size() == blockCount)
+      break;
+    blockCount = signatures.size();
+  }
+
+  // the dead block becomes state 0 and the start block state 1
+  std::vector<uint32_t> number(blockCount, None);
+  uint32_t states = 0;
+  number[block[0]] = states++;
+  if (number[block[1]] == None)
+    number[block[1]] = states++;
+  for (size_t s = 0; s < stateCount; ++s) {
+    if (number[block[s]] == None)
+      number[block[s]] = states++;
+  }
+  if (states > 0xFFFF) {
+    return {
+        Error::Code::InvalidPattern,
+        "Token definitions need more than 65535 lexer states"};
+  }
+  std::vector<std::vector<uint32_t>> minimal(states);
+  lexer.accept.assign(states, NoToken);
+  for (size_t s = 0; s < stateCount; ++s) {
+    auto &row = minimal[number[block[s]]];
+    if (!row.empty())
+      continue;
+    for (auto target : dfa[s])
+      row.push_back(number[block[target]]);
+    if (priority[s] != None)
+      lexer.accept[number[block[s]]] = tokens[priority[s]];
+  }
+
+  // classes whose columns ended up equal are merged
+  std::map<std::vector<uint16_t>, uint8_t> columns;
+  std::vector<uint8_t> columnOf(classCount);
+  for (unsigned int c = 0; c < classCount; ++c) {
+    std::vector<uint16_t> column;
+    for (const auto &row : minimal)
+      column.push_back(row[c]);
+    columnOf[c] = columns.try_emplace(column, columns.size()).first->second;
+  }
+  lexer.classes = columns.size();
+  for (unsigned int b = 0; b < 256; ++b)
+    lexer.classOf[b] = columnOf[byteClass[b]];
+  while ((1u << lexer.shift) < lexer.classes)
+    ++lexer.shift;
+
+  lexer.next.assign(size_t(states) << lexer.shift, 0);
+  for (uint32_t s = 0; s < states; ++s) {
+    for (unsigned int c = 0; c < classCount; ++c)
+      lexer.next[s << lexer.shift | columnOf[c]] = minimal[s][c];
+  }
+  return {};
+}
+
+Error Lexer::Lex(
+    std::string_view text, std::vector<unsigned int> &terminals) const {
+  PROFILE_FUNC;
+  terminals.clear();
+  const auto *data = reinterpret_cast<const uint8_t *>(text.data());
+  const size_t size = text.size();
+  const uint16_t *next = this->next.data();
+  const uint32_t *accept = this->accept.data();
+  const uint8_t *classOf = this->classOf.data();
+  const unsigned int shift = this->shift;
+
+  for (size_t position = 0; position < size;) {
+    // run until the dead state and go back to the last accepting one
+    uint32_t state = 1;
+    uint32_t token = NoToken;
+    size_t end = position;
+    for (size_t i = position; i < size;) {
+      state = next[state << shift | classOf[data[i++]]];
+      if (state == 0)
+        break;
+      if (accept[state] != NoToken) {
+        token = accept[state];
+        end = i;
+      }
+    }
+
+    if (token < this->terminalCount) {
+      terminals.push_back(token);
+    } else if (token == NoToken) {
+      auto line = 1 + std::count(text.begin(), text.begin() + position, '\n');
+      return {
+          Error::Code::UnknownTerminal,
+          "No terminal matches the input at line " + std::to_string(line) +
+              ": " + std::string(text.substr(position, 16))};
+    } else if (token != Skip) {
+      return {
+          Error::Code::UnknownTerminal,
+          "Unknown terminal in input: " +
+              this->unknown[token - this->terminalCount]};
+    }
+    position = end;
+  }
+  terminals.push_back(0); // $
+  return {};
+}
+
+size_t Lexer::TableBytes() const {
+  return this->next.size() * sizeof(this->next[0]) +
+         this->accept.size() * sizeof(this->accept[0]) +
+         sizeof(this->classOf);
+}
+
+} // namespace lrone
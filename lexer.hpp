@@ -0,0 +1,58 @@
+#pragma once
+
+#include "lrone.hpp"
+
+#include "grammar.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lrone {
+
+// Table-driven lexer for the %token and %skip definitions of a grammar. The
+// patterns, and the names of the terminals without a pattern as literal
+// strings, are compiled into one minimized DFA whose columns are classes of
+// equivalent bytes. The longest match wins. Between matches of the same
+// length literal terminals come first, then the patterns in file order.
+// Without a %skip line spaces, tabs and line breaks are skipped.
+//
+// Patterns are byte oriented regular expressions: | * + ? ( ) . [a-z] [^...]
+// and the escapes \n \t \r \f \v \xHH \d \w \s \D \W \S, any other escaped
+// character stands for itself.
+class Lexer {
+public:
+  // compile the definitions of the grammar, the lexer stays disabled if there
+  // are none
+  static Error Build(const Grammar &grammar, Lexer &lexer);
+
+  bool Enabled() const { return !this->accept.empty(); }
+
+  // terminal of every token followed by $
+  Error Lex(std::string_view text, std::vector<unsigned int> &terminals) const;
+
+  unsigned int States() const { return this->accept.size(); }
+  unsigned int Classes() const { return this->classes; }
+  // bytes of the transition, accept and byte class tables
+  size_t TableBytes() const;
+
+private:
+  static constexpr uint32_t NoToken = ~0u;
+  static constexpr uint32_t Skip = ~0u - 1;
+
+  std::array<uint8_t, 256> classOf{};
+  unsigned int classes = 0;
+  // rows of the transition table are padded to 1 << shift entries
+  unsigned int shift = 0;
+  // next[state << shift | class], state 0 is the dead state and 1 the start
+  std::vector<uint16_t> next;
+  // terminal accepted in each state, NoToken or Skip. Ids from terminalCount
+  // on are definitions of terminals the grammar does not have (anymore).
+  std::vector<uint32_t> accept;
+  unsigned int terminalCount = 0;
+  std::vector<std::string> unknown;
+};
+
+} // namespace lrone
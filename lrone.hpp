@@ -1,9 +1,12 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <cstdlib>
 #include <fstream>
 #include <string>
+#include <string_view>
 
 #define ANSI_COLOR_RED "\x1b[31m"
 #define ANSI_COLOR_GREEN "\x1b[32m"
@@ -13,41 +16,151 @@
 #define ANSI_COLOR_CYAN "\x1b[36m"
 #define ANSI_COLOR_RESET "\x1b[0m"
 
+// settings of the command line program, only its display functions and
+// LRParser::Parse read them
 extern bool benchmark_mode;
+extern bool color_mode;
 extern bool interactive_mode;
 extern unsigned int parsing_col_size;
 
 unsigned int GetTermW();
-size_t UTF8Length(std::string s);
+size_t UTF8Length(std::string_view s);
 void interaction_pause();
 
 namespace lrone {
+
+// Failure of a library call, returned instead of printing it and exiting
+struct Error {
+  enum class Code {
+    None,
+    OpenFailed,      // a file could not be read
+    UnknownTerminal, // the input names no terminal of the grammar
+    InvalidInput,    // terminal ids out of range or no $ at the end
+    NoGrammar,       // nothing was loaded yet
+    InvalidOptions,  // options that cannot be combined
+    InvalidPattern,  // a token definition is no valid regular expression
+    WriteFailed,     // a file could not be written
+    MemoryCap,       // the work does not fit into the memory it may use
+    KernelMismatch,  // a SIMD kernel differs from the scalar one
+  };
+  Code code = Code::None;
+  std::string message;
+
+  explicit operator bool() const { return this->code != Code::None; }
+};
+
+// Heap allocations made by the current thread, counted by the global operator
+// new in memory.cpp
+struct HeapCounters {
+  uint64_t allocations = 0;
+  uint64_t bytes = 0;
+  int64_t live = 0; // usable bytes not yet freed by this thread
+  int64_t peak = 0;
+};
+extern thread_local constinit HeapCounters heap_counters;
+
+// Hardware performance counters of the calling thread, read with
+// perf_event_open in perf.cpp. They are only opened on request and values
+// stay 0 on threads that did not open them or when the kernel refuses.
+struct PerfCounters {
+  enum Counter {
+    Cycles,
+    Instructions,
+    L1DMisses,
+    LLCMisses,
+    BranchMisses,
+    Count
+  };
+  uint64_t values[Count] = {};
+
+  static const char *const names[Count];
+
+  // open the counters for the calling thread, on failure a warning says why
+  static bool Open();
+  // counted by the calling thread since Open, scaled up if the kernel had to
+  // multiplex the counters
+  static void Read(PerfCounters &counters);
+  // counters the kernel accepted, the others stay 0
+  static bool Available(Counter counter);
+  // set by Open for the Profiler
+  static inline bool enabled = false;
+};
+
+// Totals of one PROFILE_SCOPE site over all of its calls. Allocations are
+// attributed to the innermost scope only so recursive scopes are not counted
+// twice.
+struct ProfileSite {
+  explicit ProfileSite(const char *label);
+
+  const char *name;
+  std::atomic<uint64_t> calls = 0;
+  std::atomic<uint64_t> allocations = 0;
+  std::atomic<uint64_t> bytes = 0;
+  std::atomic<uint64_t> counters[PerfCounters::Count] = {};
+  ProfileSite *next;
+
+  static std::atomic<ProfileSite *> first;
+};
+
 class Profiler {
 public:
   static void Initialize(const char *filename);
   static void Finalize();
-  explicit inline Profiler(const char *label) : name(label) {
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double, std::micro> offsetTime =
-        currentTime - startTime;
-    file << "{\"pid\": 1, \"ts\": " << offsetTime.count() << ", \"name\": \""
-         << name << "\", \"ph\": \"B\"},\n";
+  // allocations of every site that allocated, largest first
+  static void DisplayMemory();
+  // hardware counters of every site, most cycles first, if they were opened
+  static void DisplayCounters();
+
+  explicit inline Profiler(ProfileSite &site)
+      : site(site), start(heap_counters), parent(current) {
+    current = this;
+    if (PerfCounters::enabled)
+      PerfCounters::Read(this->counterStart);
+    if (enabled)
+      this->Event('B', this->counterStart);
   }
   inline ~Profiler() {
-    auto currentTime = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double, std::micro> offsetTime =
-        currentTime - startTime;
-    file << "{\"pid\": 1, \"ts\": " << offsetTime.count() << ", \"name\": \""
-         << name << "\", \"ph\": \"E\"},\n";
+    auto allocations = heap_counters.allocations - this->start.allocations;
+    auto bytes = heap_counters.bytes - this->start.bytes;
+    this->site.calls.fetch_add(1, std::memory_order_relaxed);
+    this->site.allocations.fetch_add(
+        allocations - this->nested.allocations, std::memory_order_relaxed);
+    this->site.bytes.fetch_add(
+        bytes - this->nested.bytes, std::memory_order_relaxed);
+    if (this->parent) {
+      this->parent->nested.allocations += allocations;
+      this->parent->nested.bytes += bytes;
+    }
+    PerfCounters end;
+    if (PerfCounters::enabled) {
+      PerfCounters::Read(end);
+      this->CountHardware(end);
+    }
+    current = this->parent;
+    if (enabled)
+      this->Event('E', end);
   }
 
 private:
-  const char *name;
+  void Event(char phase, const PerfCounters &counters);
+  // attributed like the allocations, to the innermost scope
+  void CountHardware(const PerfCounters &end);
+
+  ProfileSite &site;
+  HeapCounters start;
+  HeapCounters nested; // made by nested scopes
+  PerfCounters counterStart;
+  PerfCounters counterNested;
+  Profiler *parent;
+
+  static thread_local constinit Profiler *current;
   static bool enabled;
   static std::ofstream file;
-  static std::chrono::high_resolution_clock::time_point startTime;
+  static std::chrono::steady_clock::time_point startTime;
 };
 } // namespace lrone
 
-#define PROFILE_SCOPE(label) Profiler _timer(label)
+#define PROFILE_SCOPE(label)                                                   \
+  static ::lrone::ProfileSite _profileSite(label);                             \
+  ::lrone::Profiler _timer(_profileSite)
 #define PROFILE_FUNC PROFILE_SCOPE(__PRETTY_FUNCTION__)
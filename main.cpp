@@ -1,50 +1,237 @@
 #include "lrone.hpp"
 
+#include "batch.hpp"
+#include "benchmark.hpp"
 #include "grammar.hpp"
+#include "latency.hpp"
+#include "lexer.hpp"
+#include "memory.hpp"
+#include "output.hpp"
 #include "parser.hpp"
+#include "reports.hpp"
+#include "scanner.hpp"
+#include "server.hpp"
 #include "table.hpp"
 
 #include <chrono>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <unistd.h>
 
-bool benchmark_mode = false;
-unsigned int parsing_col_size = 20;
+// terminals of every non-empty line of a sample file, exits on errors
+template <typename F>
+static void ForEachSentence(
+    const char *filename, const char *what, const lrone::Lexer &lexer,
+    const lrone::Grammar &g, F f) {
+  std::ifstream corpus(filename);
+  if (!corpus) {
+    std::cerr << "Error: Failed to open " << what << ": " << filename
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  std::vector<unsigned int> terminals;
+  for (std::string line; std::getline(corpus, line);) {
+    if (line.empty())
+      continue;
+    auto error = lexer.Enabled() ? lexer.Lex(line, terminals)
+                                 : lrone::StringToTerminals(line, g, terminals);
+    if (error) {
+      auto &err = lrone::Err();
+      err.Color(ANSI_COLOR_RED) << error.message;
+      err.Color(ANSI_COLOR_RESET) << '\n';
+      err.Flush();
+      std::exit(EXIT_FAILURE);
+    }
+    f(terminals);
+  }
+}
 
 int main(int argc, char *argv[]) {
   char *grammarFile = NULL;
   char *inputString = NULL;
   char *csvFile = NULL;
+  char *jsonFile = NULL;
+  char *inputFile = NULL;
+  char *cacheFile = NULL;
+  bool unitElimination = false;
+  bool hardwareCounters = false;
+  bool reduceGrammar = false;
+  bool renumberSymbols = false;
+  bool lazyTable = false;
+  bool minimalTable = false;
+  bool forking = false;
+  char *warmUpFile = NULL;
+  char *layoutFile = NULL;
+  char *sentenceFile = NULL;
+  size_t memoryCap = 0;
+  char *tableFile = NULL;
+  unsigned int threads = 0;
+  char *serverSocket = NULL;
+  char *clientSocket = NULL;
+  unsigned int repeat = 1000;
+  unsigned int libraryRuns = 0;
+  unsigned int iterations = 10;
+  unsigned int warmup = 2;
+  int pinnedCPU = -1;
+  char *benchmarkFile = NULL;
+
+  // colors only make sense on a terminal
+  color_mode = isatty(STDOUT_FILENO);
 
   { // argument parsing
     int op;
-    while ((op = getopt(argc, argv, "bg:hl:o:p:s:")) != -1) {
+    const char *options =
+        "a:bCc:d:e:Ff:g:hi:j:kl:L:mM:n:o:p:qr:s:S:t:T:uv:w:xyz";
+    while ((op = getopt(argc, argv, options)) != -1) {
       switch (op) {
+      case 'a':
+        pinnedCPU = atoi(optarg);
+        break;
       case 'b':
         benchmark_mode = true;
         break;
+      case 'c':
+        clientSocket = optarg;
+        break;
+      case 'C':
+        if (auto error = lrone::CheckScanKernels()) {
+          auto &err = lrone::Err();
+          err.Color(ANSI_COLOR_RED) << error.message;
+          err.Color(ANSI_COLOR_RESET) << '\n';
+          err.Flush();
+          std::exit(EXIT_FAILURE);
+        }
+        std::cout << "Scanners of " << lrone::ScanKernelName(
+                                          lrone::DetectScanKernel())
+                  << " and below match the scalar one" << std::endl;
+        std::exit(0);
+        break;
+      case 'd':
+        serverSocket = optarg;
+        break;
+      case 'e':
+        benchmarkFile = optarg;
+        break;
+      case 'F':
+        forking = true;
+        break;
+      case 'f':
+        inputFile = optarg;
+        break;
       case 'g':
         grammarFile = optarg;
         break;
       case 'h':
         std::cout << "Usage: " << argv[0] << " [OPTION]" << std::endl;
+        std::cout << " -a cpu\t\tPin the process to one CPU" << std::endl;
         std::cout << " -b\t\tBenchmark mode, show timings and disable output"
                   << std::endl;
+        std::cout << " -c socket\tSend input to a server, see -d" << std::endl;
+        std::cout << " -C\t\tCheck the SIMD scanners against the scalar one "
+                     "and exit"
+                  << std::endl;
+        std::cout << " -d socket\tRun as server on a Unix domain socket"
+                  << std::endl;
+        std::cout << " -e file\tSave the timings of every phase as JSON"
+                  << std::endl;
+        std::cout << " -f file\tRead input string from file" << std::endl;
+        std::cout << " -F\t\tTime forking the parse at its deepest point in "
+                     "benchmark mode"
+                  << std::endl;
         std::cout << " -g file\tLoad grammar from file" << std::endl;
         std::cout << " -h\t\tDisplay this information" << std::endl;
+        std::cout << " -i file\tReuse and update a cache of the previous "
+                     "build of the table"
+                  << std::endl;
+        std::cout << " -j file\tSave parsing table as JSON" << std::endl;
+        std::cout << " -k\t\tCount cycles, instructions, cache and branch "
+                     "misses per profiled scope, see -b and -p"
+                  << std::endl;
         std::cout << " -l\t\tSet column length for parsing result table"
                   << std::endl;
+        std::cout << " -L count\tCompare parsing count times with the library "
+                     "in this process with spawning the program"
+                  << std::endl;
+        std::cout << " -m\t\tMonochrome output without ANSI colors"
+                  << std::endl;
+        std::cout << " -M megabytes\tBuild the parsing table on disk within "
+                     "this much memory, see -T"
+                  << std::endl;
+        std::cout << " -n count\tRequests sent by -c in benchmark mode"
+                  << std::endl;
         std::cout << " -o file\tSave parsing table as CSV" << std::endl;
         std::cout << " -p file\tSave profiling data as JSON" << std::endl;
+        std::cout << " -q\t\tBuild a minimal LR(1) table by merging "
+                     "compatible states"
+                  << std::endl;
+        std::cout << " -r n[,w]\tTime every phase n times after w untimed "
+                     "runs in benchmark mode (default 10,2)"
+                  << std::endl;
         std::cout << " -s string\tInput String" << std::endl;
+        std::cout << " -S file\tParse every line of a file as an input of "
+                     "its own, in lockstep batches"
+                  << std::endl;
+        std::cout << " -t threads\tParse in parallel chunks, with -b compare "
+                     "1 to this many threads"
+                  << std::endl;
+        std::cout << " -T file\tTable file built by -M, without -M parse "
+                     "with the table in an existing one"
+                  << std::endl;
+        std::cout << " -u\t\tBypass unit rules (A → B) in the parsing table"
+                  << std::endl;
+        std::cout << " -v file\tNumber the states and terminals of the "
+                     "parsing table by their use in the sentences of a "
+                     "file, one per line"
+                  << std::endl;
+        std::cout << " -w file\tWarm up a lazy table with the sentences of "
+                     "a file, one per line"
+                  << std::endl;
+        std::cout << " -x\t\tRemove useless symbols and duplicate rules "
+                     "from the grammar"
+                  << std::endl;
+        std::cout << " -y\t\tLike -x and number the symbols by their use"
+                  << std::endl;
+        std::cout << " -z\t\tBuild the rows of the parsing table lazily "
+                     "while parsing"
+                  << std::endl;
         std::exit(0);
         break;
+      case 'i':
+        cacheFile = optarg;
+        break;
+      case 'j':
+        jsonFile = optarg;
+        break;
+      case 'k':
+        hardwareCounters = true;
+        break;
       case 'l':
         parsing_col_size = atoi(optarg);
         break;
+      case 'L':
+        libraryRuns = atoi(optarg);
+        if (libraryRuns == 0) {
+          std::cerr << "Error: Invalid run count: " << optarg << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        break;
+      case 'm':
+        color_mode = false;
+        break;
+      case 'M':
+        memoryCap = std::strtoull(optarg, nullptr, 10) << 20;
+        if (memoryCap == 0) {
+          std::cerr << "Error: Invalid memory cap: " << optarg << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        break;
+      case 'n':
+        repeat = atoi(optarg);
+        break;
       case 'o':
         csvFile = optarg;
         break;
@@ -52,81 +239,702 @@ int main(int argc, char *argv[]) {
         benchmark_mode = true;
         lrone::Profiler::Initialize(optarg);
         break;
+      case 'q':
+        minimalTable = true;
+        break;
+      case 'r':
+        if (std::sscanf(optarg, "%u,%u", &iterations, &warmup) < 1 ||
+            iterations == 0) {
+          std::cerr << "Error: Invalid repetitions: " << optarg << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        break;
       case 's':
         inputString = optarg;
         break;
+      case 'S':
+        sentenceFile = optarg;
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      case 'T':
+        tableFile = optarg;
+        break;
+      case 'u':
+        unitElimination = true;
+        break;
+      case 'v':
+        layoutFile = optarg;
+        break;
+      case 'w':
+        warmUpFile = optarg;
+        lazyTable = true;
+        break;
+      case 'x':
+        reduceGrammar = true;
+        break;
+      case 'y':
+        reduceGrammar = true;
+        renumberSymbols = true;
+        break;
+      case 'z':
+        lazyTable = true;
+        break;
       }
     }
   }
 
+  if (pinnedCPU >= 0 && !lrone::PinToCPU(pinnedCPU)) {
+    auto &err = lrone::Err();
+    err.Color(ANSI_COLOR_YELLOW) << "Warning: Failed to pin to CPU "
+                                 << pinnedCPU;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    pinnedCPU = -1;
+  }
+
+  // opened for the main thread, which runs every profiled scope
+  if (hardwareCounters)
+    lrone::PerfCounters::Open();
+
+  if (serverSocket) {
+    // tables of loaded grammars are not displayed
+    benchmark_mode = true;
+    auto result = lrone::RunServer(
+        serverSocket, {.unitElimination = unitElimination});
+    lrone::Profiler::Finalize();
+    return result;
+  }
+
   if (!grammarFile) {
     std::cerr << "Error: No grammar file specified! Try -h for help."
               << std::endl;
     std::exit(EXIT_FAILURE);
   }
 
-  // Load grammar and computer FIRST()
-  auto timeStart = std::chrono::system_clock::now();
+  if (lazyTable && (cacheFile || unitElimination || csvFile || jsonFile ||
+                    minimalTable || layoutFile || sentenceFile)) {
+    std::cerr << "Error: A lazy table (-z, -w) cannot be combined with -i, "
+                 "-o, -j, -q, -u, -v or -S"
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  const bool spilled = memoryCap > 0 || tableFile;
+  if (spilled && (lazyTable || cacheFile || unitElimination || minimalTable ||
+                  layoutFile || sentenceFile || threads > 0 || forking)) {
+    std::cerr << "Error: A table on disk (-M, -T) cannot be combined with -F, "
+                 "-i, -q, -u, -v, -w, -z, -S or -t"
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if (minimalTable && cacheFile) {
+    std::cerr << "Error: A minimal table (-q) cannot be combined with -i"
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  // Read input
+  std::string input;
+  std::unique_ptr<lrone::MappedFile> mappedInput;
+  if (inputString) {
+    input = inputString;
+  } else if (inputFile) {
+    mappedInput = std::make_unique<lrone::MappedFile>(inputFile);
+    if (!mappedInput->IsOpen()) {
+      std::cerr << "Error: Failed to open input file: " << inputFile
+                << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  if (clientSocket) {
+    if (mappedInput)
+      input.assign(mappedInput->Data(), mappedInput->Size());
+    return lrone::RunClient(clientSocket, grammarFile, input, repeat);
+  }
+
+  if (libraryRuns > 0) {
+    // the library embedded in this process against running the program
+    if (mappedInput)
+      input.assign(mappedInput->Data(), mappedInput->Size());
+    auto result = lrone::RunLibraryBenchmark(
+        grammarFile, input, mappedInput ? inputFile : nullptr, libraryRuns);
+    lrone::Profiler::Finalize();
+    return result;
+  }
 
-  auto g = lrone::Grammar::FromFile(grammarFile);
-  g.Calculate();
+  // every phase is repeated in benchmark mode and runs once otherwise
+  lrone::Benchmark bench(
+      benchmark_mode ? warmup : 0, benchmark_mode ? iterations : 1);
+  bench.cpu = pinnedCPU;
+  const bool repeated = bench.warmup + bench.iterations > 1;
+
+  // previous build for an incremental rebuild
+  lrone::TableCache cache;
+  lrone::RebuildStats rebuild{};
+  bool cached = false;
+  if (cacheFile) {
+    const auto &stats = bench.Measure(
+        "Cache loading", [&] { cache = lrone::TableCache(); },
+        [&] { cached = cache.Load(cacheFile); });
+    if (benchmark_mode) {
+      lrone::Benchmark::Display(stats);
+      std::cout << (cached ? "" : " (no usable cache)") << std::endl;
+    }
+  }
 
-  auto timeEnd = std::chrono::system_clock::now();
+  // Load grammar and compute FIRST(), the file is read once so that only
+  // the parsing of the grammar is timed
+  std::string grammarText;
+  if (auto error = lrone::Grammar::ReadFile(grammarFile, grammarText)) {
+    auto &err = lrone::Err();
+    err.Color(ANSI_COLOR_RED) << error.message;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    std::exit(EXIT_FAILURE);
+  }
+  {
+    auto &out = lrone::Out();
+    out.Color(ANSI_COLOR_GREEN) << "Loading grammar from file: " << grammarFile;
+    out.Color(ANSI_COLOR_RESET) << '\n';
+    out.Flush();
+  }
+  std::istringstream grammarStream;
+  lrone::Grammar parsed;
+  const auto &loading = bench.Measure(
+      "Grammar loading",
+      [&] {
+        parsed = lrone::Grammar();
+        grammarStream.clear();
+        grammarStream.str(grammarText);
+      },
+      [&] { parsed = lrone::Grammar(grammarStream); });
   if (benchmark_mode) {
-    std::cout << "Grammar loading time: "
-              << std::chrono::duration_cast<std::chrono::nanoseconds>(
-                     timeEnd - timeStart)
-                         .count() /
-                     1000.0
-              << " us" << std::endl;
+    lrone::Benchmark::Display(loading);
+    std::cout << std::endl;
+  }
+  for (const auto &warning : parsed.warnings) {
+    auto &err = lrone::Err();
+    err.Color(ANSI_COLOR_YELLOW) << "Warning: " << warning;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+  }
+
+  // without useless symbols, the table is built for the reduced grammar
+  lrone::GrammarReduction reduction;
+  if (reduceGrammar) {
+    lrone::Grammar reduced;
+    const auto &stats = bench.Measure(
+        "Grammar reduction", [&] { reduced = lrone::Grammar(); },
+        [&] {
+          reduced = lrone::ReduceGrammar(parsed, renumberSymbols, reduction);
+        });
+    if (benchmark_mode) {
+      lrone::Benchmark::Display(stats);
+      std::cout << " (removed " << reduction.unproductive.size()
+                << " non-productive and " << reduction.unreachable.size()
+                << " unreachable non-terminals, "
+                << reduction.unusedTerminals.size() << " unused terminals, "
+                << reduction.uselessRules.size() << " rules with them and "
+                << reduction.duplicateRules.size() << " duplicate rules)"
+                << std::endl;
+    } else {
+      reduction.Display(parsed);
+    }
+    parsed = std::move(reduced);
+  }
+
+  lrone::Grammar g;
+  const auto &first = bench.Measure(
+      "FIRST sets", [&] { g = parsed; },
+      [&] {
+        if (cached) {
+          rebuild = lrone::CalculateIncremental(g, cache);
+        } else {
+          g.Calculate();
+        }
+      });
+  if (benchmark_mode) {
+    lrone::Benchmark::Display(first);
+    std::cout << std::endl;
   }
   if (!benchmark_mode) {
     g.Display();
   }
 
-  // Build the parsing table
-  timeStart = std::chrono::high_resolution_clock::now();
+  // benchmark output stays free of warnings about the grammar itself
+  if (!benchmark_mode) {
+    auto &err = lrone::Err();
+    for (auto rule : g.RightRecursiveRules()) {
+      err.Color(ANSI_COLOR_YELLOW)
+          << "Warning: Rule " << rule << " ("
+          << g.nonTerminals[g.rules[rule].first] << " →";
+      for (const auto &symbol : g.rules[rule].second) {
+        err << ' '
+            << (symbol.type == lrone::Symbol::Type::Terminal
+                    ? g.terminals[symbol.id]
+                    : g.nonTerminals[symbol.id]);
+      }
+      err << ") is right recursive, the parse stack grows with every "
+             "repetition";
+      err.Color(ANSI_COLOR_RESET) << '\n';
+    }
+    err.Flush();
+  }
+
+  // DFA of the %token definitions, the input is lexed with it if there are any
+  lrone::Lexer lexer;
+  lrone::Error lexerError;
+  const auto &lexerBuilding = bench.Measure(
+      "Lexer building", [&] { lexer = lrone::Lexer(); },
+      [&] { lexerError = lrone::Lexer::Build(g, lexer); });
+  if (lexerError) {
+    auto &err = lrone::Err();
+    err.Color(ANSI_COLOR_RED) << lexerError.message;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    std::exit(EXIT_FAILURE);
+  }
+  if (benchmark_mode && lexer.Enabled()) {
+    lrone::Benchmark::Display(lexerBuilding);
+    std::cout << " (" << lexer.States() << " DFA states, " << lexer.Classes()
+              << " byte classes, " << lexer.TableBytes() << " bytes)"
+              << std::endl;
+  }
 
-  auto table = lrone::GenerateTable(g);
+  // a table built under a memory cap without -T goes to a temporary file that
+  // is removed once it is mapped
+  std::string tablePath;
+  std::string spillDirectory = "/tmp";
+  if (const char *tmp = std::getenv("TMPDIR"))
+    spillDirectory = tmp;
+  if (tableFile) {
+    tablePath = tableFile;
+  } else if (memoryCap) {
+    tablePath = spillDirectory + "/lrone-table-XXXXXX";
+    const int fd = mkstemp(tablePath.data());
+    if (fd < 0) {
+      std::cerr << "Error: Failed to create a table file in "
+                << spillDirectory << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    close(fd);
+  }
+
+  // Build the parsing table, each repetition starts from the loaded cache
+  lrone::LRTable table;
+  std::unique_ptr<lrone::LazyTable> lazy;
+  lrone::MappedTable mapped;
+  lrone::SpillStats spill{};
+  lrone::Error spillError;
+  lrone::TableCache working;
+  unsigned int added = 0;
+  lrone::MinimalStats minimal{};
+  // growth of the peak RSS while the table is built under the cap
+  const bool rssReset = memoryCap && benchmark_mode && lrone::ResetPeakRSS();
+  const size_t rssBefore = lrone::CurrentRSS();
+  const auto &building = bench.Measure(
+      spilled && !memoryCap ? "Table file opening" : "Parsing table building",
+      [&] {
+        table = lrone::LRTable();
+        lazy.reset();
+        mapped = lrone::MappedTable();
+        if (cacheFile && repeated)
+          working = cache;
+      },
+      [&] {
+        if (spilled) {
+          if (memoryCap) {
+            spillError = lrone::GenerateSpilledTable(
+                g, tablePath,
+                {.memoryCap = memoryCap, .directory = spillDirectory}, &spill);
+          }
+          if (!spillError)
+            spillError = lrone::MappedTable::Open(tablePath, mapped);
+        } else if (lazyTable) {
+          lazy = std::make_unique<lrone::LazyTable>(g);
+        } else if (minimalTable) {
+          table = lrone::GenerateMinimalTable(g, &minimal, !benchmark_mode);
+        } else {
+          table = lrone::GenerateTable(
+              g, cacheFile ? (repeated ? &working : &cache) : nullptr,
+              cacheFile ? &rebuild : nullptr, !benchmark_mode);
+        }
+        if (unitElimination)
+          added = lrone::EliminateUnitRules(table, g);
+      });
+  if (cacheFile && repeated)
+    cache = std::move(working);
+  const size_t rssPeak = lrone::PeakRSS();
+  if (memoryCap && !tableFile)
+    unlink(tablePath.c_str());
+  if (spillError) {
+    auto &err = lrone::Err();
+    err.Color(ANSI_COLOR_RED) << spillError.message;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    std::exit(EXIT_FAILURE);
+  }
+  if (spilled && (mapped.Terminals() != g.terminals.size() ||
+                  mapped.NonTerminals() != g.nonTerminals.size())) {
+    auto &err = lrone::Err();
+    err.Color(ANSI_COLOR_RED) << "Error: The table file " << tablePath
+                              << " was built for another grammar";
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    std::exit(EXIT_FAILURE);
+  }
 
-  timeEnd = std::chrono::system_clock::now();
   if (benchmark_mode) {
-    std::cout << "Parsing table building time: "
-              << std::chrono::duration_cast<std::chrono::nanoseconds>(
-                     timeEnd - timeStart)
-                         .count() /
-                     1000.0
-              << " us" << std::endl;
+    if (unitElimination) {
+      std::cout << "Unit rule elimination added " << added << " states"
+                << std::endl;
+    }
+    lrone::Benchmark::Display(building);
+    std::cout << (lazy            ? " (lazy)"
+                  : minimalTable  ? " (minimal)"
+                  : memoryCap     ? " (spilled)"
+                  : spilled       ? " (mapped)"
+                                  : "")
+              << std::endl;
   }
 
-  if (!benchmark_mode) {
+  if (cacheFile) {
+    if (benchmark_mode) {
+      if (rebuild.compatible) {
+        std::cout << "Incremental rebuild: " << rebuild.changedNonTerminals
+                  << " non-terminals with changed rules, FIRST reused for "
+                  << rebuild.firstReused << " of "
+                  << rebuild.firstReused + rebuild.firstComputed
+                  << ", closures reused for " << rebuild.closuresReused
+                  << " of "
+                  << rebuild.closuresReused + rebuild.closuresComputed
+                  << " states" << std::endl;
+      } else {
+        std::cout << "Incremental rebuild: "
+                  << (cached ? "grammar symbols changed" : "no cache")
+                  << ", built from scratch" << std::endl;
+      }
+    }
+    if (!cache.Save(cacheFile)) {
+      auto &err = lrone::Err();
+      err.Color(ANSI_COLOR_RED) << "Failed to save cache file: " << cacheFile;
+      err.Color(ANSI_COLOR_RESET) << '\n';
+      err.Flush();
+    }
+  }
+
+  // rows and columns in the order the parses of a sample corpus use them, the
+  // table as built is kept to compare with
+  lrone::LRTable original;
+  lrone::Grammar originalGrammar;
+  lrone::TableLayout layout;
+  if (layoutFile) {
+    lrone::TableProfile profile(table);
+    unsigned int sentences = 0;
+    {
+      lrone::LRParser parser(table, g);
+      parser.profile = &profile;
+      ForEachSentence(
+          layoutFile, "layout corpus", lexer, g, [&](const auto &terminals) {
+            parser.ParseWith<lrone::ProfiledParse<lrone::SilentParse>>(
+                terminals);
+            ++sentences;
+          });
+    }
+
+    lrone::LRTable permuted;
+    const auto &stats = bench.Measure(
+        "Table layout", [&] { permuted = lrone::LRTable(); },
+        [&] {
+          layout = lrone::ProfileLayout(table, profile, true);
+          permuted = lrone::PermuteTable(table, layout);
+        });
+    original = std::move(table);
+    table = std::move(permuted);
+    originalGrammar = std::move(g);
+    g = lrone::PermuteTerminals(originalGrammar, layout.terminals);
+    // the lexer returns the new terminal ids
+    lexer = lrone::Lexer();
+    if (auto error = lrone::Lexer::Build(g, lexer)) {
+      auto &err = lrone::Err();
+      err.Color(ANSI_COLOR_RED) << error.message;
+      err.Color(ANSI_COLOR_RESET) << '\n';
+      err.Flush();
+      std::exit(EXIT_FAILURE);
+    }
+
+    if (benchmark_mode)
+      lrone::ReportLayout(stats, profile, layout, sentences);
+  }
+
+  // the rows of a table on disk are only read into memory to display or
+  // export them
+  if (spilled && (!benchmark_mode || csvFile || jsonFile))
+    table = mapped.Load();
+
+  if (lazy) {
+    // rows are only known after parsing
+  } else if (!benchmark_mode) {
     table.Display(g);
+    if (!table.conflicts.empty())
+      table.DisplayConflicts(g);
+  } else if (spilled) {
+    auto unresolved = std::count_if(
+        mapped.Conflicts().begin(), mapped.Conflicts().end(),
+        [](const auto &c) {
+          return c.resolution == lrone::LRConflict::Resolution::Unresolved;
+        });
+    std::cout << "Parsing table: " << mapped.States() << " states, "
+              << mapped.Conflicts().size() - unresolved
+              << " conflicts resolved by precedence, " << unresolved
+              << " unresolved, table file " << mapped.FileBytes()
+              << " bytes mapped" << std::endl;
+
+    if (memoryCap) {
+      lrone::ReportSpilled(
+          bench, building, spill, memoryCap, rssReset, rssBefore, rssPeak, g);
+    }
+  } else {
+    auto unresolved = std::count_if(
+        table.conflicts.begin(), table.conflicts.end(), [](const auto &c) {
+          return c.resolution == lrone::LRConflict::Resolution::Unresolved;
+        });
+    std::cout << "Parsing table: " << table.actions.size() << " states, "
+              << table.conflicts.size() - unresolved
+              << " conflicts resolved by precedence, " << unresolved
+              << " unresolved" << std::endl;
+
+    auto memory = table.MemoryUsage();
+    std::cout << "Grammar memory: " << g.MemoryUsage() << " bytes"
+              << std::endl;
+    std::cout << "Parsing table memory: " << memory.Total()
+              << " bytes (actions " << memory.actions << ", goto "
+              << memory.goTo << ", row headers " << memory.rowHeaders
+              << " for " << memory.rows << " rows, conflicts "
+              << memory.conflicts << ")" << std::endl;
+
+    if (minimalTable)
+      lrone::ReportMinimal(bench, minimal, g);
   }
 
-  if (csvFile) {
-    table.WriteCSV(csvFile, g);
+  if (csvFile && !table.WriteCSV(csvFile, g)) {
+    auto &err = lrone::Err();
+    err.Color(ANSI_COLOR_RED) << "Failed to open CSV file: " << csvFile;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
   }
 
-  // Parse
-  if (inputString) {
-    timeStart = std::chrono::system_clock::now();
+  if (jsonFile && !table.WriteJSON(jsonFile, g)) {
+    auto &err = lrone::Err();
+    err.Color(ANSI_COLOR_RED) << "Failed to open JSON file: " << jsonFile;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+  }
+
+  // build the states visited by a sample corpus before the measured parse,
+  // timed once since it changes the table
+  if (warmUpFile) {
+    auto timeStart = std::chrono::steady_clock::now();
 
-    auto parser = lrone::LRParser(table, g);
-    auto input = std::string(inputString);
-    parser.Parse(lrone::StringToTerminals(input, g));
+    lrone::LRParser parser(*lazy, g);
+    unsigned int sentences = 0;
+    ForEachSentence(
+        warmUpFile, "warm-up file", lexer, g, [&](const auto &terminals) {
+          parser.ParseWith<lrone::LazyParse<lrone::SilentParse>>(terminals);
+          ++sentences;
+        });
 
-    timeEnd = std::chrono::system_clock::now();
+    auto timeEnd = std::chrono::steady_clock::now();
     if (benchmark_mode) {
-      std::cout << "Parsing time: "
-                << std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::cout << "Warm-up time: "
+                << std::chrono::duration<double, std::micro>(
                        timeEnd - timeStart)
-                           .count() /
-                       1000.0
-                << " us" << std::endl;
+                       .count()
+                << " us (" << sentences << " sentences, "
+                << lazy->StatesVisited() << " states visited)" << std::endl;
+    }
+  }
+
+  // Parse
+  size_t inputTokens = 0;
+  if (inputString || inputFile) {
+    std::vector<unsigned int> terminals;
+    lrone::Error error;
+    double lexingTime = 0;
+    if (lexer.Enabled()) {
+      std::string_view text = mappedInput ? std::string_view(
+                                                mappedInput->Data(),
+                                                mappedInput->Size())
+                                          : std::string_view(input);
+      const auto &lexing = bench.Measure(
+          "Lexing", [&] { terminals = {}; },
+          [&] { error = lexer.Lex(text, terminals); });
+      lexingTime = lexing.median;
+      if (benchmark_mode && !error) {
+        lrone::Benchmark::Display(lexing);
+        std::cout << " (" << text.size() / lexing.median << " MB/s, "
+                  << terminals.size() - 1 << " tokens)" << std::endl;
+      }
+    } else if (mappedInput) {
+      auto kernel = lrone::DetectScanKernel();
+      std::vector<lrone::TokenSpan> tokens;
+      const auto &scanning = bench.Measure(
+          "Scanning", [&] { tokens = {}; },
+          [&] {
+            lrone::ScanTokens(
+                mappedInput->Data(), mappedInput->Size(), tokens, kernel);
+          });
+      if (benchmark_mode) {
+        lrone::ReportScanning(
+            bench, scanning, mappedInput->Data(), mappedInput->Size(), tokens,
+            kernel);
+      }
+
+      error = lrone::TokensToTerminals(
+          mappedInput->Data(), tokens, g, terminals);
+    } else {
+      error = lrone::StringToTerminals(input, g, terminals);
+    }
+    if (error) {
+      auto &err = lrone::Err();
+      err.Color(ANSI_COLOR_RED) << error.message;
+      err.Color(ANSI_COLOR_RESET) << '\n';
+      err.Flush();
+      std::exit(EXIT_FAILURE);
+    }
+    inputTokens = terminals.size();
+
+    auto parser =
+        lazy ? std::make_unique<lrone::LRParser>(*lazy, g, terminals.size())
+        : spilled
+            ? std::make_unique<lrone::LRParser>(mapped, g, terminals.size())
+            : std::make_unique<lrone::LRParser>(table, g, terminals.size());
+    // the timed runs of benchmark mode print nothing, a syntax error is
+    // reported and the peak depth counted by one more run afterwards
+    bool accepted = false;
+    const auto &parsing = bench.Measure("Parsing", [&] {
+      if (benchmark_mode)
+        accepted = parser->Parse<lrone::SilentParse>(terminals);
+      else if (threads > 0)
+        accepted =
+            parser->ParseParallel<lrone::QuietParse>(terminals, threads);
+      else
+        accepted = parser->Parse<lrone::TracedParse>(terminals);
+    });
+    if (benchmark_mode)
+      parser->Parse<lrone::DepthParse<lrone::QuietParse>>(terminals);
+
+    if (threads > 0 && !benchmark_mode && accepted) {
+      auto &out = lrone::Out();
+      out.Color(ANSI_COLOR_GREEN) << "Input accepted!";
+      out.Color(ANSI_COLOR_RESET) << '\n';
+      out.Flush();
+    }
+    if (benchmark_mode) {
+      lrone::Benchmark::Display(parsing);
+      std::cout << " (" << terminals.size() / parsing.median
+                << " M tokens/s)" << std::endl;
+      if (lexer.Enabled()) {
+        const size_t bytes = mappedInput ? mappedInput->Size() : input.size();
+        std::cout << "Raw text to result: "
+                  << bytes / (lexingTime + parsing.median) << " MB/s"
+                  << std::endl;
+      }
+      if (layoutFile) {
+        lrone::ReportLayoutParsing(
+            bench, *parser, terminals, accepted, original, originalGrammar,
+            layout);
+      }
+      std::cout << "Reductions per token: "
+                << double(parser->reductions) / terminals.size() << std::endl;
+      std::cout << "Peak stack depth: " << parser->maxDepth << std::endl;
+
+      if (forking)
+        lrone::ReportForking(bench, *parser, terminals);
+
+      if (threads > 0)
+        lrone::ReportThreads(bench, *parser, terminals, threads, accepted);
     }
     // std::cout << std::endl;
   }
 
+  // many short inputs, one per line
+  if (sentenceFile) {
+    std::vector<uint32_t> sentences;
+    std::vector<uint32_t> starts;
+    ForEachSentence(
+        sentenceFile, "sentence file", lexer, g, [&](const auto &terminals) {
+          starts.push_back(sentences.size());
+          sentences.insert(sentences.end(), terminals.begin(), terminals.end());
+        });
+    inputTokens += sentences.size();
+
+    lrone::BatchParser batch(table, g);
+    const auto kernel = lrone::DetectBatchKernel();
+    std::vector<lrone::BatchResult> results;
+    const auto &batching = bench.Measure("Batch parsing", [&] {
+      batch.Parse(sentences, starts, results, kernel);
+    });
+
+    if (!benchmark_mode) {
+      auto &out = lrone::Out();
+      size_t accepted = 0;
+      for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i].accepted) {
+          ++accepted;
+          continue;
+        }
+        out.Color(ANSI_COLOR_RED) << "Sentence " << i + 1
+                                  << " rejected at token "
+                                  << results[i].errorPosition;
+        out.Color(ANSI_COLOR_RESET) << '\n';
+      }
+      out << accepted << " of " << results.size() << " sentences accepted\n";
+      out.Flush();
+    } else {
+      lrone::ReportBatch(
+          bench, batching, batch, kernel, results, sentences, starts, table,
+          g);
+    }
+  }
+
+  if (lazy && !benchmark_mode) {
+    if (!lazy->table.conflicts.empty())
+      lazy->table.DisplayConflicts(g);
+    std::cout << "Lazy table: " << lazy->StatesVisited() << " of "
+              << lazy->StatesFound() << " states found were visited"
+              << std::endl;
+  } else if (lazy) {
+    lrone::ReportLazy(bench, *lazy, g);
+  }
+
+  if (benchmark_mode) {
+    lrone::Profiler::DisplayMemory();
+    lrone::Profiler::DisplayCounters();
+    std::cout << "Peak heap: " << lrone::heap_counters.peak
+              << " bytes, peak RSS: " << lrone::PeakRSS() << " bytes"
+              << std::endl;
+  }
+
+  if (benchmarkFile) {
+    bench.properties = {
+        {"grammar", grammarFile},
+        {"input", inputFile ? inputFile : inputString ? inputString : ""},
+        {"tokens", std::to_string(inputTokens)},
+        {"table", lazy               ? "lazy"
+                  : memoryCap       ? "spilled"
+                  : spilled         ? "mapped"
+                  : unitElimination ? "unit rules bypassed"
+                  : cacheFile       ? "incremental"
+                  : minimalTable    ? "minimal"
+                                    : "full"},
+        {"layout", layoutFile ? "profiled" : "as built"},
+    };
+    bench.WriteJSON(benchmarkFile);
+  }
+
   lrone::Profiler::Finalize();
   return 0;
 }
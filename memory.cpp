@@ -0,0 +1,127 @@
+#include "memory.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+
+namespace lrone {
+
+// field of /proc/self/status in bytes, 0 if unknown
+static size_t StatusBytes(const char *field) {
+  // plain stdio, this is read at the end of a benchmark and should not
+  // allocate on the heap it measures
+  FILE *status = std::fopen("/proc/self/status", "r");
+  if (!status)
+    return 0;
+  const size_t length = std::strlen(field);
+  char line[256];
+  size_t kib = 0;
+  while (std::fgets(line, sizeof(line), status)) {
+    if (std::strncmp(line, field, length) == 0) {
+      kib = std::strtoull(line + length, nullptr, 10);
+      break;
+    }
+  }
+  std::fclose(status);
+  return kib * 1024;
+}
+
+size_t PeakRSS() { return StatusBytes("VmHWM:"); }
+
+size_t CurrentRSS() { return StatusBytes("VmRSS:"); }
+
+bool ResetPeakRSS() {
+  FILE *clear = std::fopen("/proc/self/clear_refs", "w");
+  if (!clear)
+    return false;
+  const bool written = std::fputs("5", clear) >= 0;
+  return std::fclose(clear) == 0 && written;
+}
+
+} // namespace lrone
+
+// Every allocation goes through these so it can be attributed to the
+// innermost PROFILE_SCOPE, see Profiler
+
+static inline void *Counted(void *p, size_t size) {
+  auto &counters = lrone::heap_counters;
+  ++counters.allocations;
+  counters.bytes += size;
+  counters.live += malloc_usable_size(p);
+  if (counters.live > counters.peak)
+    counters.peak = counters.live;
+  return p;
+}
+
+static inline void Release(void *p) {
+  if (!p)
+    return;
+  lrone::heap_counters.live -= malloc_usable_size(p);
+  std::free(p);
+}
+
+static void *Allocate(size_t size) {
+  if (size == 0)
+    size = 1;
+  while (true) {
+    if (void *p = std::malloc(size))
+      return Counted(p, size);
+    auto handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+static void *AllocateAligned(size_t size, std::align_val_t alignment) {
+  auto align = static_cast<size_t>(alignment);
+  // aligned_alloc needs a multiple of the alignment
+  size = (std::max<size_t>(size, 1) + align - 1) & ~(align - 1);
+  while (true) {
+    if (void *p = std::aligned_alloc(align, size))
+      return Counted(p, size);
+    auto handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+void *operator new(size_t size) { return Allocate(size); }
+void *operator new[](size_t size) { return Allocate(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new(size_t size, std::align_val_t alignment) {
+  return AllocateAligned(size, alignment);
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return AllocateAligned(size, alignment);
+}
+
+void operator delete(void *p) noexcept { Release(p); }
+void operator delete[](void *p) noexcept { Release(p); }
+void operator delete(void *p, size_t) noexcept { Release(p); }
+void operator delete[](void *p, size_t) noexcept { Release(p); }
+void operator delete(void *p, std::align_val_t) noexcept { Release(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { Release(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  Release(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  Release(p);
+}
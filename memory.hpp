@@ -0,0 +1,15 @@
+#pragma once
+
+#include "lrone.hpp"
+
+namespace lrone {
+
+// Peak resident set size of the process in bytes (VmHWM), 0 if unknown
+size_t PeakRSS();
+// Resident set size of the process in bytes (VmRSS), 0 if unknown
+size_t CurrentRSS();
+// Sets the peak resident set size to the current one, false if the kernel
+// does not allow it
+bool ResetPeakRSS();
+
+} // namespace lrone
@@ -1,9 +1,12 @@
 #include "lrone.hpp"
 
 #include <algorithm>
+#include <cstdio>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sys/ioctl.h>
+#include <vector>
 
 unsigned int GetTermW() {
   struct winsize w;
@@ -11,7 +14,7 @@ unsigned int GetTermW() {
   return w.ws_col;
 }
 
-size_t UTF8Length(std::string s) {
+size_t UTF8Length(std::string_view s) {
   return std::count_if(s.begin(), s.end(), [](char c) {
     return (static_cast<unsigned char>(c) & 0xC0) != 0x80;
   });
@@ -21,15 +24,31 @@ void interaction_pause() {
   std::cout << std::endl << "Press any key to continue" << std::endl;
 }
 
+bool benchmark_mode = false;
+bool color_mode = false;
+unsigned int parsing_col_size = 20;
+
+// counted by the operator new of the command line program, which an embedding
+// application does not get
+thread_local constinit lrone::HeapCounters lrone::heap_counters;
+
 std::ofstream lrone::Profiler::file;
 bool lrone::Profiler::enabled;
-std::chrono::high_resolution_clock::time_point lrone::Profiler::startTime;
+std::chrono::steady_clock::time_point lrone::Profiler::startTime;
+thread_local constinit lrone::Profiler *lrone::Profiler::current = nullptr;
+std::atomic<lrone::ProfileSite *> lrone::ProfileSite::first = nullptr;
+
+lrone::ProfileSite::ProfileSite(const char *label)
+    : name(label), next(first.load()) {
+  while (!first.compare_exchange_weak(this->next, this))
+    ;
+}
 
 void lrone::Profiler::Initialize(const char *filename) {
   enabled = true;
   file.open(filename);
   file << "{\n\"traceEvents\": [\n";
-  startTime = std::chrono::high_resolution_clock::now();
+  startTime = std::chrono::steady_clock::now();
 }
 
 void lrone::Profiler::Finalize() {
@@ -39,3 +58,135 @@ void lrone::Profiler::Finalize() {
     file.close();
   }
 }
+
+void lrone::Profiler::Event(char phase, const PerfCounters &counters) {
+  auto currentTime = std::chrono::steady_clock::now();
+  std::chrono::duration<double, std::micro> offsetTime =
+      currentTime - startTime;
+  file << "{\"pid\": 1, \"ts\": " << offsetTime.count() << ", \"name\": \""
+       << this->site.name << "\", \"ph\": \"" << phase << "\"";
+  if (phase == 'E') {
+    // own allocations, the ones of nested scopes are in their own events
+    auto allocations = heap_counters.allocations - this->start.allocations -
+                       this->nested.allocations;
+    auto bytes =
+        heap_counters.bytes - this->start.bytes - this->nested.bytes;
+    file << ", \"args\": {\"allocations\": " << allocations
+         << ", \"bytes\": " << bytes;
+    for (int c = 0; c < PerfCounters::Count; ++c) {
+      if (!PerfCounters::Available(PerfCounters::Counter(c)))
+        continue;
+      file << ", \"" << PerfCounters::names[c] << "\": "
+           << counters.values[c] - this->counterStart.values[c] -
+                  this->counterNested.values[c];
+    }
+    file << "}";
+  }
+  file << "},\n";
+  file << "{\"pid\": 1, \"ts\": " << offsetTime.count()
+       << ", \"name\": \"heap\", \"ph\": \"C\", \"args\": {\"live bytes\": "
+       << heap_counters.live << "}},\n";
+  // running totals of the thread, one track each as their scales differ
+  for (int c = 0; c < PerfCounters::Count; ++c) {
+    if (!PerfCounters::Available(PerfCounters::Counter(c)))
+      continue;
+    file << "{\"pid\": 1, \"ts\": " << offsetTime.count() << ", \"name\": \""
+         << PerfCounters::names[c] << "\", \"ph\": \"C\", \"args\": {\""
+         << PerfCounters::names[c] << "\": " << counters.values[c] << "}},\n";
+  }
+}
+
+void lrone::Profiler::CountHardware(const PerfCounters &end) {
+  for (int c = 0; c < PerfCounters::Count; ++c) {
+    auto total = end.values[c] - this->counterStart.values[c];
+    this->site.counters[c].fetch_add(
+        total - this->counterNested.values[c], std::memory_order_relaxed);
+    if (this->parent)
+      this->parent->counterNested.values[c] += total;
+  }
+}
+
+void lrone::Profiler::DisplayMemory() {
+  std::vector<const ProfileSite *> sites;
+  for (auto site = ProfileSite::first.load(); site; site = site->next) {
+    if (site->allocations != 0)
+      sites.push_back(site);
+  }
+  std::sort(sites.begin(), sites.end(), [](auto a, auto b) {
+    return a->bytes.load() > b->bytes.load();
+  });
+
+  // whatever this thread allocated outside of any scope
+  uint64_t allocations = heap_counters.allocations;
+  uint64_t bytes = heap_counters.bytes;
+  for (auto site : sites) {
+    allocations -= std::min(allocations, site->allocations.load());
+    bytes -= std::min(bytes, site->bytes.load());
+  }
+
+  std::cout << "Heap allocations by scope (calls, allocations, bytes):"
+            << std::endl;
+  for (auto site : sites) {
+    std::cout << "  " << std::setw(8) << site->calls.load() << std::setw(10)
+              << site->allocations.load() << std::setw(12)
+              << site->bytes.load() << "  " << site->name << std::endl;
+  }
+  std::cout << "  " << std::setw(8) << "" << std::setw(10) << allocations
+            << std::setw(12) << bytes << "  (outside profiled scopes)"
+            << std::endl;
+}
+
+void lrone::Profiler::DisplayCounters() {
+  if (!PerfCounters::enabled)
+    return;
+  std::vector<const ProfileSite *> sites;
+  for (auto site = ProfileSite::first.load(); site; site = site->next) {
+    if (site->counters[PerfCounters::Cycles] != 0 ||
+        site->counters[PerfCounters::Instructions] != 0)
+      sites.push_back(site);
+  }
+  std::sort(sites.begin(), sites.end(), [](auto a, auto b) {
+    return a->counters[PerfCounters::Cycles].load() >
+           b->counters[PerfCounters::Cycles].load();
+  });
+
+  // whatever this thread counted outside of any scope
+  PerfCounters outside;
+  PerfCounters::Read(outside);
+  for (auto site : sites) {
+    for (int c = 0; c < PerfCounters::Count; ++c) {
+      outside.values[c] -=
+          std::min(outside.values[c], site->counters[c].load());
+    }
+  }
+
+  std::cout << "Hardware counters by scope (";
+  for (int c = 0; c < PerfCounters::Count; ++c) {
+    std::cout << PerfCounters::names[c]
+              << (PerfCounters::Available(PerfCounters::Counter(c)) ? ""
+                                                                    : " n/a")
+              << ", ";
+  }
+  std::cout << "IPC):" << std::endl;
+  auto line = [](const uint64_t *values, const char *name) {
+    std::cout << "  ";
+    for (int c = 0; c < PerfCounters::Count; ++c)
+      std::cout << std::setw(14) << values[c];
+    // without touching the precision of std::cout
+    char ipc[16];
+    std::snprintf(
+        ipc, sizeof(ipc), "%6.2f",
+        values[PerfCounters::Cycles]
+            ? double(values[PerfCounters::Instructions]) /
+                  values[PerfCounters::Cycles]
+            : 0.0);
+    std::cout << ipc << "  " << name << std::endl;
+  };
+  for (auto site : sites) {
+    uint64_t values[PerfCounters::Count];
+    for (int c = 0; c < PerfCounters::Count; ++c)
+      values[c] = site->counters[c].load();
+    line(values, site->name);
+  }
+  line(outside.values, "(outside profiled scopes)");
+}
@@ -0,0 +1,168 @@
+#include "output.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+namespace lrone {
+
+OutputBuffer::OutputBuffer(int fd) : fd(fd), data(new char[Capacity]) {}
+
+OutputBuffer::OutputBuffer(const char *filename)
+    : fd(open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+      ownsFd(true), data(new char[Capacity]) {}
+
+OutputBuffer::~OutputBuffer() {
+  this->Flush();
+  if (this->ownsFd && this->fd >= 0)
+    close(this->fd);
+  delete[] this->data;
+}
+
+void OutputBuffer::Flush() {
+  if (this->used == 0)
+    return;
+  if (this->fd == STDOUT_FILENO) {
+    // keep the order with anything already written through std::cout
+    std::cout.flush();
+  }
+
+  const char *start = this->data;
+  size_t remaining = this->used;
+  while (remaining > 0 && this->fd >= 0) {
+    auto n = write(this->fd, start, remaining);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    start += n;
+    remaining -= n;
+  }
+  this->used = 0;
+}
+
+OutputBuffer &OutputBuffer::operator<<(std::string_view text) {
+  if (text.size() > Capacity - this->used) {
+    this->Flush();
+    if (text.size() > Capacity) {
+      // too large to be buffered
+      auto fd = this->fd;
+      this->used = 0;
+      const char *start = text.data();
+      size_t remaining = text.size();
+      while (remaining > 0 && fd >= 0) {
+        auto n = write(fd, start, remaining);
+        if (n < 0) {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+        start += n;
+        remaining -= n;
+      }
+      return *this;
+    }
+  }
+  std::copy(text.begin(), text.end(), this->data + this->used);
+  this->used += text.size();
+  return *this;
+}
+
+// write the decimal digits of value backwards ending at end
+static inline char *FormatUnsigned(char *end, unsigned long value) {
+  do {
+    *--end = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  return end;
+}
+
+OutputBuffer &OutputBuffer::operator<<(unsigned long value) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  return *this << std::string_view(FormatUnsigned(end, value), end);
+}
+
+OutputBuffer &OutputBuffer::operator<<(long value) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  char *start;
+  if (value < 0) {
+    start = FormatUnsigned(end, -static_cast<unsigned long>(value));
+    *--start = '-';
+  } else {
+    start = FormatUnsigned(end, value);
+  }
+  return *this << std::string_view(start, end);
+}
+
+void OutputBuffer::Padding(size_t length, unsigned int width) {
+  for (; length < width; ++length)
+    *this << ' ';
+}
+
+OutputBuffer &OutputBuffer::Left(std::string_view text, unsigned int width) {
+  *this << text;
+  this->Padding(text.size(), width);
+  return *this;
+}
+
+OutputBuffer &OutputBuffer::Right(std::string_view text, unsigned int width) {
+  this->Padding(text.size(), width);
+  return *this << text;
+}
+
+OutputBuffer &OutputBuffer::Left(unsigned long value, unsigned int width) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  return this->Left(std::string_view(FormatUnsigned(end, value), end), width);
+}
+
+OutputBuffer &OutputBuffer::Right(unsigned long value, unsigned int width) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  return this->Right(std::string_view(FormatUnsigned(end, value), end), width);
+}
+
+OutputBuffer &OutputBuffer::JSONString(std::string_view text) {
+  static const char hex[] = "0123456789abcdef";
+  *this << '"';
+  for (char c : text) {
+    switch (c) {
+    case '"':
+      *this << "\\\"";
+      break;
+    case '\\':
+      *this << "\\\\";
+      break;
+    case '\n':
+      *this << "\\n";
+      break;
+    case '\t':
+      *this << "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        *this << "\\u00" << hex[c >> 4] << hex[c & 0xF];
+      } else {
+        *this << c;
+      }
+    }
+  }
+  return *this << '"';
+}
+
+OutputBuffer &Out() {
+  static OutputBuffer buffer(STDOUT_FILENO);
+  return buffer;
+}
+
+OutputBuffer &Err() {
+  static OutputBuffer buffer(STDERR_FILENO);
+  return buffer;
+}
+
+} // namespace lrone
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "lrone.hpp"
+
+#include <string_view>
+
+namespace lrone {
+
+// Large reusable output buffer written to a file descriptor with a single
+// write() per flush. Integers are formatted by hand and ANSI color codes are
+// dropped unless color_mode is set.
+class OutputBuffer {
+public:
+  explicit OutputBuffer(int fd);
+  // create or truncate the file, IsOpen() reports failure
+  explicit OutputBuffer(const char *filename);
+  ~OutputBuffer();
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  bool IsOpen() const { return this->fd >= 0; }
+
+  inline OutputBuffer &operator<<(char c) {
+    if (this->used == Capacity)
+      this->Flush();
+    this->data[this->used++] = c;
+    return *this;
+  }
+  OutputBuffer &operator<<(std::string_view text);
+  OutputBuffer &operator<<(unsigned long value);
+  OutputBuffer &operator<<(long value);
+  inline OutputBuffer &operator<<(unsigned int value) {
+    return *this << static_cast<unsigned long>(value);
+  }
+  inline OutputBuffer &operator<<(int value) {
+    return *this << static_cast<long>(value);
+  }
+
+  // ANSI escape for colors, skipped when colors are disabled
+  inline OutputBuffer &Color(const char *code) {
+    if (color_mode)
+      *this << std::string_view(code);
+    return *this;
+  }
+
+  // pad with spaces to at least width bytes
+  OutputBuffer &Left(std::string_view text, unsigned int width);
+  OutputBuffer &Right(std::string_view text, unsigned int width);
+  OutputBuffer &Left(unsigned long value, unsigned int width);
+  OutputBuffer &Right(unsigned long value, unsigned int width);
+
+  // string with JSON escaping and quotes
+  OutputBuffer &JSONString(std::string_view text);
+
+  void Flush();
+
+private:
+  static constexpr size_t Capacity = 1 << 16;
+
+  void Padding(size_t length, unsigned int width);
+
+  int fd;
+  bool ownsFd = false;
+  size_t used = 0;
+  char *data;
+};
+
+// buffer for standard output shared by all Display functions, each of them
+// flushes it when done so that it can be mixed with std::cout
+OutputBuffer &Out();
+// the same for standard error, for warnings and errors
+OutputBuffer &Err();
+
+} // namespace lrone
@@ -1,163 +1,883 @@
 #include "parser.hpp"
 
-#include <iomanip>
+#include "output.hpp"
+
+#include <algorithm>
 #include <iostream>
+#include <queue>
+#include <thread>
+#include <unordered_map>
 
 namespace lrone {
 
-std::vector<unsigned int>
-StringToTerminals(const std::string &terminalsLine, const Grammar &grammar) {
+Error StringToTerminals(
+    std::string_view terminalsLine, const Grammar &grammar,
+    std::vector<unsigned int> &inputTerminals) {
   PROFILE_FUNC;
-  std::vector<unsigned int> inputTerminals;
+  inputTerminals.clear();
   // extract terminals separated by space
   auto start = terminalsLine.begin();
   auto end = start;
   while (end != terminalsLine.end()) {
     end = std::find(start, terminalsLine.end(), ' ');
-    auto name = std::string(start, end);
+    auto name = std::string_view(start, end);
 
     auto terminal =
         std::find(grammar.terminals.begin(), grammar.terminals.end(), name);
-    if (terminal == grammar.terminals.end()) {
-      std::cerr << ANSI_COLOR_RED
-                << "Unknown terminal in input: " << ANSI_COLOR_RESET << name
-                << std::endl;
-      std::exit(EXIT_FAILURE);
-    } else {
+    if (terminal != grammar.terminals.end()) {
       inputTerminals.push_back(terminal - grammar.terminals.begin());
+    } else if (std::find(
+                   grammar.removedTerminals.begin(),
+                   grammar.removedTerminals.end(),
+                   name) != grammar.removedTerminals.end()) {
+      inputTerminals.push_back(grammar.removedTerminal);
+    } else {
+      return {
+          Error::Code::UnknownTerminal,
+          "Unknown terminal in input: " + std::string(name)};
     }
 
     start = end + 1;
   }
 
   inputTerminals.push_back(0); // $
-  return inputTerminals;
-}
-
-LRParser::LRParser(LRTable &table, Grammar &grammar) {
-  this->table = &table;
-  this->grammar = &grammar;
+  return {};
 }
 
 struct LRParserState {
   std::vector<unsigned int> stateStack;
   std::vector<Symbol> symbolStack;
-  std::vector<unsigned int>::const_iterator inputPosition;
+  // number of live entries in stateStack, symbolStack holds one less
+  size_t depth;
+  std::span<const unsigned int>::iterator inputPosition;
 
-  void Display(const Grammar &grammar, const std::vector<unsigned int> &input) {
-    int col = 0;
-    for (auto n : this->stateStack) {
-      std::cout << n << " ";
+  void Display(const Grammar &grammar, std::span<const unsigned int> input) {
+    auto &out = Out();
+    unsigned int col = 0;
+    // width of the current line, used to pad when colors are disabled
+    size_t width = 0;
+    auto nextColumn = [&]() {
+      col += parsing_col_size;
+      if (color_mode) {
+        out << "\x1b[" << col << 'G';
+      } else {
+        do {
+          out << ' ';
+        } while (++width < col);
+      }
+      width = col;
+    };
+
+    for (size_t i = 0; i < this->depth; ++i) {
+      auto n = this->stateStack[i];
+      out << n << ' ';
+      do {
+        ++width;
+      } while (n /= 10);
+      ++width;
     }
-    col += parsing_col_size;
-    std::cout << "\x1b[" << col << "G";
+    nextColumn();
 
-    for (auto n : this->symbolStack) {
-      n.Display(grammar);
-      std::cout << " ";
+    for (size_t i = 1; i < this->depth; ++i) {
+      const auto &symbol = this->symbolStack[i];
+      symbol.Display(grammar);
+      out << ' ';
+      width += 1 + UTF8Length(symbol.type == Symbol::Type::Terminal
+                                  ? grammar.terminals[symbol.id]
+                                  : grammar.nonTerminals[symbol.id]);
     }
-    col += parsing_col_size;
-    std::cout << "\x1b[" << col << "G";
+    nextColumn();
 
-    // std::cout << "Input: ";
     for (auto it = this->inputPosition; it != input.end(); ++it) {
-      std::cout << grammar.terminals[*it] << " ";
+      out << grammar.terminals[*it] << ' ';
+      width += 1 + UTF8Length(grammar.terminals[*it]);
+    }
+    nextColumn();
+  }
+};
+
+// Where chunks of the input can start speculatively, found once per table
+struct SpeculationTable {
+  // boundaries are only placed after terminals with at most this many
+  // different shift targets, each of them is tried as start state
+  static constexpr unsigned int MaxCandidates = 4;
+  // a reduction below the known states is only followed if its non-terminal
+  // has at most this many goTo targets
+  static constexpr unsigned int MaxGotoTargets = 16;
+  // tokens the speculation of a chunk may shift over all of its paths, per
+  // token of the chunk
+  static constexpr size_t Budget = 4;
+
+  explicit SpeculationTable(const LRTable &table);
+
+  // distinct shift targets per terminal, empty if there are too many
+  std::vector<std::vector<unsigned int>> shiftTargets;
+  // distinct goTo targets per non-terminal, empty if there are too many
+  std::vector<std::vector<unsigned int>> gotoTargets;
+};
+
+// sort and deduplicate every list, lists longer than limit are cleared
+static void DistinctTargets(
+    std::vector<std::vector<unsigned int>> &lists, size_t limit) {
+  for (auto &targets : lists) {
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    if (targets.size() > limit)
+      targets.clear();
+  }
+}
+
+SpeculationTable::SpeculationTable(const LRTable &table) {
+  const size_t terminals = table.actions.empty() ? 0 : table.actions[0].size();
+  const size_t nonTerminals = table.goTo.empty() ? 0 : table.goTo[0].size();
+
+  this->shiftTargets.resize(terminals);
+  for (const auto &row : table.actions) {
+    for (unsigned int t = 0; t < terminals; ++t) {
+      if (row[t].type == LRAction::Type::Shift)
+        this->shiftTargets[t].push_back(row[t].num);
+    }
+  }
+  DistinctTargets(this->shiftTargets, MaxCandidates);
+
+  // 0 is never a goTo target and marks a missing entry
+  this->gotoTargets.resize(nonTerminals);
+  for (const auto &row : table.goTo) {
+    for (unsigned int nt = 0; nt < nonTerminals; ++nt) {
+      if (row[nt] != 0)
+        this->gotoTargets[nt].push_back(row[nt]);
+    }
+  }
+  DistinctTargets(this->gotoTargets, MaxGotoTargets);
+}
+
+// Node of the persistent stacks of ParseState, immutable once linked so that
+// any number of stacks can continue from it
+struct StackNode {
+  StackNode *parent;
+  unsigned int state;
+  unsigned int refs;
+};
+
+// Recycles the nodes of a parser's stacks, counts are not atomic as all
+// states of a parser stay on one thread
+struct StackPool {
+  static constexpr size_t BlockNodes = 4096;
+
+  // a node with one reference, taking over the caller's reference to parent
+  StackNode *Allocate(unsigned int state, StackNode *parent) {
+    if (!this->free) {
+      this->blocks.push_back(std::make_unique<StackNode[]>(BlockNodes));
+      auto *block = this->blocks.back().get();
+      for (size_t i = 0; i < BlockNodes; ++i) {
+        block[i].parent = this->free;
+        this->free = &block[i];
+      }
+    }
+    auto *node = this->free;
+    this->free = node->parent;
+    *node = {.parent = parent, .state = state, .refs = 1};
+    ++this->live;
+    return node;
+  }
+
+  static void AddRef(StackNode *node) {
+    if (node)
+      ++node->refs;
+  }
+
+  // nodes no longer referenced go back to the free list with their parents
+  void Release(StackNode *node) {
+    while (node && --node->refs == 0) {
+      auto *parent = node->parent;
+      node->parent = this->free;
+      this->free = node;
+      --this->live;
+      node = parent;
     }
-    col += parsing_col_size;
-    std::cout << "\x1b[" << col << "G";
   }
+
+  std::vector<std::unique_ptr<StackNode[]>> blocks;
+  StackNode *free = nullptr;
+  size_t live = 0;
+  // states pushed by the terminal being fed
+  std::vector<unsigned int> pushed;
 };
 
-void LRParser::Parse(const std::vector<unsigned int> &input) {
+LRParser::LRParser(LRTable &table, Grammar &grammar, size_t maxDepthHint)
+    : state(std::make_unique<LRParserState>()),
+      stackPool(std::make_unique<StackPool>()) {
   PROFILE_FUNC;
-  LRParserState state;
-  state.stateStack.push_back(0);
-  state.inputPosition = input.begin();
+  this->table = &table;
+  this->grammar = &grammar;
 
-  if (!benchmark_mode) {
-    std::cout << std::setw(parsing_col_size) << "Stack"
-              << std::setw(parsing_col_size) << "Current symbols"
-              << std::setw(parsing_col_size) << "Remaining input"
-              << std::setw(parsing_col_size) << "Next Action" << std::endl;
+  for (const auto &rule : grammar.rules) {
+    this->ruleLength.push_back(rule.second.size());
+    this->ruleLHS.push_back(rule.first);
   }
 
+  this->Reserve(maxDepthHint);
+}
+
+LRParser::LRParser(LazyTable &table, Grammar &grammar, size_t maxDepthHint)
+    : LRParser(table.table, grammar, maxDepthHint) {
+  this->lazy = &table;
+}
+
+// stands in for the rows of a mapped table, which are not in memory
+static LRTable noRows;
+
+LRParser::LRParser(MappedTable &table, Grammar &grammar, size_t maxDepthHint)
+    : LRParser(noRows, grammar, maxDepthHint) {
+  this->mapped = &table;
+}
+
+LRParser::~LRParser() = default;
+
+void LRParser::Reserve(size_t maxDepth) {
+  // one extra slot so a reduce by an empty rule never needs a bounds check
+  if (this->state->stateStack.size() < maxDepth + 1) {
+    this->state->stateStack.resize(maxDepth + 1);
+  }
+}
+
+size_t LRParser::StackBytes() const {
+  return this->stackPool->live * sizeof(StackNode);
+}
+
+ParseState::ParseState(LRParser &parser)
+    : parser(&parser), top(parser.stackPool->Allocate(0, nullptr)), depth(1) {}
+
+ParseState::ParseState(const ParseState &other)
+    : reductions(other.reductions), parser(other.parser), top(other.top),
+      depth(other.depth), accepted(other.accepted) {
+  StackPool::AddRef(this->top);
+}
+
+ParseState::ParseState(ParseState &&other) noexcept
+    : reductions(other.reductions), parser(other.parser), top(other.top),
+      depth(other.depth), accepted(other.accepted) {
+  other.top = nullptr;
+}
+
+ParseState &ParseState::operator=(ParseState other) noexcept {
+  std::swap(this->reductions, other.reductions);
+  std::swap(this->parser, other.parser);
+  std::swap(this->top, other.top);
+  std::swap(this->depth, other.depth);
+  std::swap(this->accepted, other.accepted);
+  return *this;
+}
+
+ParseState::~ParseState() {
+  if (this->top)
+    this->parser->stackPool->Release(this->top);
+}
+
+LRAction ParseState::Run(
+    unsigned int terminal, const StackNode *&below, size_t &belowDepth,
+    std::vector<unsigned int> &pushed, size_t &reductions) const {
+  const auto &parser = *this->parser;
+  const auto &actions = parser.table->actions;
+  const auto &goTo = parser.table->goTo;
+  pushed.clear();
   while (true) {
-    if (!benchmark_mode) {
-      state.Display(*this->grammar, input);
+    const auto lrstate = pushed.empty() ? below->state : pushed.back();
+    if (parser.lazy && actions[lrstate].empty()) [[unlikely]]
+      parser.lazy->Expand(lrstate);
+    const auto action = actions[lrstate][terminal];
+    if (action.type != LRAction::Type::Reduce)
+      return action;
+
+    ++reductions;
+    for (auto n = parser.ruleLength[action.num]; n > 0; --n) {
+      if (!pushed.empty()) {
+        pushed.pop_back();
+      } else {
+        below = below->parent;
+        --belowDepth;
+      }
     }
-    auto lrstate = *(state.stateStack.end() - 1);
-    auto action = this->table->actions[lrstate][*state.inputPosition];
+    const auto from = pushed.empty() ? below->state : pushed.back();
+    pushed.push_back(goTo[from][parser.ruleLHS[action.num]]);
+  }
+}
+
+bool ParseState::Feed(unsigned int terminal) {
+  if (!this->parser || this->accepted ||
+      terminal >= this->parser->grammar->terminals.size())
+    return false;
+
+  auto &pool = *this->parser->stackPool;
+  auto &pushed = pool.pushed;
+  const StackNode *below = this->top;
+  size_t belowDepth = this->depth;
+  size_t reductions = 0;
+  const auto action =
+      this->Run(terminal, below, belowDepth, pushed, reductions);
+  if (action.type == LRAction::Type::Error)
+    return false;
+  if (action.type == LRAction::Type::Shift) {
+    pushed.push_back(action.num);
+  } else {
+    this->accepted = true;
+  }
+
+  // the nodes kept are shared with the old stack, which may be shared itself
+  auto *node = const_cast<StackNode *>(below);
+  StackPool::AddRef(node);
+  for (auto lrstate : pushed)
+    node = pool.Allocate(lrstate, node);
+  pool.Release(this->top);
+  this->top = node;
+  this->depth = belowDepth + pushed.size();
+  this->reductions += reductions;
+  return true;
+}
+
+void ParseState::Acceptable(std::vector<unsigned int> &terminals) const {
+  terminals.clear();
+  if (!this->parser || this->accepted)
+    return;
+
+  const auto &actions = this->parser->table->actions;
+  if (this->parser->lazy && actions[this->top->state].empty())
+    this->parser->lazy->Expand(this->top->state);
+  // a reduction may be followed by an error in a table with merged states,
+  // so reductions are followed to the shift
+  auto &pushed = this->parser->stackPool->pushed;
+  const unsigned int terminalCount = this->parser->grammar->terminals.size();
+  for (unsigned int t = 0; t < terminalCount; ++t) {
+    // a lazy table may append rows while reductions are followed
+    const auto type = actions[this->top->state][t].type;
+    if (type == LRAction::Type::Error)
+      continue;
+    const StackNode *below = this->top;
+    size_t belowDepth = this->depth;
+    size_t reductions = 0;
+    if (type != LRAction::Type::Reduce ||
+        this->Run(t, below, belowDepth, pushed, reductions).type !=
+            LRAction::Type::Error)
+      terminals.push_back(t);
+  }
+}
+
+unsigned int ParseState::Top() const {
+  return this->top ? this->top->state : 0;
+}
+
+void ParseState::Stack(std::vector<unsigned int> &states) const {
+  states.clear();
+  for (auto *node = this->top; node; node = node->parent)
+    states.push_back(node->state);
+  std::reverse(states.begin(), states.end());
+}
+
+void LRParser::ReportError(unsigned int lrstate, unsigned int terminal) const {
+  auto &out = Out();
+  out.Color(ANSI_COLOR_RED) << "Error: Found terminal ";
+  out.Color(ANSI_COLOR_MAGENTA) << this->grammar->terminals[terminal];
+  out.Color(ANSI_COLOR_RED) << " expected one of ";
+  for (unsigned int t = 0; t < this->grammar->terminals.size(); ++t) {
+    const auto type = this->mapped ? this->mapped->Action(lrstate, t).type
+                                   : this->table->actions[lrstate][t].type;
+    if (type != LRAction::Type::Error) {
+      out.Color(ANSI_COLOR_MAGENTA) << this->grammar->terminals[t];
+      out.Color(ANSI_COLOR_RED) << ' ';
+    }
+  }
+  out.Color(ANSI_COLOR_RESET) << '\n';
+  out.Flush();
+}
+
+template <typename Policy>
+bool LRParser::ParseWith(std::span<const unsigned int> input) {
+  PROFILE_FUNC;
+  const auto &actions = this->table->actions;
+  const auto &goTo = this->table->goTo;
+  const unsigned int *ruleLength = this->ruleLength.data();
+  const unsigned int *ruleLHS = this->ruleLHS.data();
+  auto actionOf = [&](unsigned int lrstate, unsigned int terminal) {
+    if constexpr (Policy::mapped)
+      return this->mapped->Action(lrstate, terminal);
+    else
+      return actions[lrstate][terminal];
+  };
+  auto goToOf = [&](unsigned int lrstate, unsigned int nonTerminal) {
+    if constexpr (Policy::mapped)
+      return this->mapped->GoTo(lrstate, nonTerminal);
+    else
+      return goTo[lrstate][nonTerminal];
+  };
+
+  // the state stack is addressed by a raw pointer, symbols are only kept for
+  // display and share the same index
+  unsigned int *base = this->state->stateStack.data();
+  unsigned int *limit = base + this->state->stateStack.size() - 1;
+  unsigned int *top = base;
+  unsigned int *peak = base;
+  *top = 0;
+  auto inputPosition = input.begin();
+  size_t reductions = 0;
+
+  auto grow = [&]() {
+    auto depth = top - base;
+    [[maybe_unused]] auto peakDepth = peak - base;
+    this->Reserve(this->state->stateStack.size() * 2);
+    if constexpr (Policy::trace) {
+      this->state->symbolStack.resize(this->state->stateStack.size());
+    }
+    base = this->state->stateStack.data();
+    limit = base + this->state->stateStack.size() - 1;
+    top = base + depth;
+    if constexpr (Policy::depth)
+      peak = base + peakDepth;
+  };
+
+  if constexpr (Policy::trace) {
+    this->state->symbolStack.resize(this->state->stateStack.size());
+  }
+
+  if constexpr (Policy::trace) {
+    auto &out = Out();
+    out.Left("Stack", parsing_col_size);
+    out.Left("Current symbols", parsing_col_size);
+    out.Left("Remaining input", parsing_col_size);
+    out.Left("Next Action", parsing_col_size) << '\n';
+  }
+
+  while (true) {
+    if constexpr (Policy::trace) {
+      this->state->depth = top - base + 1;
+      this->state->inputPosition = inputPosition;
+      this->state->Display(*this->grammar, input);
+    }
+    auto lrstate = *top;
+    // every state on the stack was on top before, so its goTo row exists
+    if constexpr (Policy::lazy) {
+      if (actions[lrstate].empty()) [[unlikely]]
+        this->lazy->Expand(lrstate);
+    }
+    const auto action = actionOf(lrstate, *inputPosition);
+    if constexpr (Policy::profile)
+      this->profile->CountAction(lrstate, *inputPosition);
     switch (action.type) {
     case LRAction::Type::Shift: {
-      if (!benchmark_mode) {
-        std::cout << ANSI_COLOR_YELLOW << "Shifting to " << action.num
-                  << ANSI_COLOR_RESET << std::endl;
+      if constexpr (Policy::trace) {
+        Out().Color(ANSI_COLOR_YELLOW) << "Shifting to " << action.num;
+        Out().Color(ANSI_COLOR_RESET) << '\n';
       }
 
+      if (top == limit)
+        grow();
+
       // go to new state
-      state.stateStack.push_back(action.num);
+      *++top = action.num;
+      if constexpr (Policy::depth)
+        peak = std::max(peak, top);
 
       // push new terminal
-      state.symbolStack.push_back(Symbol{
-          .type = Symbol::Type::Terminal,
-          .id = *state.inputPosition,
-      });
+      if constexpr (Policy::trace) {
+        this->state->symbolStack[top - base] = Symbol{
+            .type = Symbol::Type::Terminal,
+            .id = *inputPosition,
+        };
+      }
 
       // go to next input terminal
-      ++state.inputPosition;
+      ++inputPosition;
     } break;
 
     case LRAction::Type::Reduce: {
-      if (!benchmark_mode) {
-        std::cout << ANSI_COLOR_CYAN << "Reducing by " << action.num
-                  << ANSI_COLOR_RESET << std::endl;
+      if constexpr (Policy::trace) {
+        Out().Color(ANSI_COLOR_CYAN) << "Reducing by " << action.num;
+        Out().Color(ANSI_COLOR_RESET) << '\n';
       }
 
-      auto rule = this->grammar->rules[action.num];
+      // remove all RHS symbols at once
+      ++reductions;
+      top -= ruleLength[action.num];
+      const auto lhs = ruleLHS[action.num];
 
-      // remove each RHS symbol
-      for (int i = rule.second.size(); i != 0; --i) {
-        state.symbolStack.pop_back();
-        state.stateStack.pop_back();
-      }
+      // go to new state according to non-terminal
+      if (top == limit)
+        grow();
+      top[1] = goToOf(*top, lhs);
+      if constexpr (Policy::profile)
+        this->profile->CountGoTo(*top, lhs);
+      ++top;
+      if constexpr (Policy::depth)
+        peak = std::max(peak, top);
 
       // put non-terminal from LHS
-      state.symbolStack.push_back(Symbol{
-          .type = Symbol::Type::NonTerminal,
-          .id = rule.first,
-      });
-
-      // get the new current state
-      lrstate = *(state.stateStack.end() - 1);
-
-      // go to new state according to non-terminal
-      state.stateStack.push_back(table->goTo[lrstate][rule.first]);
+      if constexpr (Policy::trace) {
+        this->state->symbolStack[top - base] = Symbol{
+            .type = Symbol::Type::NonTerminal,
+            .id = lhs,
+        };
+      }
     } break;
 
     case LRAction::Type::Accept: {
-      if (!benchmark_mode) {
-        std::cout << ANSI_COLOR_GREEN << "Input accepted!" << ANSI_COLOR_RESET
-                  << std::endl;
+      if constexpr (Policy::trace) {
+        Out().Color(ANSI_COLOR_GREEN) << "Input accepted!";
+        Out().Color(ANSI_COLOR_RESET) << '\n';
+        Out().Flush();
       }
-      return;
+      this->reductions = reductions;
+      this->maxDepth = Policy::depth ? peak - base + 1 : 0;
+      return true;
     }
 
     case LRAction::Type::Error: {
-      std::cout << ANSI_COLOR_RED << "Error: Found terminal "
-                << ANSI_COLOR_MAGENTA
-                << grammar->terminals[*state.inputPosition] << ANSI_COLOR_RED
-                << " expected one of ";
-      for (unsigned int t = 0; t < this->table->actions[lrstate].size(); ++t) {
-        if (this->table->actions[lrstate][t].type != LRAction::Type::Error) {
-          std::cout << ANSI_COLOR_MAGENTA << grammar->terminals[t]
-                    << ANSI_COLOR_RED << ' ';
-        }
+      this->reductions = reductions;
+      this->maxDepth = Policy::depth ? peak - base + 1 : 0;
+      this->errorPosition = inputPosition - input.begin();
+      this->errorState = lrstate;
+      if constexpr (Policy::report)
+        this->ReportError(lrstate, *inputPosition);
+      return false;
+    }
+    }
+  }
+}
+
+template bool
+LRParser::ParseWith<QuietParse>(std::span<const unsigned int> input);
+template bool
+LRParser::ParseWith<TracedParse>(std::span<const unsigned int> input);
+template bool
+LRParser::ParseWith<SilentParse>(std::span<const unsigned int> input);
+template bool LRParser::ParseWith<LazyParse<QuietParse>>(
+    std::span<const unsigned int> input);
+template bool LRParser::ParseWith<LazyParse<TracedParse>>(
+    std::span<const unsigned int> input);
+template bool LRParser::ParseWith<LazyParse<SilentParse>>(
+    std::span<const unsigned int> input);
+template bool LRParser::ParseWith<ProfiledParse<SilentParse>>(
+    std::span<const unsigned int> input);
+template bool LRParser::ParseWith<MappedParse<QuietParse>>(
+    std::span<const unsigned int> input);
+template bool LRParser::ParseWith<MappedParse<TracedParse>>(
+    std::span<const unsigned int> input);
+template bool LRParser::ParseWith<MappedParse<SilentParse>>(
+    std::span<const unsigned int> input);
+
+template <typename Policy>
+bool LRParser::Parse(std::span<const unsigned int> input) {
+  if (this->mapped)
+    return this->ParseWith<MappedParse<Policy>>(input);
+  if (this->lazy)
+    return this->ParseWith<LazyParse<Policy>>(input);
+  return this->ParseWith<Policy>(input);
+}
+
+template bool LRParser::Parse<QuietParse>(std::span<const unsigned int> input);
+template bool
+LRParser::Parse<TracedParse>(std::span<const unsigned int> input);
+template bool
+LRParser::Parse<SilentParse>(std::span<const unsigned int> input);
+template bool LRParser::Parse<DepthParse<QuietParse>>(
+    std::span<const unsigned int> input);
+template bool LRParser::Parse<DepthParse<SilentParse>>(
+    std::span<const unsigned int> input);
+
+namespace {
+
+// Speculative parse of one chunk. A segment starts with a state on top of
+// the stack at some input position and ends where the real stack has to
+// decide: at a reduction popping its start state, or when it stops. A
+// reduction popping the start state continues in the segments of the goTo
+// targets that accept the lookahead. Segments are shared by every path that
+// reaches the same state at the same position, so speculations differing
+// only in the states they popped are parsed once.
+struct ChunkGraph {
+  static constexpr uint32_t NoSegment = ~0u;
+
+  struct Segment {
+    unsigned int start;
+    size_t begin;
+    size_t position = 0; // where the segment ended
+    size_t reductions = 0;
+    size_t height = 1; // most states on the stack from start upwards
+    // ended by a reduction to lhs removing popped states below start
+    bool underflow = false;
+    unsigned int lhs = 0;
+    size_t popped = 0;
+    // continuations per goTo target, or the stack left when stopped
+    uint32_t first = 0;
+    uint32_t count = 0;
+  };
+
+  std::vector<Segment> segments;
+  // (goTo target, segment) of underflowing segments
+  std::vector<std::pair<unsigned int, uint32_t>> edges;
+  std::vector<unsigned int> stacks;
+  std::vector<uint32_t> roots; // one per candidate start state
+};
+
+// Parse input[begin, end) from every candidate start state. At most budget
+// tokens are shifted over all segments, continuations left unexplored are
+// parsed sequentially by the stitcher.
+void Speculate(
+    const LRTable &table, const SpeculationTable &speculation,
+    const unsigned int *ruleLength, const unsigned int *ruleLHS,
+    std::span<const unsigned int> input,
+    const std::vector<unsigned int> &starts, size_t begin, size_t end,
+    size_t budget, ChunkGraph &graph) {
+  std::unordered_map<uint64_t, uint32_t> known;
+  // segments run in order of their begin so that paths meet early
+  std::priority_queue<
+      std::pair<size_t, uint32_t>, std::vector<std::pair<size_t, uint32_t>>,
+      std::greater<>>
+      pending;
+  const uint64_t stateCount = table.actions.size();
+
+  auto segment = [&](size_t position, unsigned int state) {
+    auto [found, added] = known.try_emplace(
+        position * stateCount + state, graph.segments.size());
+    if (added) {
+      graph.segments.push_back({.start = state, .begin = position});
+      pending.push({position, found->second});
+    }
+    return found->second;
+  };
+  for (auto start : starts)
+    graph.roots.push_back(segment(begin, start));
+
+  std::vector<unsigned int> stack;
+  std::vector<unsigned int> targets;
+  while (!pending.empty() && budget > 0) {
+    const auto id = pending.top().second;
+    pending.pop();
+    auto current = graph.segments[id];
+    auto position = current.begin;
+    stack.assign(1, current.start);
+
+    while (position < end && budget > 0) {
+      const auto action = table.actions[stack.back()][input[position]];
+      if (action.type == LRAction::Type::Shift) {
+        stack.push_back(action.num);
+        current.height = std::max(current.height, stack.size());
+        ++position;
+        --budget;
+        continue;
+      }
+      if (action.type != LRAction::Type::Reduce)
+        break;
+      const auto length = ruleLength[action.num];
+      const auto lhs = ruleLHS[action.num];
+      if (length < stack.size()) {
+        stack.resize(stack.size() - length);
+        stack.push_back(table.goTo[stack.back()][lhs]);
+        current.height = std::max(current.height, stack.size());
+        ++current.reductions;
+        continue;
       }
-      std::cout << ANSI_COLOR_RESET << std::endl;
-      return;
+
+      targets.clear();
+      for (auto target : speculation.gotoTargets[lhs]) {
+        if (table.actions[target][input[position]].type !=
+            LRAction::Type::Error)
+          targets.push_back(target);
+      }
+      if (targets.empty())
+        break;
+      ++current.reductions;
+      current.underflow = true;
+      current.lhs = lhs;
+      current.popped = length - stack.size();
+      current.first = graph.edges.size();
+      current.count = targets.size();
+      for (auto target : targets) {
+        graph.edges.push_back(
+            {target, budget > 0 ? segment(position, target)
+                                : ChunkGraph::NoSegment});
+      }
+      break;
     }
+
+    current.position = position;
+    if (!current.underflow) {
+      current.first = graph.stacks.size();
+      current.count = stack.size();
+      graph.stacks.insert(graph.stacks.end(), stack.begin(), stack.end());
     }
+    graph.segments[id] = current;
+  }
+
+  // segments the budget did not reach stop where they begin
+  while (!pending.empty()) {
+    auto &left = graph.segments[pending.top().second];
+    pending.pop();
+    left.position = left.begin;
+    left.first = graph.stacks.size();
+    left.count = 1;
+    graph.stacks.push_back(left.start);
   }
 }
 
+} // namespace
+
+template <typename Policy>
+bool LRParser::ParseParallel(
+    std::span<const unsigned int> input, unsigned int threads) {
+  PROFILE_FUNC;
+  this->chunks = 1;
+  this->speculatedChunks = 0;
+  this->speculatedTokens = 0;
+  // too little work per thread to be worth it
+  constexpr size_t MinChunk = 4096;
+  if (this->mapped || this->lazy || threads < 2 ||
+      input.size() < 2 * MinChunk)
+    return this->Parse<DepthParse<Policy>>(input);
+
+  if (!this->speculation)
+    this->speculation = std::make_unique<SpeculationTable>(*this->table);
+  const auto &speculation = *this->speculation;
+  const auto &actions = this->table->actions;
+  const auto &goTo = this->table->goTo;
+  const unsigned int *ruleLength = this->ruleLength.data();
+  const unsigned int *ruleLHS = this->ruleLHS.data();
+
+  // every chunk but the first starts right after a terminal with few shift
+  // targets, searched from the even split onwards
+  const size_t n = input.size();
+  std::vector<size_t> begins{0};
+  for (unsigned int k = 1; k < threads; ++k) {
+    const size_t split = n * k / threads;
+    const size_t limit =
+        std::min(n - 1, split + std::min<size_t>(n / threads / 2, 4096));
+    size_t best = 0, bestCount = SpeculationTable::MaxCandidates + 1;
+    for (size_t p = std::max(split, begins.back()); p < limit; ++p) {
+      const auto count = speculation.shiftTargets[input[p]].size();
+      if (count != 0 && count < bestCount) {
+        best = p;
+        bestCount = count;
+        if (count == 1)
+          break;
+      }
+    }
+    if (best != 0)
+      begins.push_back(best + 1);
+  }
+  this->chunks = begins.size();
+
+  // speculate on all chunks but the first while it is parsed for real
+  std::vector<ChunkGraph> graphs(begins.size());
+  std::vector<std::thread> workers;
+  for (size_t k = 1; k < begins.size(); ++k) {
+    const auto end = k + 1 < begins.size() ? begins[k + 1] : n;
+    workers.emplace_back([&, k, end]() {
+      Speculate(
+          *this->table, speculation, ruleLength, ruleLHS, input,
+          speculation.shiftTargets[input[begins[k] - 1]], begins[k], end,
+          SpeculationTable::Budget * (end - begins[k]), graphs[k]);
+    });
+  }
+
+  auto &stack = this->state->stateStack;
+  size_t depth = 1;
+  size_t peak = 1;
+  size_t reductions = 0;
+  size_t position = 0;
+  stack[0] = 0;
+  enum class Outcome { Continue, Accepted, Rejected };
+
+  // the sequential parser, stops after the shift reaching the end
+  auto run = [&](size_t end) {
+    while (position < end) {
+      const auto lrstate = stack[depth - 1];
+      const auto action = actions[lrstate][input[position]];
+      switch (action.type) {
+      case LRAction::Type::Shift:
+        if (depth == stack.size() - 1)
+          this->Reserve(stack.size() * 2);
+        stack[depth++] = action.num;
+        peak = std::max(peak, depth);
+        ++position;
+        break;
+      case LRAction::Type::Reduce:
+        ++reductions;
+        depth -= ruleLength[action.num];
+        if (depth == stack.size() - 1)
+          this->Reserve(stack.size() * 2);
+        stack[depth] = goTo[stack[depth - 1]][ruleLHS[action.num]];
+        peak = std::max(peak, ++depth);
+        break;
+      case LRAction::Type::Accept:
+        return Outcome::Accepted;
+      case LRAction::Type::Error:
+        this->errorPosition = position;
+        this->errorState = lrstate;
+        if constexpr (Policy::report)
+          this->ReportError(lrstate, input[position]);
+        return Outcome::Rejected;
+      }
+    }
+    return Outcome::Continue;
+  };
+
+  // follow the segments of a chunk graph that match the real stack, the
+  // goTo of every underflow is looked up on the real stack
+  auto stitch = [&](const ChunkGraph &graph) {
+    const auto start = position;
+    auto id = ChunkGraph::NoSegment;
+    for (auto root : graph.roots) {
+      if (graph.segments[root].start == stack[depth - 1])
+        id = root;
+    }
+    while (id != ChunkGraph::NoSegment) {
+      const auto &segment = graph.segments[id];
+      if (segment.underflow && depth < segment.popped + 2)
+        break;
+      reductions += segment.reductions;
+      this->Reserve(depth + segment.height);
+      peak = std::max(peak, depth - 1 + segment.height);
+      position = segment.position;
+      if (!segment.underflow) {
+        std::copy_n(
+            &graph.stacks[segment.first], segment.count, &stack[depth - 1]);
+        depth += segment.count - 1;
+        break;
+      }
+
+      depth -= 1 + segment.popped;
+      const auto target = goTo[stack[depth - 1]][segment.lhs];
+      stack[depth++] = target;
+      id = ChunkGraph::NoSegment;
+      for (auto i = segment.first; i < segment.first + segment.count; ++i) {
+        if (graph.edges[i].first == target)
+          id = graph.edges[i].second;
+      }
+    }
+    if (position != start) {
+      ++this->speculatedChunks;
+      this->speculatedTokens += position - start;
+    }
+  };
+
+  auto outcome = Outcome::Continue;
+  for (size_t k = 0; k < begins.size() && outcome == Outcome::Continue; ++k) {
+    if (k > 0) {
+      workers[k - 1].join();
+      stitch(graphs[k]);
+    }
+    outcome = run(k + 1 < begins.size() ? begins[k + 1] : n);
+  }
+  for (auto &worker : workers) {
+    if (worker.joinable())
+      worker.join();
+  }
+
+  this->reductions = reductions;
+  this->maxDepth = peak;
+  return outcome == Outcome::Accepted;
+}
+
+template bool LRParser::ParseParallel<QuietParse>(
+    std::span<const unsigned int> input, unsigned int threads);
+template bool LRParser::ParseParallel<SilentParse>(
+    std::span<const unsigned int> input, unsigned int threads);
+
 } // namespace lrone
@@ -5,19 +5,176 @@
 #include "table.hpp"
 
 #include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
 
 namespace lrone {
 
-std::vector<unsigned int>
-StringToTerminals(const std::string &terminalsLine, const Grammar &grammar);
+// ids of the terminals separated by spaces followed by $
+Error StringToTerminals(
+    std::string_view terminalsLine, const Grammar &grammar,
+    std::vector<unsigned int> &inputTerminals);
+
+// Policies for LRParser::ParseWith, tracing is resolved at compile time so the
+// quiet loop contains no output code at all
+struct QuietParse {
+  static constexpr bool trace = false;
+  static constexpr bool report = true; // print syntax errors
+  static constexpr bool depth = false; // track LRParser::maxDepth
+  static constexpr bool lazy = false;
+  static constexpr bool profile = false;
+  static constexpr bool mapped = false;
+};
+struct TracedParse {
+  static constexpr bool trace = true;
+  static constexpr bool report = true;
+  static constexpr bool depth = true;
+  static constexpr bool lazy = false;
+  static constexpr bool profile = false;
+  static constexpr bool mapped = false;
+};
+struct SilentParse {
+  static constexpr bool trace = false;
+  static constexpr bool report = false;
+  static constexpr bool depth = false;
+  static constexpr bool lazy = false;
+  static constexpr bool profile = false;
+  static constexpr bool mapped = false;
+};
+// records the deepest state stack in LRParser::maxDepth
+template <typename Policy> struct DepthParse : Policy {
+  static constexpr bool depth = true;
+};
+// builds the rows of a LazyTable when a state is reached for the first time
+template <typename Policy> struct LazyParse : Policy {
+  static constexpr bool lazy = true;
+};
+// counts the table cells it uses into LRParser::profile
+template <typename Policy> struct ProfiledParse : Policy {
+  static constexpr bool profile = true;
+};
+// reads the rows of LRParser::mapped in place
+template <typename Policy> struct MappedParse : Policy {
+  static constexpr bool mapped = true;
+};
+
+struct LRParserState;
+struct SpeculationTable;
+struct StackNode;
+struct StackPool;
 
 class LRParser {
 public:
-  LRParser(LRTable &table, Grammar &grammar);
-  void Parse(const std::vector<unsigned int> &input);
+  LRParser(LRTable &table, Grammar &grammar, size_t maxDepthHint = 1024);
+  // rows of the lazy table are built when a state is first reached
+  LRParser(LazyTable &table, Grammar &grammar, size_t maxDepthHint = 1024);
+  // Parse and ParseWith<MappedParse<...>> read the mapped rows, ParseParallel
+  // parses sequentially and ParseState cannot be used
+  LRParser(MappedTable &table, Grammar &grammar, size_t maxDepthHint = 1024);
+  ~LRParser();
+
+  // ParseWith<Policy> on the table of this parser, wrapped in LazyParse or
+  // MappedParse for those tables. Returns true when the input is accepted.
+  template <typename Policy> bool Parse(std::span<const unsigned int> input);
+  template <typename Policy>
+  bool ParseWith(std::span<const unsigned int> input);
+
+  // Parse with the input split into chunks that are parsed speculatively on
+  // their own threads and stitched together in order, the result is the same
+  // as of Parse<Policy>. Chunks whose speculation does not fit the real stack
+  // are parsed sequentially. Only the report flag of the policy is used.
+  template <typename Policy>
+  bool ParseParallel(
+      std::span<const unsigned int> input, unsigned int threads);
+
+  // preallocate stacks for the given parse depth, stacks grow beyond it
+  void Reserve(size_t maxDepth);
+
+  // bytes of the stack nodes held by the ParseStates of this parser
+  size_t StackBytes() const;
 
   LRTable *table;
+  LazyTable *lazy = nullptr;
+  MappedTable *mapped = nullptr;
   Grammar *grammar;
+  // counts of ParseWith<ProfiledParse<...>>, sized for the table
+  TableProfile *profile = nullptr;
+  // number of reductions performed by the last parse
+  size_t reductions = 0;
+  // deepest state stack reached by the last parse, 0 if its policy does not
+  // track the depth
+  size_t maxDepth = 0;
+  // input position and state of the last syntax error
+  size_t errorPosition = 0;
+  unsigned int errorState = 0;
+  // chunks of the last ParseParallel, the ones whose speculation was used
+  // and the tokens parsed by it
+  unsigned int chunks = 0;
+  unsigned int speculatedChunks = 0;
+  size_t speculatedTokens = 0;
+
+private:
+  // per rule RHS length and LHS non-terminal
+  std::vector<unsigned int> ruleLength;
+  std::vector<unsigned int> ruleLHS;
+  // stacks are kept between calls to avoid reallocation
+  std::unique_ptr<LRParserState> state;
+  // built by the first ParseParallel
+  std::unique_ptr<SpeculationTable> speculation;
+  // nodes of the persistent stacks of ParseState
+  std::unique_ptr<StackPool> stackPool;
+
+  void ReportError(unsigned int lrstate, unsigned int terminal) const;
+
+  friend class ParseState;
+};
+
+// Point of an incremental parse for trying several continuations, e.g. for
+// completion or to disambiguate by looking ahead. The state stack is a
+// persistent list whose nodes are shared between copies, so a copy is an O(1)
+// snapshot or fork and feeding it leaves the original as it was. All copies
+// use the node pool of their parser, they must stay on one thread and not
+// outlive the parser.
+class ParseState {
+public:
+  // no parser, Feed fails
+  ParseState() = default;
+  // before the first terminal of an input
+  explicit ParseState(LRParser &parser);
+  ParseState(const ParseState &other);
+  ParseState(ParseState &&other) noexcept;
+  ParseState &operator=(ParseState other) noexcept;
+  ~ParseState();
+
+  // do the reductions the terminal calls for and shift it, $ (0) is accepted
+  // instead. Returns false and changes nothing if the terminal does not fit.
+  bool Feed(unsigned int terminal);
+  // the terminals Feed would take now in ascending order
+  void Acceptable(std::vector<unsigned int> &terminals) const;
+
+  bool Accepted() const { return this->accepted; }
+  // LR state on top of the stack
+  unsigned int Top() const;
+  size_t Depth() const { return this->depth; }
+  // LR states from the bottom of the stack to the top
+  void Stack(std::vector<unsigned int> &states) const;
+
+  // reductions done by all Feed calls of this state and the one it was
+  // copied from
+  size_t reductions = 0;
+
+private:
+  // the action that follows the reductions on terminal, the states pushed
+  // above the shared node below are collected in pushed
+  LRAction Run(
+      unsigned int terminal, const StackNode *&below, size_t &belowDepth,
+      std::vector<unsigned int> &pushed, size_t &reductions) const;
+
+  LRParser *parser = nullptr;
+  StackNode *top = nullptr;
+  size_t depth = 0;
+  bool accepted = false;
 };
 
 } // namespace lrone
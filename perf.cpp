@@ -0,0 +1,141 @@
+#include "lrone.hpp"
+
+#include "output.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace lrone {
+
+const char *const PerfCounters::names[Count] = {
+    "cycles", "instructions", "L1D misses", "LLC misses", "branch misses"};
+
+namespace {
+
+// one group per thread so that all counters are read with a single read()
+struct CounterGroup {
+  int leader = -1;
+  // counter of each value in the order the kernel returns them
+  PerfCounters::Counter order[PerfCounters::Count];
+  unsigned int members = 0;
+};
+
+thread_local CounterGroup group;
+bool available[PerfCounters::Count];
+
+perf_event_attr Attributes(PerfCounters::Counter counter) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  switch (counter) {
+  case PerfCounters::Cycles:
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    break;
+  case PerfCounters::Instructions:
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case PerfCounters::L1DMisses:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    break;
+  case PerfCounters::LLCMisses:
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    break;
+  case PerfCounters::BranchMisses:
+    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    break;
+  case PerfCounters::Count:
+    break;
+  }
+  // user space only, which is also all an unprivileged process may count
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return attr;
+}
+
+} // namespace
+
+bool PerfCounters::Open() {
+  if (group.leader >= 0)
+    return true;
+
+  int error = 0;
+  for (int c = 0; c < Count; ++c) {
+    auto attr = Attributes(Counter(c));
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, group.leader, 0);
+    if (fd < 0) {
+      // missing on this CPU, or more counters than it can count at once
+      if (error == 0)
+        error = errno;
+      continue;
+    }
+    if (group.leader < 0)
+      group.leader = fd;
+    group.order[group.members++] = Counter(c);
+    available[c] = true;
+  }
+
+  auto &err = Err();
+  if (group.leader < 0) {
+    err.Color(ANSI_COLOR_YELLOW)
+        << "Warning: Hardware counters are not available: "
+        << std::strerror(error);
+    if (error == EACCES || error == EPERM) {
+      err << " (lower /proc/sys/kernel/perf_event_paranoid or grant "
+             "CAP_PERFMON)";
+    } else if (error == ENOENT || error == EOPNOTSUPP || error == ENODEV) {
+      err << " (not exposed by this CPU or virtual machine)";
+    }
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    return false;
+  }
+  if (group.members < Count) {
+    err.Color(ANSI_COLOR_YELLOW) << "Warning: Not counting";
+    const char *separator = " ";
+    for (int c = 0; c < Count; ++c) {
+      if (!available[c]) {
+        err << separator << names[c];
+        separator = ", ";
+      }
+    }
+    err << " (" << std::strerror(error) << ")";
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+  }
+  enabled = true;
+  return true;
+}
+
+void PerfCounters::Read(PerfCounters &counters) {
+  if (group.leader < 0)
+    return;
+  // number of values, time enabled, time running, values
+  uint64_t data[3 + Count];
+  if (read(group.leader, data, sizeof(data)) < 0)
+    return;
+  const uint64_t timeEnabled = data[1];
+  const uint64_t timeRunning = data[2];
+  for (unsigned int i = 0; i < data[0] && i < group.members; ++i) {
+    uint64_t value = data[3 + i];
+    if (timeRunning < timeEnabled) {
+      // shared with other users of the PMU, extrapolate
+      value = timeRunning ? static_cast<uint64_t>(
+                                double(value) * timeEnabled / timeRunning)
+                          : 0;
+    }
+    counters.values[group.order[i]] = value;
+  }
+}
+
+bool PerfCounters::Available(Counter counter) { return available[counter]; }
+
+} // namespace lrone
@@ -0,0 +1,319 @@
+#include "reports.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace lrone {
+
+void ReportBatch(
+    Benchmark &bench, const PhaseStats &batching, BatchParser &batch,
+    BatchKernel kernel, const std::vector<BatchResult> &results,
+    const std::vector<uint32_t> &sentences,
+    const std::vector<uint32_t> &starts, LRTable &table, Grammar &g) {
+  Benchmark::Display(batching);
+  std::cout << " (" << starts.size() / batching.median << " M sentences/s, "
+            << BatchKernelName(kernel) << ", " << BatchParser::Lanes
+            << " lanes, packed table " << batch.TableBytes() << " bytes)"
+            << std::endl;
+
+  // one LRParser call per sentence
+  LRParser parser(table, g);
+  std::vector<BatchResult> reference(starts.size());
+  const auto &loop = bench.Measure("Per-sentence parsing", [&] {
+    for (size_t i = 0; i < starts.size(); ++i) {
+      const size_t end =
+          i + 1 < starts.size() ? starts[i + 1] : sentences.size();
+      const bool accepted = parser.ParseWith<SilentParse>(
+          std::span(sentences.data() + starts[i], end - starts[i]));
+      reference[i] = {
+          accepted, accepted ? 0 : uint32_t(parser.errorPosition),
+          uint32_t(parser.reductions)};
+    }
+  });
+  Benchmark::Display(loop);
+  std::cout << " (" << starts.size() / loop.median << " M sentences/s)"
+            << std::endl;
+
+  std::vector<BatchResult> scalarResults;
+  double scalarTime = batching.median;
+  if (kernel != BatchKernel::Scalar) {
+    const auto &scalar = bench.Measure("Scalar batch parsing", [&] {
+      batch.Parse(sentences, starts, scalarResults, BatchKernel::Scalar);
+    });
+    scalarTime = scalar.median;
+    Benchmark::Display(scalar);
+    std::cout << " (" << starts.size() / scalar.median << " M sentences/s)"
+              << std::endl;
+  } else {
+    scalarResults = results;
+  }
+  const bool identical = results == reference && scalarResults == reference;
+  std::cout << "Batch speedup: " << loop.median / batching.median << " ("
+            << BatchKernelName(kernel) << "), " << loop.median / scalarTime
+            << " (scalar), " << starts.size() << " sentences of "
+            << double(sentences.size()) / starts.size()
+            << " tokens on average, "
+            << (identical ? "identical" : "MISMATCH") << std::endl;
+}
+
+void ReportLazy(Benchmark &bench, LazyTable &lazy, const Grammar &g) {
+  auto memory = lazy.table.MemoryUsage();
+  std::cout << "Lazy table: " << lazy.StatesVisited() << " of "
+            << lazy.StatesFound() << " states found were visited, "
+            << lazy.table.conflicts.size() << " conflicts, memory "
+            << memory.Total() + lazy.ItemSetBytes() << " bytes (rows "
+            << memory.Total() << ", item sets " << lazy.ItemSetBytes()
+            << "), peak heap " << heap_counters.peak << " bytes" << std::endl;
+
+  // the whole table for comparison, it counts into the peak heap printed
+  // afterwards
+  LRTable full;
+  const auto &stats = bench.Measure(
+      "Full table building", [&] { full = LRTable(); },
+      [&] { full = GenerateTable(g); });
+  std::cout << "Full table: " << full.actions.size()
+            << " states, building time " << stats.median << " us, memory "
+            << full.MemoryUsage().Total() << " bytes" << std::endl;
+}
+
+void ReportMinimal(
+    Benchmark &bench, const MinimalStats &minimal, const Grammar &g) {
+  std::cout << "Minimal table: " << minimal.cores
+            << " distinct cores (LALR(1) states), " << minimal.merged
+            << " kernels merged, " << minimal.rebuilt << " rows rebuilt"
+            << std::endl;
+
+  LRTable canonical;
+  const auto &stats = bench.Measure(
+      "Canonical table building", [&] { canonical = LRTable(); },
+      [&] { canonical = GenerateTable(g); });
+  auto unresolved = std::count_if(
+      canonical.conflicts.begin(), canonical.conflicts.end(),
+      [](const auto &c) {
+        return c.resolution == LRConflict::Resolution::Unresolved;
+      });
+  std::cout << "Canonical table: " << canonical.actions.size() << " states, "
+            << unresolved << " unresolved conflicts, building time "
+            << stats.median << " us, memory "
+            << canonical.MemoryUsage().Total() << " bytes" << std::endl;
+}
+
+void ReportLayout(
+    const PhaseStats &stats, const TableProfile &profile,
+    const TableLayout &layout, unsigned int sentences) {
+  uint64_t total = 0;
+  for (unsigned int s = 0; s < layout.states.size(); ++s)
+    total += profile.StateVisits(s);
+  uint64_t covered = 0;
+  unsigned int rows = 0;
+  while (rows < layout.states.size() && covered * 100 < total * 99)
+    covered += profile.StateVisits(layout.states[rows++]);
+  Benchmark::Display(stats);
+  std::cout << " (" << sentences << " sentences, " << total
+            << " lookups, 99% of them in the first " << rows << " of "
+            << layout.states.size() << " states)" << std::endl;
+}
+
+void ReportLayoutParsing(
+    Benchmark &bench, LRParser &parser,
+    const std::vector<unsigned int> &terminals, bool accepted,
+    LRTable &original, Grammar &originalGrammar, const TableLayout &layout) {
+  std::vector<unsigned int> originalTerminals(terminals.size());
+  for (size_t i = 0; i < terminals.size(); ++i)
+    originalTerminals[i] = layout.terminals[terminals[i]];
+  LRParser originalParser(original, originalGrammar, terminals.size());
+  const auto runs = bench.warmup + bench.iterations;
+  auto compare = [&](const char *name, LRParser &p,
+                     const std::vector<unsigned int> &in, bool &result) {
+    PerfCounters before, after;
+    PerfCounters::Read(before);
+    const auto &stats =
+        bench.Measure(name, [&] { result = p.Parse<SilentParse>(in); });
+    PerfCounters::Read(after);
+    p.Parse<DepthParse<SilentParse>>(in);
+    Benchmark::Display(stats);
+    std::cout << " (" << in.size() / stats.median << " M tokens/s";
+    for (auto counter : {PerfCounters::L1DMisses, PerfCounters::LLCMisses}) {
+      if (!PerfCounters::Available(counter))
+        continue;
+      std::cout << ", "
+                << double(after.values[counter] - before.values[counter]) /
+                       runs / in.size()
+                << ' ' << PerfCounters::names[counter] << " per token";
+    }
+    std::cout << ")" << std::endl;
+    return stats.median;
+  };
+  bool originalAccepted = false;
+  bool profiledAccepted = false;
+  const auto originalTime =
+      compare("Parsing (original layout)", originalParser, originalTerminals,
+              originalAccepted);
+  const auto profiledTime = compare(
+      "Parsing (profiled layout)", parser, terminals, profiledAccepted);
+  const bool identical =
+      originalAccepted == accepted && profiledAccepted == accepted &&
+      originalParser.reductions == parser.reductions &&
+      originalParser.maxDepth == parser.maxDepth &&
+      (accepted ||
+       (originalParser.errorPosition == parser.errorPosition &&
+        originalParser.errorState == layout.states[parser.errorState]));
+  std::cout << "Profiled layout: speedup " << originalTime / profiledTime
+            << ", " << (identical ? "identical" : "MISMATCH") << std::endl;
+}
+
+void ReportSpilled(
+    Benchmark &bench, const PhaseStats &building, const SpillStats &spill,
+    size_t memoryCap, bool rssReset, size_t rssBefore, size_t rssPeak,
+    const Grammar &g) {
+  std::cout << "Spilled table: " << spill.itemSetBytes
+            << " item set bytes written, " << spill.itemSetReads
+            << " read back, construction memory " << spill.memory << " of "
+            << memoryCap << " bytes" << std::endl;
+  if (rssReset) {
+    std::cout << "Construction RSS: peak " << rssPeak - rssBefore
+              << " bytes above the " << rssBefore << " bytes before ("
+              << (rssPeak - rssBefore < memoryCap ? "under" : "OVER")
+              << " the cap)" << std::endl;
+  } else {
+    std::cout << "Construction RSS: the peak could not be reset" << std::endl;
+  }
+
+  // the table in memory for comparison, it counts into the peak RSS printed
+  // afterwards
+  LRTable full;
+  const auto &stats = bench.Measure(
+      "In-memory table building", [&] { full = LRTable(); },
+      [&] { full = GenerateTable(g); });
+  std::cout << "In-memory table: " << full.actions.size()
+            << " states, building time " << stats.median
+            << " us, spilled build " << building.median / stats.median
+            << " times as long, memory " << full.MemoryUsage().Total()
+            << " bytes" << std::endl;
+}
+
+void ReportScanning(
+    Benchmark &bench, const PhaseStats &scanning, const char *data,
+    size_t size, const std::vector<TokenSpan> &tokens, ScanKernel kernel) {
+  Benchmark::Display(scanning);
+  std::cout << " (" << size / (scanning.median * 1000) << " GB/s, "
+            << ScanKernelName(kernel) << ")" << std::endl;
+
+  std::vector<TokenSpan> reference;
+  const auto &scalar = bench.Measure(
+      "Scalar scanning", [&] { reference = {}; },
+      [&] { ScanTokens(data, size, reference, ScanKernel::Scalar); });
+  Benchmark::Display(scalar);
+  std::cout << " (" << size / (scalar.median * 1000) << " GB/s, "
+            << (reference == tokens ? "identical" : "MISMATCH") << ")"
+            << std::endl;
+}
+
+void ReportForking(
+    Benchmark &bench, LRParser &parser,
+    const std::vector<unsigned int> &terminals) {
+  ParseState state(parser);
+  ParseState deepest = state;
+  size_t position = 0;
+  for (size_t i = 0; i + 1 < terminals.size() && state.Feed(terminals[i]);
+       ++i) {
+    if (state.Depth() > deepest.Depth()) {
+      deepest = state;
+      position = i + 1;
+    }
+  }
+  const size_t forks = 10000;
+  const unsigned int next = terminals[position];
+  std::vector<ParseState> kept;
+  kept.reserve(forks);
+  const auto &forking = bench.Measure(
+      "Forking", [&] { kept.clear(); },
+      [&] {
+        for (size_t f = 0; f < forks; ++f)
+          kept.push_back(deepest);
+      });
+  const auto before = parser.StackBytes();
+  const auto &feeding = bench.Measure(
+      "Forking and feeding", [&] { kept.clear(); },
+      [&] {
+        for (size_t f = 0; f < forks; ++f) {
+          kept.push_back(deepest);
+          kept.back().Feed(next);
+        }
+      });
+  const auto nodeBytes = parser.StackBytes() - before;
+
+  std::vector<unsigned int> stack;
+  deepest.Stack(stack);
+  std::vector<std::vector<unsigned int>> copies;
+  copies.reserve(forks);
+  const auto &copying = bench.Measure(
+      "Deep copying", [&] { copies.clear(); },
+      [&] {
+        for (size_t f = 0; f < forks; ++f) {
+          copies.push_back(stack);
+          copies.back().push_back(0);
+        }
+      });
+  size_t copyBytes = 0;
+  for (const auto &copy : copies)
+    copyBytes += copy.capacity() * sizeof(unsigned int);
+
+  std::vector<unsigned int> acceptable;
+  deepest.Acceptable(acceptable);
+  std::cout << "Fork point: depth " << deepest.Depth() << " before token "
+            << position << ", " << acceptable.size()
+            << " acceptable terminals" << std::endl;
+  Benchmark::Display(forking);
+  std::cout << " (" << forking.median * 1000 / forks << " ns per fork)"
+            << std::endl;
+  Benchmark::Display(feeding);
+  std::cout << " (" << feeding.median * 1000 / forks << " ns, "
+            << double(nodeBytes) / forks << " stack bytes and "
+            << kept.back().reductions - deepest.reductions
+            << " reductions per fork)" << std::endl;
+  Benchmark::Display(copying);
+  std::cout << " (" << copying.median * 1000 / forks << " ns, "
+            << double(copyBytes) / forks << " stack bytes per copy)"
+            << std::endl;
+}
+
+void ReportThreads(
+    Benchmark &bench, LRParser &parser,
+    const std::vector<unsigned int> &terminals, unsigned int threads,
+    bool accepted) {
+  std::vector<unsigned int> threadCounts;
+  for (unsigned int count = 1; count < threads; count *= 2)
+    threadCounts.push_back(count);
+  threadCounts.push_back(threads);
+  const auto reductions = parser.reductions;
+  const auto maxDepth = parser.maxDepth;
+  const auto errorPosition = parser.errorPosition;
+  double sequential = 0;
+  for (auto count : threadCounts) {
+    bool identical = true;
+    auto name = "Parallel parsing (" + std::to_string(count) + " threads)";
+    const auto &stats = bench.Measure(name.c_str(), [&] {
+      auto result = parser.ParseParallel<SilentParse>(terminals, count);
+      identical = identical && result == accepted &&
+                  parser.reductions == reductions &&
+                  parser.maxDepth == maxDepth &&
+                  (accepted || parser.errorPosition == errorPosition);
+    });
+    if (count == 1)
+      sequential = stats.median;
+    Benchmark::Display(stats);
+    std::cout << " (speedup " << sequential / stats.median << ", "
+              << parser.chunks << " chunks, " << parser.speculatedChunks
+              << " speculated covering "
+              << 100.0 * parser.speculatedTokens / terminals.size()
+              << "% of the tokens, "
+              << (identical ? "identical" : "MISMATCH") << ")" << std::endl;
+  }
+  std::cout << "Hardware threads: " << std::thread::hardware_concurrency()
+            << std::endl;
+}
+
+} // namespace lrone
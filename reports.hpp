@@ -0,0 +1,75 @@
+#pragma once
+
+#include "batch.hpp"
+#include "benchmark.hpp"
+#include "parser.hpp"
+#include "scanner.hpp"
+#include "table.hpp"
+
+#include <vector>
+
+namespace lrone {
+
+// Measurements of benchmark mode that go beyond timing the phases, each
+// repeated with bench and printed after the phase it belongs to.
+
+// Throughput of the batch parse of the sentences, against parsing them one by
+// one with an LRParser and, if the kernel was not the scalar one, with the
+// scalar kernel. All results are compared with those of the batch.
+void ReportBatch(
+    Benchmark &bench, const PhaseStats &batching, BatchParser &batch,
+    BatchKernel kernel, const std::vector<BatchResult> &results,
+    const std::vector<uint32_t> &sentences,
+    const std::vector<uint32_t> &starts, LRTable &table, Grammar &g);
+
+// States of the lazy table built so far and its memory, against building the
+// whole table
+void ReportLazy(Benchmark &bench, LazyTable &lazy, const Grammar &g);
+
+// States merged into the minimal table, against building the canonical one
+void ReportMinimal(
+    Benchmark &bench, const MinimalStats &minimal, const Grammar &g);
+
+// Time of laying out the table and the number of rows from the start that
+// hold 99% of the lookups of the profile
+void ReportLayout(
+    const PhaseStats &stats, const TableProfile &profile,
+    const TableLayout &layout, unsigned int sentences);
+
+// Parsing the input with the table of the layout against parsing it, mapped
+// back to the terminal ids of the original grammar, with the table as built.
+// The parser ran on the input before and accepted it or not.
+void ReportLayoutParsing(
+    Benchmark &bench, LRParser &parser,
+    const std::vector<unsigned int> &terminals, bool accepted,
+    LRTable &original, Grammar &originalGrammar, const TableLayout &layout);
+
+// Disk traffic and memory of a table built under memoryCap in the time of
+// building, and the growth of the peak RSS from rssBefore to rssPeak if it
+// could be reset, against building the table in memory
+void ReportSpilled(
+    Benchmark &bench, const PhaseStats &building, const SpillStats &spill,
+    size_t memoryCap, bool rssReset, size_t rssBefore, size_t rssPeak,
+    const Grammar &g);
+
+// Throughput of the scanning phase, followed by the scalar kernel on the same
+// data to check the tokens of the one detected
+void ReportScanning(
+    Benchmark &bench, const PhaseStats &scanning, const char *data,
+    size_t size, const std::vector<TokenSpan> &tokens, ScanKernel kernel);
+
+// Forks of an incremental parse of the input at its deepest point against
+// copies of a plain stack of the same depth. The parser needs the table in
+// memory.
+void ReportForking(
+    Benchmark &bench, LRParser &parser,
+    const std::vector<unsigned int> &terminals);
+
+// Parallel parsing of the input with 1, 2, 4 ... up to threads threads, every
+// result is compared with the sequential one, accepted
+void ReportThreads(
+    Benchmark &bench, LRParser &parser,
+    const std::vector<unsigned int> &terminals, unsigned int threads,
+    bool accepted);
+
+} // namespace lrone
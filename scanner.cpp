@@ -0,0 +1,332 @@
+#include "scanner.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LRONE_SCAN_X86
+#endif
+
+namespace lrone {
+
+MappedFile::MappedFile(const char *filename) {
+  this->fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (this->fd < 0)
+    return;
+
+  struct stat info;
+  if (fstat(this->fd, &info) < 0) {
+    close(this->fd);
+    this->fd = -1;
+    return;
+  }
+
+  this->size = info.st_size;
+  if (this->size == 0)
+    return;
+
+  void *mapping =
+      mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, this->fd, 0);
+  if (mapping == MAP_FAILED) {
+    close(this->fd);
+    this->fd = -1;
+    this->size = 0;
+    return;
+  }
+  madvise(mapping, this->size, MADV_SEQUENTIAL);
+  this->data = static_cast<const char *>(mapping);
+}
+
+MappedFile::~MappedFile() {
+  if (this->data)
+    munmap(const_cast<char *>(this->data), this->size);
+  if (this->fd >= 0)
+    close(this->fd);
+}
+
+const char *ScanKernelName(ScanKernel kernel) {
+  switch (kernel) {
+  case ScanKernel::Scalar:
+    return "scalar";
+  case ScanKernel::SSE2:
+    return "SSE2";
+  case ScanKernel::AVX2:
+    return "AVX2";
+  }
+  return "unknown";
+}
+
+ScanKernel DetectScanKernel() {
+#ifdef LRONE_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return ScanKernel::AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return ScanKernel::SSE2;
+#endif
+  return ScanKernel::Scalar;
+}
+
+static inline bool IsSeparator(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static void ScanScalar(
+    const char *data, size_t size, std::vector<TokenSpan> &tokens) {
+  size_t i = 0;
+  while (i < size) {
+    while (i < size && IsSeparator(data[i]))
+      ++i;
+    if (i == size)
+      break;
+    size_t start = i;
+    while (i < size && !IsSeparator(data[i]))
+      ++i;
+    tokens.push_back({start, static_cast<uint32_t>(i - start)});
+  }
+}
+
+namespace {
+
+// Token boundaries carried from one block to the next
+struct ScanState {
+  bool open = false; // previous byte belonged to a token
+  uint64_t start = 0;
+};
+
+// Turn a bitmask of non-separator bytes of one block into token spans. Token
+// starts and ends alternate, so they can be consumed in order.
+inline void EmitTokens(
+    uint64_t word, unsigned int width, uint64_t base, ScanState &state,
+    std::vector<TokenSpan> &tokens) {
+  const uint64_t widthMask =
+      width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+  const uint64_t shifted = (word << 1) | uint64_t(state.open);
+  uint64_t starts = word & ~shifted;
+  uint64_t ends = ~word & shifted & widthMask;
+
+  while (true) {
+    if (state.open) {
+      if (ends == 0)
+        break;
+      auto end = base + std::countr_zero(ends);
+      ends &= ends - 1;
+      tokens.push_back(
+          {state.start, static_cast<uint32_t>(end - state.start)});
+      state.open = false;
+    } else {
+      if (starts == 0)
+        break;
+      state.start = base + std::countr_zero(starts);
+      starts &= starts - 1;
+      state.open = true;
+    }
+  }
+}
+
+inline void ScanTail(
+    const char *data, size_t offset, size_t size, ScanState &state,
+    std::vector<TokenSpan> &tokens) {
+  while (offset < size) {
+    unsigned int width = std::min<size_t>(64, size - offset);
+    uint64_t word = 0;
+    for (unsigned int i = 0; i < width; ++i) {
+      if (!IsSeparator(data[offset + i]))
+        word |= uint64_t(1) << i;
+    }
+    EmitTokens(word, width, offset, state, tokens);
+    offset += width;
+  }
+  if (state.open) {
+    tokens.push_back(
+        {state.start, static_cast<uint32_t>(size - state.start)});
+  }
+}
+
+#ifdef LRONE_SCAN_X86
+void ScanSSE2(const char *data, size_t size, std::vector<TokenSpan> &tokens) {
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i carriage = _mm_set1_epi8('\r');
+
+  ScanState state;
+  size_t offset = 0;
+  for (; offset + 16 <= size; offset += 16) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offset));
+    __m128i separators = _mm_or_si128(
+        _mm_or_si128(
+            _mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, tab)),
+        _mm_or_si128(
+            _mm_cmpeq_epi8(block, newline), _mm_cmpeq_epi8(block, carriage)));
+    uint64_t word = ~uint32_t(_mm_movemask_epi8(separators)) & 0xFFFF;
+    EmitTokens(word, 16, offset, state, tokens);
+  }
+  ScanTail(data, offset, size, state, tokens);
+}
+
+__attribute__((target("avx2"))) void
+ScanAVX2(const char *data, size_t size, std::vector<TokenSpan> &tokens) {
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i carriage = _mm256_set1_epi8('\r');
+
+  ScanState state;
+  size_t offset = 0;
+  // two 32 byte blocks are combined to one 64 bit word per step
+  for (; offset + 64 <= size; offset += 64) {
+    uint64_t word = 0;
+    for (unsigned int half = 0; half < 2; ++half) {
+      __m256i block = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(data + offset + half * 32));
+      __m256i separators = _mm256_or_si256(
+          _mm256_or_si256(
+              _mm256_cmpeq_epi8(block, space), _mm256_cmpeq_epi8(block, tab)),
+          _mm256_or_si256(
+              _mm256_cmpeq_epi8(block, newline),
+              _mm256_cmpeq_epi8(block, carriage)));
+      word |= uint64_t(~uint32_t(_mm256_movemask_epi8(separators)))
+              << (half * 32);
+    }
+    EmitTokens(word, 64, offset, state, tokens);
+  }
+  ScanTail(data, offset, size, state, tokens);
+}
+#endif
+
+} // namespace
+
+void ScanTokens(
+    const char *data, size_t size, std::vector<TokenSpan> &tokens,
+    ScanKernel kernel) {
+  PROFILE_FUNC;
+  switch (kernel) {
+#ifdef LRONE_SCAN_X86
+  case ScanKernel::AVX2:
+    ScanAVX2(data, size, tokens);
+    return;
+  case ScanKernel::SSE2:
+    ScanSSE2(data, size, tokens);
+    return;
+#endif
+  default:
+    ScanScalar(data, size, tokens);
+    return;
+  }
+}
+
+Error CheckScanKernels() {
+  PROFILE_FUNC;
+  std::vector<ScanKernel> kernels;
+  switch (DetectScanKernel()) {
+  case ScanKernel::AVX2:
+    kernels.push_back(ScanKernel::AVX2);
+    [[fallthrough]];
+  case ScanKernel::SSE2:
+    kernels.push_back(ScanKernel::SSE2);
+    [[fallthrough]];
+  case ScanKernel::Scalar:
+    break;
+  }
+
+  std::vector<std::string> inputs;
+  // token and separator runs of every length around the block sizes
+  for (size_t token = 1; token <= 66; ++token) {
+    for (size_t gap : {1, 2, 15, 16, 17, 31, 32, 33, 63, 64, 65}) {
+      std::string text;
+      while (text.size() < 200) {
+        text.append(token, 'a');
+        text.append(gap, ' ');
+      }
+      inputs.push_back(text);
+      inputs.push_back(std::string(gap, '\t') + text + "x");
+    }
+  }
+  for (size_t size = 0; size <= 130; ++size) {
+    inputs.push_back(std::string(size, 'a'));
+    inputs.push_back(std::string(size, ' '));
+    std::string lines;
+    while (lines.size() < size)
+      lines += "id\r\n";
+    inputs.push_back(lines.substr(0, size));
+  }
+  // random mixes of all separators, fixed seed
+  uint64_t seed = 0x9e3779b97f4a7c15;
+  const char alphabet[] = {'a', 'b', ' ', '\t', '\r', '\n', ' ', 'a'};
+  for (unsigned int i = 0; i < 2000; ++i) {
+    std::string text;
+    const size_t size = i % 300;
+    while (text.size() < size) {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      text.append((seed >> 61) & 3 ? 1 : seed % 20, alphabet[seed % 8]);
+    }
+    inputs.push_back(text);
+  }
+
+  std::vector<TokenSpan> expected, tokens;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    // exactly sized copies at every alignment, reads past the end are
+    // found by sanitizers
+    for (size_t shift = 0; shift < 64; shift += i % 7 + 1) {
+      std::vector<char> buffer(shift + inputs[i].size());
+      std::copy(inputs[i].begin(), inputs[i].end(), buffer.begin() + shift);
+      expected.clear();
+      ScanScalar(buffer.data() + shift, inputs[i].size(), expected);
+      for (auto kernel : kernels) {
+        tokens.clear();
+        ScanTokens(buffer.data() + shift, inputs[i].size(), tokens, kernel);
+        if (tokens != expected) {
+          return {
+              Error::Code::KernelMismatch,
+              std::string("The ") + ScanKernelName(kernel) +
+                  " scanner differs from the scalar one on input " +
+                  std::to_string(i) + " of " +
+                  std::to_string(inputs[i].size()) + " bytes at offset " +
+                  std::to_string(shift)};
+        }
+      }
+    }
+  }
+  return {};
+}
+
+Error TokensToTerminals(
+    const char *data, const std::vector<TokenSpan> &tokens,
+    const Grammar &grammar, std::vector<unsigned int> &inputTerminals) {
+  PROFILE_FUNC;
+  std::unordered_map<std::string_view, unsigned int> terminalIds;
+  for (unsigned int t = 0; t < grammar.terminals.size(); ++t)
+    terminalIds.emplace(grammar.terminals[t], t);
+  for (const auto &name : grammar.removedTerminals)
+    terminalIds.emplace(name, grammar.removedTerminal);
+
+  inputTerminals.clear();
+  inputTerminals.reserve(tokens.size() + 1);
+  for (const auto &token : tokens) {
+    auto name = std::string_view(data + token.offset, token.length);
+    auto terminal = terminalIds.find(name);
+    if (terminal == terminalIds.end()) {
+      return {
+          Error::Code::UnknownTerminal,
+          "Unknown terminal in input: " + std::string(name)};
+    }
+    inputTerminals.push_back(terminal->second);
+  }
+
+  inputTerminals.push_back(0); // $
+  return {};
+}
+
+} // namespace lrone
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "lrone.hpp"
+
+#include "grammar.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace lrone {
+
+// Read-only memory mapping of a whole input file
+class MappedFile {
+public:
+  explicit MappedFile(const char *filename);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool IsOpen() const { return this->fd >= 0; }
+  const char *Data() const { return this->data; }
+  size_t Size() const { return this->size; }
+
+private:
+  int fd = -1;
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+// Position of one token inside the scanned buffer
+struct TokenSpan {
+  uint64_t offset;
+  uint32_t length;
+
+  bool operator==(const TokenSpan &rhs) const = default;
+};
+
+enum class ScanKernel { Scalar, SSE2, AVX2 };
+
+const char *ScanKernelName(ScanKernel kernel);
+// best kernel supported by the running CPU
+ScanKernel DetectScanKernel();
+
+// Split the buffer at spaces, tabs and line breaks. Every kernel produces
+// exactly the same spans as the scalar one.
+void ScanTokens(
+    const char *data, size_t size, std::vector<TokenSpan> &tokens,
+    ScanKernel kernel);
+
+// Compare every kernel the CPU supports with the scalar one on generated
+// inputs: tokens and separator runs crossing the 16, 32 and 64 byte blocks,
+// unaligned starts, tails shorter than a block, CRLF line breaks and buffers
+// of only tokens or only separators
+Error CheckScanKernels();
+
+// Look up the terminal of every token and append $
+Error TokensToTerminals(
+    const char *data, const std::vector<TokenSpan> &tokens,
+    const Grammar &grammar, std::vector<unsigned int> &inputTerminals);
+
+} // namespace lrone
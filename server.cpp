@@ -0,0 +1,431 @@
+#include "server.hpp"
+
+#include "context.hpp"
+#include "latency.hpp"
+#include "output.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace lrone {
+
+namespace {
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void RequestStop(int) { stopRequested = 1; }
+
+bool FillAddress(const char *socketPath, sockaddr_un &address) {
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (std::strlen(socketPath) >= sizeof(address.sun_path)) {
+    auto &err = Err();
+    err.Color(ANSI_COLOR_RED) << "Socket path too long: " << socketPath;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    return false;
+  }
+  std::strcpy(address.sun_path, socketPath);
+  return true;
+}
+
+void AppendFrame(
+    std::string &buffer, protocol::Status status, const std::string &message) {
+  uint32_t length = 1 + message.size();
+  buffer.append(reinterpret_cast<const char *>(&length), sizeof(length));
+  buffer.push_back(static_cast<char>(status));
+  buffer.append(message);
+}
+
+// A grammar kept resident by the server together with everything needed to
+// parse with it
+struct LoadedGrammar {
+  explicit LoadedGrammar(const ContextOptions &options) : context(options) {}
+
+  Context context;
+  std::vector<uint32_t> input;
+  ParseResult result;
+};
+
+struct Connection {
+  std::string in;
+  std::string out;
+  size_t written = 0;
+};
+
+class Server {
+public:
+  explicit Server(const ServerOptions &options) : options(options) {}
+
+  // handle one request payload and append the response frame to out
+  void Handle(const char *payload, uint32_t length, std::string &out);
+
+private:
+  LoadedGrammar *Load(const std::string &path, std::string &error);
+
+  ServerOptions options;
+  std::unordered_map<std::string, std::unique_ptr<LoadedGrammar>> grammars;
+};
+
+LoadedGrammar *Server::Load(const std::string &path, std::string &error) {
+  auto found = this->grammars.find(path);
+  if (found != this->grammars.end())
+    return found->second.get();
+
+  PROFILE_SCOPE("Load Grammar");
+  auto &out = Out();
+  out.Color(ANSI_COLOR_GREEN) << "Loading grammar from file: " << path;
+  out.Color(ANSI_COLOR_RESET) << '\n';
+  out.Flush();
+  auto loaded = std::make_unique<LoadedGrammar>(
+      ContextOptions{.unitElimination = this->options.unitElimination});
+  if (auto failure = loaded->context.LoadGrammarFile(path)) {
+    error = failure.message;
+    return nullptr;
+  }
+  for (const auto &warning : loaded->context.grammar.warnings) {
+    auto &err = Err();
+    err.Color(ANSI_COLOR_YELLOW) << "Warning: " << warning;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+  }
+
+  return this->grammars.emplace(path, std::move(loaded)).first->second.get();
+}
+
+void Server::Handle(const char *payload, uint32_t length, std::string &out) {
+  PROFILE_FUNC;
+  uint16_t pathLength;
+  if (length < 1 + sizeof(pathLength) ||
+      payload[0] != static_cast<char>(protocol::Command::Parse)) {
+    AppendFrame(out, protocol::Status::Failed, "Malformed request");
+    return;
+  }
+  std::memcpy(&pathLength, payload + 1, sizeof(pathLength));
+  const char *path = payload + 1 + sizeof(pathLength);
+  if (length < 1 + sizeof(pathLength) + pathLength) {
+    AppendFrame(out, protocol::Status::Failed, "Malformed request");
+    return;
+  }
+  const char *text = path + pathLength;
+  const char *textEnd = payload + length;
+
+  std::string error;
+  auto loaded = this->Load(std::string(path, pathLength), error);
+  if (!loaded) {
+    AppendFrame(out, protocol::Status::Failed, error);
+    return;
+  }
+
+  auto &context = loaded->context;
+  auto &input = loaded->input;
+  auto &result = loaded->result;
+  if (auto failure =
+          context.Terminals(std::string_view(text, textEnd), input)) {
+    AppendFrame(out, protocol::Status::Failed, failure.message);
+    return;
+  }
+  if (auto failure = context.Parse(input, result)) {
+    AppendFrame(out, protocol::Status::Failed, failure.message);
+    return;
+  }
+
+  if (result.accepted) {
+    AppendFrame(out, protocol::Status::Accepted, "");
+    return;
+  }
+  AppendFrame(
+      out, protocol::Status::Rejected, context.Describe(input, result));
+}
+
+// write as much pending output as the socket accepts, false on error
+bool Flush(int fd, Connection &connection) {
+  while (connection.written < connection.out.size()) {
+    auto n = write(
+        fd, connection.out.data() + connection.written,
+        connection.out.size() - connection.written);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    connection.written += n;
+  }
+  connection.out.clear();
+  connection.written = 0;
+  return true;
+}
+
+bool WriteAll(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    auto n = write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, char *data, size_t size) {
+  while (size > 0) {
+    auto n = read(fd, data, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+} // namespace
+
+int RunServer(const char *socketPath, const ServerOptions &options) {
+  sockaddr_un address;
+  if (!FillAddress(socketPath, address))
+    return EXIT_FAILURE;
+
+  int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  unlink(socketPath);
+  if (listenFd < 0 ||
+      bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) <
+          0 ||
+      listen(listenFd, SOMAXCONN) < 0) {
+    auto &err = Err();
+    err.Color(ANSI_COLOR_RED) << "Failed to listen on " << socketPath << ": "
+                              << std::strerror(errno);
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    return EXIT_FAILURE;
+  }
+
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = listenFd;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+  std::signal(SIGPIPE, SIG_IGN);
+  std::signal(SIGINT, RequestStop);
+  std::signal(SIGTERM, RequestStop);
+
+  auto &out = Out();
+  out.Color(ANSI_COLOR_GREEN) << "Listening on " << socketPath;
+  out.Color(ANSI_COLOR_RESET) << '\n';
+  out.Flush();
+
+  Server server(options);
+  std::unordered_map<int, Connection> connections;
+  std::vector<epoll_event> events(64);
+  char buffer[65536];
+
+  auto close_connection = [&](int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+  };
+
+  while (!stopRequested) {
+    int count = epoll_wait(epollFd, events.data(), events.size(), -1);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      int fd = events[i].data.fd;
+
+      if (fd == listenFd) {
+        int client;
+        while ((client = accept4(
+                    listenFd, nullptr, nullptr,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+          epoll_event clientEvent{};
+          clientEvent.events = EPOLLIN | EPOLLRDHUP;
+          clientEvent.data.fd = client;
+          epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &clientEvent);
+          connections[client];
+        }
+        continue;
+      }
+
+      auto &connection = connections[fd];
+      bool closed = (events[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+        while (true) {
+          auto n = read(fd, buffer, sizeof(buffer));
+          if (n > 0) {
+            connection.in.append(buffer, n);
+          } else if (n < 0 && errno == EINTR) {
+            continue;
+          } else {
+            closed |= n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
+          }
+        }
+
+        // answer every complete request in order
+        size_t offset = 0;
+        uint32_t length;
+        while (connection.in.size() - offset >= sizeof(length)) {
+          std::memcpy(&length, connection.in.data() + offset, sizeof(length));
+          if (length > protocol::MaxFrameSize) {
+            closed = true;
+            break;
+          }
+          if (connection.in.size() - offset - sizeof(length) < length)
+            break;
+          server.Handle(
+              connection.in.data() + offset + sizeof(length), length,
+              connection.out);
+          offset += sizeof(length) + length;
+        }
+        connection.in.erase(0, offset);
+      }
+
+      if (!Flush(fd, connection)) {
+        close_connection(fd);
+        continue;
+      }
+      // responses already queued are still delivered on a half-closed socket
+      if (closed && connection.out.empty()) {
+        close_connection(fd);
+        continue;
+      }
+
+      epoll_event update{};
+      update.events = EPOLLIN | EPOLLRDHUP;
+      if (!connection.out.empty())
+        update.events |= EPOLLOUT;
+      update.data.fd = fd;
+      epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &update);
+    }
+  }
+
+  for (auto &[fd, connection] : connections)
+    close(fd);
+  close(epollFd);
+  close(listenFd);
+  unlink(socketPath);
+  return 0;
+}
+
+int RunClient(
+    const char *socketPath, const char *grammarFile, const std::string &input,
+    unsigned int repeat) {
+  sockaddr_un address;
+  if (!FillAddress(socketPath, address))
+    return EXIT_FAILURE;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(
+                    fd, reinterpret_cast<sockaddr *>(&address),
+                    sizeof(address)) < 0) {
+    auto &err = Err();
+    err.Color(ANSI_COLOR_RED) << "Failed to connect to " << socketPath << ": "
+                              << std::strerror(errno);
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    return EXIT_FAILURE;
+  }
+
+  // the server may run in another directory
+  char path[PATH_MAX];
+  if (!realpath(grammarFile, path)) {
+    auto &err = Err();
+    err.Color(ANSI_COLOR_RED) << "Failed to open Grammar file: " << grammarFile;
+    err.Color(ANSI_COLOR_RESET) << '\n';
+    err.Flush();
+    return EXIT_FAILURE;
+  }
+
+  std::string request;
+  uint16_t pathLength = std::strlen(path);
+  uint32_t length = 1 + sizeof(pathLength) + pathLength + input.size();
+  request.append(reinterpret_cast<const char *>(&length), sizeof(length));
+  request.push_back(static_cast<char>(protocol::Command::Parse));
+  request.append(
+      reinterpret_cast<const char *>(&pathLength), sizeof(pathLength));
+  request.append(path, pathLength);
+  request.append(input);
+
+  if (!benchmark_mode)
+    repeat = 1;
+
+  std::vector<double> latencies;
+  std::string response;
+  for (unsigned int i = 0; i < repeat; ++i) {
+    auto timeStart = std::chrono::steady_clock::now();
+    if (!WriteAll(fd, request.data(), request.size()) ||
+        !ReadAll(fd, reinterpret_cast<char *>(&length), sizeof(length)) ||
+        length == 0 || length > protocol::MaxFrameSize) {
+      auto &err = Err();
+      err.Color(ANSI_COLOR_RED) << "Connection to server lost";
+      err.Color(ANSI_COLOR_RESET) << '\n';
+      err.Flush();
+      close(fd);
+      return EXIT_FAILURE;
+    }
+    response.resize(length);
+    if (!ReadAll(fd, response.data(), length)) {
+      auto &err = Err();
+      err.Color(ANSI_COLOR_RED) << "Connection to server lost";
+      err.Color(ANSI_COLOR_RESET) << '\n';
+      err.Flush();
+      close(fd);
+      return EXIT_FAILURE;
+    }
+    auto timeEnd = std::chrono::steady_clock::now();
+    latencies.push_back(
+        std::chrono::duration<double, std::micro>(timeEnd - timeStart)
+            .count());
+  }
+  close(fd);
+
+  auto status = static_cast<protocol::Status>(response[0]);
+  auto message = response.substr(1);
+  switch (status) {
+  case protocol::Status::Accepted:
+    Out().Color(ANSI_COLOR_GREEN) << "Input accepted!";
+    Out().Color(ANSI_COLOR_RESET) << '\n';
+    Out().Flush();
+    break;
+  case protocol::Status::Rejected:
+    Out().Color(ANSI_COLOR_RED) << "Error: " << message;
+    Out().Color(ANSI_COLOR_RESET) << '\n';
+    Out().Flush();
+    break;
+  case protocol::Status::Failed:
+    Err().Color(ANSI_COLOR_RED) << message;
+    Err().Color(ANSI_COLOR_RESET) << '\n';
+    Err().Flush();
+    break;
+  }
+
+  if (benchmark_mode) {
+    auto spawnLatencies = SpawnLatencies(path, input, nullptr, repeat);
+    ReportLatency("Server", latencies);
+    ReportLatency("Spawned CLI", spawnLatencies);
+  }
+
+  return status == protocol::Status::Accepted ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace lrone
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "lrone.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace lrone {
+
+// Wire format between the daemon and its clients over a Unix domain socket.
+// Every message is a frame of a uint32_t payload length in native byte order
+// followed by the payload.
+//
+// Request payload:  uint8_t command, uint16_t grammar path length,
+//                   grammar path, input terminals separated by whitespace
+// Response payload: uint8_t status, error details as text
+namespace protocol {
+enum class Command : uint8_t { Parse = 1 };
+enum class Status : uint8_t { Accepted = 0, Rejected = 1, Failed = 2 };
+
+// frames larger than this are rejected and the connection is closed
+constexpr uint32_t MaxFrameSize = 64 * 1024 * 1024;
+} // namespace protocol
+
+struct ServerOptions {
+  bool unitElimination = false;
+};
+
+// Serve parse requests until SIGINT or SIGTERM. Grammars are loaded on first
+// use and kept resident together with their parsing tables.
+int RunServer(const char *socketPath, const ServerOptions &options);
+
+// Send the input to a running server and print the result. In benchmark mode
+// the request is repeated and its latency is compared with spawning the
+// command line program for the same input.
+int RunClient(
+    const char *socketPath, const char *grammarFile, const std::string &input,
+    unsigned int repeat);
+
+} // namespace lrone
@@ -0,0 +1,61 @@
+# Builds the table of a generated grammar under a memory cap with -M/-T,
+# opens the table file again with -T alone and builds it in memory, the
+# three CSV exports have to be identical. Run with
+#   cmake -DLRONE=<program> -DWORK=<directory> -P spill_test.cmake
+#
+# The grammar is a list of statements, each of the kinds with its own item
+# list, sharing one expression grammar with several levels. Its table in
+# memory takes about 2.6 MB, above the 1 MB cap.
+
+set(kinds 100)
+set(levels 8)
+
+set(terminals "id ( ) ; = ,")
+set(nonTerminals "P L S")
+set(rules "P L\nL L S\nL S\n")
+math(EXPR lastKind "${kinds} - 1")
+foreach(i RANGE ${lastKind})
+  string(APPEND terminals " s${i}")
+  string(APPEND nonTerminals " B${i} I${i}")
+  string(APPEND rules "S s${i} B${i} ;\n")
+  string(APPEND rules "B${i} B${i} , I${i}\nB${i} I${i}\n")
+  string(APPEND rules "I${i} id\nI${i} id = E0\n")
+endforeach()
+math(EXPR lastLevel "${levels} - 1")
+foreach(i RANGE ${lastLevel})
+  math(EXPR next "${i} + 1")
+  string(APPEND terminals " o${i}")
+  string(APPEND nonTerminals " E${i}")
+  string(APPEND rules "E${i} E${i} o${i} E${next}\nE${i} E${next}\n")
+endforeach()
+string(APPEND nonTerminals " E${levels}")
+string(APPEND rules "E${levels} ( E0 )\nE${levels} id\n")
+
+file(MAKE_DIRECTORY ${WORK})
+file(WRITE ${WORK}/grammar.txt "${terminals}\n${nonTerminals}\n${rules}")
+file(REMOVE ${WORK}/table.bin)
+
+foreach(run "spilled;-M;1;-T;${WORK}/table.bin"
+            "mapped;-T;${WORK}/table.bin"
+            "memory")
+  list(GET run 0 name)
+  list(REMOVE_AT run 0)
+  execute_process(
+    COMMAND ${LRONE} -b -r 1,0 -g ${WORK}/grammar.txt ${run}
+            -o ${WORK}/${name}.csv
+    OUTPUT_QUIET
+    RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "The ${name} build failed: ${result}")
+  endif()
+endforeach()
+
+foreach(name spilled mapped)
+  execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files
+            ${WORK}/${name}.csv ${WORK}/memory.csv
+    RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "The ${name} table differs from the one in memory")
+  endif()
+endforeach()
@@ -1,47 +1,81 @@
 #include "table.hpp"
 
+#include "output.hpp"
+#include "scanner.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
 #include <fstream>
-#include <iomanip>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory_resource>
+#include <numeric>
+#include <optional>
+#include <unistd.h>
+#include <unordered_map>
 #include <utility>
 
 namespace lrone {
 
 bool LRItem::operator==(const LRItem &rhs) const {
   return (this->dotPosition == rhs.dotPosition) &&
-         (this->endTerminal == rhs.endTerminal) && (this->ruleID == rhs.ruleID);
+         (this->ruleID == rhs.ruleID) && (this->lookaheads == rhs.lookaheads);
+}
+
+bool LRItem::operator<(const LRItem &rhs) const {
+  if (this->ruleID != rhs.ruleID)
+    return this->ruleID < rhs.ruleID;
+  return this->dotPosition < rhs.dotPosition;
+}
+
+size_t LRItem::Hash() const {
+  size_t h = (size_t(this->ruleID) << 16) ^ this->dotPosition;
+  return (h * 0x9e3779b97f4a7c15) ^ this->lookaheads.Hash();
 }
 
 void LRItem::Display(const Grammar &grammar) const {
-  auto rule = grammar.rules[this->ruleID];
+  auto &out = Out();
+  const auto &rule = grammar.rules[this->ruleID];
 
-  std::cout << grammar.nonTerminals[rule.first] << " → ";
+  out << grammar.nonTerminals[rule.first] << " → ";
 
   unsigned int i = 0;
   for (auto &symbol : rule.second) {
     if (i++ == this->dotPosition) {
-      std::cout << "• ";
+      out << "• ";
     }
     switch (symbol.type) {
     case Symbol::Type::Terminal:
-      std::cout << ANSI_COLOR_MAGENTA << grammar.terminals[symbol.id] << ' '
-                << ANSI_COLOR_RESET;
+      out.Color(ANSI_COLOR_MAGENTA) << grammar.terminals[symbol.id] << ' ';
+      out.Color(ANSI_COLOR_RESET);
       break;
     case Symbol::Type::NonTerminal:
-      std::cout << ANSI_COLOR_CYAN << grammar.nonTerminals[symbol.id] << ' '
-                << ANSI_COLOR_RESET;
+      out.Color(ANSI_COLOR_CYAN) << grammar.nonTerminals[symbol.id] << ' ';
+      out.Color(ANSI_COLOR_RESET);
       break;
     }
   }
   if (i == this->dotPosition) {
-    std::cout << "• ";
+    out << "• ";
   }
 
-  std::cout << ", " << grammar.terminals[this->endTerminal] << std::endl;
+  out << ", ";
+  bool firstTerminal = true;
+  this->lookaheads.ForEach([&](unsigned int terminal) {
+    if (!firstTerminal)
+      out << '/';
+    out << grammar.terminals[terminal];
+    firstTerminal = false;
+  });
+  out << '\n';
 }
 
 Symbol LRItem::GetNextSymbol(const Grammar &grammar) const {
-  auto rhs = grammar.rules[this->ruleID].second;
+  const auto &rhs = grammar.rules[this->ruleID].second;
   if (rhs.size() <= this->dotPosition) {
     // return the end terminal to represent no more symbols available
     return {.type = Symbol::Type::Terminal, .id = 0};
@@ -54,128 +88,954 @@ bool LRAction::operator==(const LRAction &rhs) const {
   return this->type == rhs.type && this->num == rhs.num;
 }
 
-void Closure(std::vector<LRItem> &itemSet, const Grammar &grammar) {
+namespace {
+
+// Monotonic arena over blocks taken from the heap, nothing is freed before
+// Reset() or destruction. Reset() merges the blocks used so far into one, so
+// work repeated for every state stops allocating after the first few.
+class Arena final : public std::pmr::memory_resource {
+public:
+  explicit Arena(size_t blockSize = 1 << 14) : blockSize(blockSize) {}
+  ~Arena() override { this->Free(); }
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // bytes taken from the heap
+  size_t Allocated() const {
+    size_t total = 0;
+    for (auto block = this->blocks; block; block = block->next)
+      total += sizeof(Block) + block->size;
+    return total;
+  }
+
+  void Reset() {
+    if (this->blocks && this->blocks->next) {
+      size_t total = 0;
+      for (auto block = this->blocks; block; block = block->next)
+        total += block->size;
+      this->Free();
+      this->AddBlock(total);
+    }
+    if (this->blocks) {
+      this->cursor = this->blocks->Data();
+      this->end = this->cursor + this->blocks->size;
+    }
+  }
+
+private:
+  struct Block {
+    Block *next;
+    size_t size; // usable bytes following the header
+    std::byte *Data() { return reinterpret_cast<std::byte *>(this + 1); }
+  };
+
+  void AddBlock(size_t size) {
+    auto block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+    block->next = this->blocks;
+    block->size = size;
+    this->blocks = block;
+    this->cursor = block->Data();
+    this->end = this->cursor + size;
+  }
+
+  void Free() {
+    while (this->blocks) {
+      auto next = this->blocks->next;
+      ::operator delete(this->blocks);
+      this->blocks = next;
+    }
+    this->cursor = this->end = nullptr;
+  }
+
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    size_t padding =
+        -reinterpret_cast<uintptr_t>(this->cursor) & (alignment - 1);
+    if (bytes + padding > size_t(this->end - this->cursor)) {
+      this->AddBlock(std::max(this->blockSize, bytes + alignment));
+      this->blockSize *= 2;
+      padding = -reinterpret_cast<uintptr_t>(this->cursor) & (alignment - 1);
+    }
+    auto p = this->cursor + padding;
+    this->cursor = p + bytes;
+    return p;
+  }
+  void do_deallocate(void *, size_t, size_t) override {}
+  bool do_is_equal(const memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+  size_t blockSize;
+  Block *blocks = nullptr;
+  std::byte *cursor = nullptr;
+  std::byte *end = nullptr;
+};
+
+typedef std::pmr::vector<LRItem> ItemSet;
+
+// Sorted kernel of a state, pointing to the start of its item set as the
+// closure only appends to the kernel
+struct KernelKey {
+  const LRItem *items;
+  size_t size;
+
+  bool operator==(const KernelKey &rhs) const {
+    return std::equal(
+        this->items, this->items + this->size, rhs.items,
+        rhs.items + rhs.size);
+  }
+};
+
+struct KernelHash {
+  size_t operator()(const KernelKey &kernel) const {
+    size_t h = kernel.size;
+    for (size_t i = 0; i < kernel.size; ++i)
+      h = (h ^ kernel.items[i].Hash()) * 0x100000001b3;
+    return h;
+  }
+};
+
+// Lookaheads contributed by the symbols following every dot position,
+// computed once instead of calling First() for each closure item, the rules
+// grouped by their LHS and the closure template of every non-terminal
+struct ClosureTables {
+  ClosureTables(const Grammar &grammar, std::pmr::memory_resource *resource);
+
+  std::pmr::vector<size_t> ruleOffset;
+  // FIRST of the rest of the rule behind the dot at ruleOffset + dot
+  std::pmr::vector<TerminalSet> firstAfter;
+  // rest of the rule can be empty, the item passes its own lookaheads on
+  std::pmr::vector<bool> inherits;
+  std::pmr::vector<unsigned int> lhsOffset;
+  std::pmr::vector<unsigned int> rulesByLHS;
+
+  // The non-terminals whose rules a non-terminal after the dot adds to a
+  // closure, at templateOffset[nt] up to templateOffset[nt + 1]. The items
+  // get the spontaneous lookaheads, plus the lookaheads passed to nt if they
+  // inherit them.
+  struct TemplateItem {
+    unsigned int lhs;
+    bool inherits;
+  };
+  std::pmr::vector<unsigned int> templateOffset;
+  std::pmr::vector<TemplateItem> templates;
+  // spontaneous lookaheads of template item t at t * words, the words of a
+  // TerminalSet
+  std::pmr::vector<uint64_t> spontaneous;
+  size_t words;
+};
+
+ClosureTables::ClosureTables(
+    const Grammar &grammar, std::pmr::memory_resource *resource)
+    : ruleOffset(resource), firstAfter(resource), inherits(resource),
+      lhsOffset(grammar.nonTerminals.size() + 1, 0, resource),
+      rulesByLHS(grammar.rules.size(), 0, resource), templateOffset(resource),
+      templates(resource), spontaneous(resource),
+      words((grammar.terminals.size() + 63) / 64) {
   PROFILE_FUNC;
-  for (unsigned int item_it = 0; item_it < itemSet.size(); ++item_it) {
-    const auto item = itemSet[item_it];
+  for (const auto &rule : grammar.rules) {
+    this->ruleOffset.push_back(this->firstAfter.size());
+    for (auto dot = rule.second.begin(); dot != rule.second.end(); ++dot) {
+      auto first = grammar.First(dot + 1, rule.second.end());
+      TerminalSet lookaheads(grammar.terminals.size(), resource);
+      for (auto terminal : first)
+        lookaheads.Set(terminal);
+      this->firstAfter.push_back(std::move(lookaheads));
+      this->inherits.push_back(
+          first.empty() ||
+          std::find(first.begin(), first.end(), 0) != first.end());
+    }
+  }
 
-    const auto next = item.GetNextSymbol(grammar);
-    if (next.id == 0) { // we have reached the end
-      continue;
+  // counting sort keeps the rules of each LHS in grammar order
+  for (const auto &rule : grammar.rules)
+    ++this->lhsOffset[rule.first + 1];
+  for (size_t nt = 0; nt < grammar.nonTerminals.size(); ++nt)
+    this->lhsOffset[nt + 1] += this->lhsOffset[nt];
+  std::pmr::vector<unsigned int> next(
+      this->lhsOffset.begin(), this->lhsOffset.end() - 1, resource);
+  for (unsigned int i = 0; i < grammar.rules.size(); ++i)
+    this->rulesByLHS[next[grammar.rules[i].first]++] = i;
+
+  // All rules of a non-terminal get the same lookaheads in a closure, so the
+  // template of each non-terminal is found on the graph of non-terminals
+  // whose rules start with another one. In reverse postorder one pass passes
+  // the lookaheads on unless the graph has a cycle other than left recursion.
+  // Edges of left recursive rules come first as they only add to their own
+  // non-terminal.
+  const auto count = grammar.nonTerminals.size();
+  std::pmr::vector<unsigned int> edgeOffset(count + 1, 0, resource);
+  std::pmr::vector<unsigned int> edgeTo(resource);
+  std::pmr::vector<size_t> edgeAfter(resource);
+  for (unsigned int nt = 0; nt < count; ++nt) {
+    edgeOffset[nt] = edgeTo.size();
+    for (bool recursive : {true, false}) {
+      for (auto k = this->lhsOffset[nt]; k < this->lhsOffset[nt + 1]; ++k) {
+        const auto &rhs = grammar.rules[this->rulesByLHS[k]].second;
+        if (!rhs.empty() && rhs[0].type == Symbol::Type::NonTerminal &&
+            (rhs[0].id == nt) == recursive) {
+          edgeTo.push_back(rhs[0].id);
+          edgeAfter.push_back(this->ruleOffset[this->rulesByLHS[k]]);
+        }
+      }
     }
+  }
+  edgeOffset[count] = edgeTo.size();
 
-    if (next.type == Symbol::Type::NonTerminal) {
-      unsigned int i = 0;
+  // kernel items have the dot behind the first symbol, except S' → . S
+  std::pmr::vector<bool> needed(count, false, resource);
+  for (const auto &rule : grammar.rules) {
+    for (size_t i = rule.first == 0 ? 0 : 1; i < rule.second.size(); ++i) {
+      if (rule.second[i].type == Symbol::Type::NonTerminal)
+        needed[rule.second[i].id] = true;
+    }
+  }
 
-      const auto &itemrhs = grammar.rules[item.ruleID].second;
+  enum : uint8_t { Unvisited, Open, Finished };
+  std::pmr::vector<TerminalSet> lookaheads(
+      count, TerminalSet(grammar.terminals.size(), resource), resource);
+  std::pmr::vector<bool> inherit(count, false, resource);
+  std::pmr::vector<uint8_t> visit(count, Unvisited, resource);
+  std::pmr::vector<unsigned int> order(resource);
+  std::pmr::vector<std::pair<unsigned int, unsigned int>> stack(resource);
+  this->templateOffset.reserve(count + 1);
+  for (unsigned int nt = 0; nt < count; ++nt) {
+    this->templateOffset.push_back(this->templates.size());
+    if (!needed[nt])
+      continue;
 
-      for (const auto &rule : grammar.rules) {
-        if (rule.first == next.id) {
-          auto first = grammar.First(
-              itemrhs.begin() + item.dotPosition + 1, itemrhs.end());
-          if (first.empty() ||
-              std::find(first.begin(), first.end(), 0) != first.end()) {
-            first.push_back(item.endTerminal);
-          }
+    // postorder of the non-terminals reachable from nt
+    order.clear();
+    bool cyclic = false;
+    visit[nt] = Open;
+    stack.push_back({nt, edgeOffset[nt]});
+    while (!stack.empty()) {
+      auto &[from, edge] = stack.back();
+      if (edge == edgeOffset[from + 1]) {
+        visit[from] = Finished;
+        order.push_back(from);
+        stack.pop_back();
+        continue;
+      }
+      const auto to = edgeTo[edge++];
+      if (visit[to] == Unvisited) {
+        visit[to] = Open;
+        stack.push_back({to, edgeOffset[to]});
+      } else if (visit[to] == Open && to != from) {
+        cyclic = true;
+      }
+    }
+    std::reverse(order.begin(), order.end());
 
-          for (auto end_term : first) {
-            LRItem newitem = {
-                .ruleID = i,
-                .dotPosition = 0,
-                .endTerminal = end_term,
-            };
-            if (std::find(itemSet.begin(), itemSet.end(), newitem) ==
-                itemSet.end()) {
-              itemSet.push_back(newitem);
+    inherit[nt] = true;
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (auto from : order) {
+        for (auto e = edgeOffset[from]; e < edgeOffset[from + 1]; ++e) {
+          const auto to = edgeTo[e];
+          const auto after = edgeAfter[e];
+          changed |= lookaheads[to].Merge(this->firstAfter[after]);
+          if (this->inherits[after]) {
+            changed |= lookaheads[to].Merge(lookaheads[from]);
+            if (inherit[from] && !inherit[to]) {
+              inherit[to] = true;
+              changed = true;
             }
           }
         }
-        i++;
       }
+      changed = changed && cyclic;
+    }
+
+    // the breadth first order of Closure, children in the order of the rules
+    order.assign(1, nt);
+    visit[nt] = Unvisited;
+    for (size_t i = 0; i < order.size(); ++i) {
+      for (auto e = edgeOffset[order[i]]; e < edgeOffset[order[i] + 1]; ++e) {
+        if (visit[edgeTo[e]] == Finished) {
+          visit[edgeTo[e]] = Unvisited;
+          order.push_back(edgeTo[e]);
+        }
+      }
+    }
+    for (auto lhs : order) {
+      this->templates.push_back({lhs, inherit[lhs]});
+      auto &words = lookaheads[lhs].words;
+      this->spontaneous.insert(
+          this->spontaneous.end(), words.begin(), words.end());
+      std::fill(words.begin(), words.end(), 0);
+      inherit[lhs] = false;
+    }
+  }
+  this->templateOffset.push_back(this->templates.size());
+}
+
+// Compares a grammar with the one of a cache. Rules of non-terminals whose
+// list of rules is unchanged are mapped between both grammars.
+struct GrammarDiff {
+  static constexpr unsigned int NoRule = ~0u;
+
+  GrammarDiff(const Grammar &grammar, const TableCache &cache);
+
+  // terminals unchanged, non-terminals only appended and unchanged rules in
+  // the same order, otherwise nothing can be reused
+  bool compatible = false;
+  std::vector<bool> changed; // per non-terminal
+  std::vector<unsigned int> newRule;
+  std::vector<unsigned int> oldRule;
+};
+
+GrammarDiff::GrammarDiff(const Grammar &grammar, const TableCache &cache)
+    : changed(grammar.nonTerminals.size(), true),
+      newRule(cache.rules.size(), NoRule),
+      oldRule(grammar.rules.size(), NoRule) {
+  const auto oldCount = cache.nonTerminals.size();
+  if (cache.terminals != grammar.terminals ||
+      oldCount > grammar.nonTerminals.size() ||
+      !std::equal(
+          cache.nonTerminals.begin(), cache.nonTerminals.end(),
+          grammar.nonTerminals.begin()))
+    return;
+
+  std::vector<std::vector<unsigned int>> oldRules(oldCount);
+  std::vector<std::vector<unsigned int>> newRules(oldCount);
+  for (unsigned int i = 0; i < cache.rules.size(); ++i)
+    oldRules[cache.rules[i].first].push_back(i);
+  for (unsigned int i = 0; i < grammar.rules.size(); ++i) {
+    if (grammar.rules[i].first < oldCount)
+      newRules[grammar.rules[i].first].push_back(i);
+  }
+
+  for (size_t nt = 0; nt < oldCount; ++nt) {
+    this->changed[nt] =
+        oldRules[nt].size() != newRules[nt].size() ||
+        !std::equal(
+            oldRules[nt].begin(), oldRules[nt].end(), newRules[nt].begin(),
+            [&](unsigned int o, unsigned int n) {
+              return cache.rules[o].second == grammar.rules[n].second;
+            });
+    if (this->changed[nt])
+      continue;
+    for (size_t k = 0; k < oldRules[nt].size(); ++k) {
+      this->newRule[oldRules[nt][k]] = newRules[nt][k];
+      this->oldRule[newRules[nt][k]] = oldRules[nt][k];
+    }
+  }
+
+  // kernels are sorted by rule, the mapping has to keep that order
+  unsigned int last = 0;
+  for (auto rule : this->newRule) {
+    if (rule == NoRule)
+      continue;
+    if (rule < last)
+      return;
+    last = rule;
+  }
+  this->compatible = true;
+}
+
+static size_t HashCachedItem(
+    uint32_t rule, uint32_t dot, const uint64_t *words, size_t count) {
+  size_t h = 0;
+  for (size_t i = 0; i < count; ++i)
+    h = (h ^ words[i]) * 0x100000001b3;
+  return ((size_t(rule) << 16 ^ dot) * 0x9e3779b97f4a7c15) ^ h;
+}
+
+static bool Contains(const std::vector<unsigned int> &set, unsigned int x) {
+  return std::find(set.begin(), set.end(), x) != set.end();
+}
+
+// Finds the closure of a kernel in the item sets of a previous build when
+// neither the rules nor the FIRST sets it depends on have changed
+class ClosureReuse {
+public:
+  ClosureReuse(
+      const Grammar &grammar, const TableCache &cache,
+      const GrammarDiff &diff);
+
+  // append the rest of the closure to a sorted kernel, returns false if it
+  // has to be computed
+  bool Complete(ItemSet &kernel) const;
+
+private:
+  // FIRST of the symbols from start on changed
+  bool FirstChanged(
+      const std::vector<Symbol> &rhs, size_t start) const;
+
+  const Grammar &grammar;
+  const TableCache &cache;
+  const GrammarDiff &diff;
+  const size_t words;
+  std::vector<bool> nullable;
+  std::vector<bool> firstChanged;
+  // closure of the non-terminal reaches a changed rule or FIRST set
+  std::vector<bool> tainted;
+  // kernel hash to state of the cache
+  std::unordered_multimap<size_t, unsigned int> kernels;
+};
+
+ClosureReuse::ClosureReuse(
+    const Grammar &grammar, const TableCache &cache, const GrammarDiff &diff)
+    : grammar(grammar), cache(cache), diff(diff),
+      words((grammar.terminals.size() + 63) / 64),
+      nullable(grammar.nonTerminals.size()),
+      firstChanged(grammar.nonTerminals.size()), tainted(diff.changed) {
+  for (size_t nt = 0; nt < grammar.nonTerminals.size(); ++nt) {
+    this->nullable[nt] = Contains(grammar.first[nt], 0);
+    this->firstChanged[nt] =
+        nt >= cache.first.size() || cache.first[nt] != grammar.first[nt];
+  }
+
+  // expanding A → B γ takes the lookaheads of B from FIRST(γ)
+  for (const auto &[lhs, rhs] : grammar.rules) {
+    if (!rhs.empty() && rhs[0].type == Symbol::Type::NonTerminal &&
+        this->FirstChanged(rhs, 1))
+      this->tainted[lhs] = true;
+  }
+  for (bool added = true; added;) {
+    added = false;
+    for (const auto &[lhs, rhs] : grammar.rules) {
+      if (!rhs.empty() && rhs[0].type == Symbol::Type::NonTerminal &&
+          this->tainted[rhs[0].id] && !this->tainted[lhs]) {
+        this->tainted[lhs] = true;
+        added = true;
+      }
+    }
+  }
+
+  for (unsigned int state = 0; state < cache.kernelSizes.size(); ++state) {
+    size_t h = cache.kernelSizes[state];
+    for (auto i = cache.itemOffsets[state];
+         i < cache.itemOffsets[state] + cache.kernelSizes[state]; ++i) {
+      const auto &item = cache.items[i];
+      h = (h ^ HashCachedItem(
+                   item.rule, item.dot, &cache.lookaheads[i * this->words],
+                   this->words)) *
+          0x100000001b3;
+    }
+    this->kernels.emplace(h, state);
+  }
+}
+
+bool ClosureReuse::FirstChanged(
+    const std::vector<Symbol> &rhs, size_t start) const {
+  for (auto i = start; i < rhs.size(); ++i) {
+    if (rhs[i].type != Symbol::Type::NonTerminal)
+      return false;
+    if (this->firstChanged[rhs[i].id])
+      return true;
+    if (!this->nullable[rhs[i].id])
+      return false;
+  }
+  return false;
+}
+
+bool ClosureReuse::Complete(ItemSet &kernel) const {
+  size_t h = kernel.size();
+  for (const auto &item : kernel) {
+    const auto oldRule = this->diff.oldRule[item.ruleID];
+    if (oldRule == GrammarDiff::NoRule)
+      return false;
+    const auto &rhs = this->grammar.rules[item.ruleID].second;
+    if (item.dotPosition < rhs.size() &&
+        rhs[item.dotPosition].type == Symbol::Type::NonTerminal &&
+        (this->tainted[rhs[item.dotPosition].id] ||
+         this->FirstChanged(rhs, item.dotPosition + 1)))
+      return false;
+    h = (h ^ HashCachedItem(
+                 oldRule, item.dotPosition, item.lookaheads.words.data(),
+                 this->words)) *
+        0x100000001b3;
+  }
+
+  auto [candidate, last] = this->kernels.equal_range(h);
+  for (; candidate != last; ++candidate) {
+    const auto state = candidate->second;
+    const auto offset = this->cache.itemOffsets[state];
+    if (this->cache.kernelSizes[state] != kernel.size())
+      continue;
+    bool same = true;
+    for (size_t k = 0; same && k < kernel.size(); ++k) {
+      const auto &item = this->cache.items[offset + k];
+      same = item.rule == this->diff.oldRule[kernel[k].ruleID] &&
+             item.dot == kernel[k].dotPosition &&
+             std::equal(
+                 kernel[k].lookaheads.words.begin(),
+                 kernel[k].lookaheads.words.end(),
+                 &this->cache.lookaheads[(offset + k) * this->words]);
+    }
+    if (same)
+      break;
+  }
+  if (candidate == last)
+    return false;
+
+  const auto state = candidate->second;
+  const auto kernelSize = kernel.size();
+  auto resource = kernel.get_allocator().resource();
+  for (auto i = this->cache.itemOffsets[state] + kernelSize;
+       i < this->cache.itemOffsets[state + 1]; ++i) {
+    const auto &item = this->cache.items[i];
+    auto rule = this->diff.newRule[item.rule];
+    if (rule == GrammarDiff::NoRule) {
+      kernel.resize(kernelSize);
+      return false;
+    }
+    TerminalSet lookaheads(this->grammar.terminals.size(), resource);
+    std::copy_n(
+        &this->cache.lookaheads[i * this->words], this->words,
+        lookaheads.words.begin());
+    kernel.push_back({
+        .ruleID = rule,
+        .dotPosition = item.dot,
+        .lookaheads = std::move(lookaheads),
+    });
+  }
+  return true;
+}
+
+} // namespace
+
+RebuildStats CalculateIncremental(Grammar &grammar, const TableCache &cache) {
+  PROFILE_FUNC;
+  RebuildStats stats{};
+  const auto count = grammar.nonTerminals.size();
+  GrammarDiff diff(grammar, cache);
+  if (!diff.compatible || cache.first.size() != cache.nonTerminals.size()) {
+    grammar.Calculate();
+    stats.changedNonTerminals = count;
+    stats.firstComputed = count;
+    return stats;
+  }
+
+  // FIRST of a non-terminal depends on the FIRST sets of its RHS symbols up
+  // to the first one that cannot be empty, symbols not affected yet can be
+  // empty as before
+  auto affected = diff.changed;
+  for (bool added = true; added;) {
+    added = false;
+    for (const auto &[lhs, rhs] : grammar.rules) {
+      if (affected[lhs])
+        continue;
+      for (const auto &symbol : rhs) {
+        if (symbol.type != Symbol::Type::NonTerminal)
+          break;
+        if (affected[symbol.id]) {
+          affected[lhs] = true;
+          added = true;
+          break;
+        }
+        if (!Contains(cache.first[symbol.id], 0))
+          break;
+      }
+    }
+  }
+
+  stats.compatible = true;
+  for (size_t nt = 0; nt < count; ++nt) {
+    stats.changedNonTerminals += diff.changed[nt];
+    if (affected[nt]) {
+      grammar.first[nt].clear();
+    } else {
+      grammar.first[nt] = cache.first[nt];
+      ++stats.firstReused;
+    }
+  }
+  grammar.Calculate(affected);
+  stats.firstComputed = count - stats.firstReused;
+  return stats;
+}
+
+// Temporaries go to scratch, new items are placed in the resource of itemSet.
+// Every kernel item with a non-terminal after the dot instantiates the
+// template of that non-terminal, lookaheads of the closure items are the
+// union of what the kernel items pass to them. Only S' → . S has the dot at 0
+// in a kernel and no template contains it, so lookaheads added to the kernel
+// never have to be passed on again. Items are appended in the order a
+// breadth first expansion finds them, which numbers the states.
+static void Closure(
+    ItemSet &itemSet, const Grammar &grammar, const ClosureTables &tables,
+    std::pmr::memory_resource *scratch) {
+  PROFILE_FUNC;
+  constexpr unsigned int NoItem = ~0u;
+  auto resource = itemSet.get_allocator().resource();
+  const auto kernelSize = itemSet.size();
+
+  size_t sources = 0;
+  size_t source = 0;
+  for (size_t i = 0; i < kernelSize; ++i) {
+    if (itemSet[i].GetNextSymbol(grammar).type == Symbol::Type::NonTerminal) {
+      ++sources;
+      source = i;
+    }
+  }
+  if (sources == 0)
+    return;
+
+  // what a kernel item passes to its non-terminal, and what one template
+  // item adds to the rules of its LHS
+  TerminalSet lookaheads(grammar.terminals.size(), scratch);
+  TerminalSet incoming(grammar.terminals.size(), scratch);
+  auto passedBy = [&](const LRItem &item) -> const TerminalSet & {
+    const auto after = tables.ruleOffset[item.ruleID] + item.dotPosition;
+    if (!tables.inherits[after])
+      return tables.firstAfter[after];
+    lookaheads = tables.firstAfter[after];
+    lookaheads.Merge(item.lookaheads);
+    return lookaheads;
+  };
+  auto templateItem = [&](size_t t, const TerminalSet &passed) {
+    const auto words = tables.words;
+    incoming.words.assign(
+        tables.spontaneous.begin() + t * words,
+        tables.spontaneous.begin() + (t + 1) * words);
+    if (tables.templates[t].inherits)
+      incoming.Merge(passed);
+  };
+
+  // a single template is the whole closure in the right order
+  if (sources == 1) {
+    const auto next = itemSet[source].GetNextSymbol(grammar);
+    const auto &passed = passedBy(itemSet[source]);
+    for (auto t = tables.templateOffset[next.id];
+         t < tables.templateOffset[next.id + 1]; ++t) {
+      templateItem(t, passed);
+      const auto lhs = tables.templates[t].lhs;
+      for (auto k = tables.lhsOffset[lhs]; k < tables.lhsOffset[lhs + 1]; ++k) {
+        itemSet.push_back({
+            .ruleID = tables.rulesByLHS[k],
+            .dotPosition = 0,
+            .lookaheads = TerminalSet(incoming, resource),
+        });
+      }
+    }
+    return;
+  }
+
+  // position of the item with dot at 0 for each rule, every core appears at
+  // most once in a set and its lookaheads are merged instead
+  std::pmr::vector<unsigned int> ruleItem(
+      grammar.rules.size(), NoItem, scratch);
+  for (unsigned int i = 0; i < kernelSize; ++i) {
+    if (itemSet[i].dotPosition == 0)
+      ruleItem[itemSet[i].ruleID] = i;
+  }
+
+  // the items in breadth first order, each non-terminal is expanded once
+  std::pmr::vector<bool> expanded(grammar.nonTerminals.size(), false, scratch);
+  for (size_t i = 0; i < itemSet.size(); ++i) {
+    const auto next = itemSet[i].GetNextSymbol(grammar);
+    if (next.type != Symbol::Type::NonTerminal || expanded[next.id])
+      continue;
+    expanded[next.id] = true;
+    for (auto k = tables.lhsOffset[next.id]; k < tables.lhsOffset[next.id + 1];
+         ++k) {
+      const auto rule = tables.rulesByLHS[k];
+      if (ruleItem[rule] != NoItem)
+        continue;
+      ruleItem[rule] = itemSet.size();
+      itemSet.push_back({
+          .ruleID = rule,
+          .dotPosition = 0,
+          .lookaheads = TerminalSet(grammar.terminals.size(), resource),
+      });
+    }
+  }
+
+  for (size_t i = 0; i < kernelSize; ++i) {
+    const auto next = itemSet[i].GetNextSymbol(grammar);
+    if (next.type != Symbol::Type::NonTerminal)
+      continue;
+    const auto &passed = passedBy(itemSet[i]);
+    for (auto t = tables.templateOffset[next.id];
+         t < tables.templateOffset[next.id + 1]; ++t) {
+      templateItem(t, passed);
+      const auto lhs = tables.templates[t].lhs;
+      for (auto k = tables.lhsOffset[lhs]; k < tables.lhsOffset[lhs + 1]; ++k)
+        itemSet[ruleItem[tables.rulesByLHS[k]]].lookaheads.Merge(incoming);
     }
   }
 }
 
 void LRTable::Display(const Grammar &grammar) {
-  std::cout << "   ";
+  auto &out = Out();
+  out << "   ";
   for (const auto &terminal : grammar.terminals) {
-    std::cout << " │ " << std::setw(3) << terminal.substr(0, 3);
+    out << " │ ";
+    out.Left(std::string_view(terminal).substr(0, 3), 3);
   }
 
   for (auto nt = grammar.nonTerminals.begin() + 1;
        nt != grammar.nonTerminals.end(); ++nt) {
-    std::cout << " │ " << std::setw(2) << nt->substr(0, 2);
+    out << " │ ";
+    out.Left(std::string_view(*nt).substr(0, 2), 2);
   }
-  std::cout << std::endl;
+  out << '\n';
 
-  unsigned int i = 0;
   for (unsigned int row = 0; row < this->actions.size(); ++row) {
-    std::cout << std::setw(3) << std::right << i++ << std::left;
+    out.Right(row, 3);
     for (const auto &column : this->actions[row]) {
-      std::cout << " │ ";
+      out << " │ ";
 
       switch (column.type) {
       case LRAction::Type::Error:
-        std::cout << ANSI_COLOR_RED << 'E' << std::setw(2) << ANSI_COLOR_RESET
-                  << "  ";
+        out.Color(ANSI_COLOR_RED) << 'E';
+        out.Color(ANSI_COLOR_RESET) << "  ";
         break;
       case LRAction::Type::Shift:
-        std::cout << ANSI_COLOR_YELLOW << 'S' << std::setw(2) << column.num
-                  << ANSI_COLOR_RESET;
+        out.Color(ANSI_COLOR_YELLOW) << 'S';
+        out.Left(column.num, 2).Color(ANSI_COLOR_RESET);
         break;
       case LRAction::Type::Reduce:
-        std::cout << ANSI_COLOR_CYAN << 'R' << std::setw(2) << column.num
-                  << ANSI_COLOR_RESET;
+        out.Color(ANSI_COLOR_CYAN) << 'R';
+        out.Left(column.num, 2).Color(ANSI_COLOR_RESET);
         break;
       case LRAction::Type::Accept:
-        std::cout << ANSI_COLOR_GREEN << 'A' << std::setw(2) << "  "
-                  << ANSI_COLOR_RESET;
+        out.Color(ANSI_COLOR_GREEN) << "A  ";
+        out.Color(ANSI_COLOR_RESET);
       }
     }
 
     for (unsigned int col = 1; col < grammar.nonTerminals.size(); ++col) {
       unsigned int val = this->goTo[row][col];
       if (val == 0) {
-        std::cout << " │   ";
+        out << " │   ";
       } else {
-        std::cout << " │ " << std::right << std::setw(2) << this->goTo[row][col]
-                  << std::left;
+        out << " │ ";
+        out.Right(val, 2);
       }
     }
 
-    std::cout << std::endl;
+    out << '\n';
+  }
+  out.Flush();
+}
+
+void LRTable::DisplayConflicts(const Grammar &grammar) {
+  auto &out = Out();
+  out << "Conflicts\n═════════\n";
+
+  for (const auto &conflict : this->conflicts) {
+    out.Right(conflict.state, 3) << "│ ";
+    out.Color(ANSI_COLOR_MAGENTA) << grammar.terminals[conflict.terminal];
+    out.Color(ANSI_COLOR_RESET) << ' ';
+    if (conflict.type == LRConflict::Type::ShiftReduce) {
+      out << "shift-reduce S" << conflict.other << "/R" << conflict.rule;
+    } else {
+      out << "reduce-reduce R" << conflict.rule << "/R" << conflict.other;
+    }
+
+    switch (conflict.resolution) {
+    case LRConflict::Resolution::Unresolved:
+      out.Color(ANSI_COLOR_RED) << " unresolved";
+      break;
+    case LRConflict::Resolution::Shift:
+      out.Color(ANSI_COLOR_GREEN) << " resolved as shift";
+      break;
+    case LRConflict::Resolution::Reduce:
+      out.Color(ANSI_COLOR_GREEN) << " resolved as reduce";
+      break;
+    case LRConflict::Resolution::Error:
+      out.Color(ANSI_COLOR_GREEN) << " resolved as error (%nonassoc)";
+      break;
+    }
+    out.Color(ANSI_COLOR_RESET) << '\n';
+  }
+  out << '\n';
+  out.Flush();
+}
+
+// action in the compact notation used by the CSV and JSON exports
+static void WriteAction(OutputBuffer &file, const LRAction &action) {
+  switch (action.type) {
+  case LRAction::Type::Error:
+    file << 'E';
+    break;
+  case LRAction::Type::Shift:
+    file << 'S' << action.num;
+    break;
+  case LRAction::Type::Reduce:
+    file << 'R' << action.num;
+    break;
+  case LRAction::Type::Accept:
+    file << 'A';
+    break;
+  default:
+    file << 'U';
+  }
+}
+
+// Binary layout of TableCache files: values are 32 bit in host byte order,
+// symbols are stored as type << 31 | id and the item arrays are written as
+// they are, each preceded by its length
+static constexpr char CacheMagic[] = "lrone table cache 2\n";
+
+bool TableCache::Save(const char *filename) const {
+  PROFILE_FUNC;
+  std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+    return false;
+
+  auto u32 = [&](uint32_t value) {
+    file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+  };
+  auto strings = [&](const std::vector<std::string> &names) {
+    u32(names.size());
+    for (const auto &name : names) {
+      u32(name.size());
+      file.write(name.data(), name.size());
+    }
+  };
+  auto array = [&](const auto &values) {
+    u32(values.size());
+    file.write(
+        reinterpret_cast<const char *>(values.data()),
+        values.size() * sizeof(values[0]));
+  };
+
+  file.write(CacheMagic, sizeof(CacheMagic) - 1);
+  strings(this->terminals);
+  strings(this->nonTerminals);
+  u32(this->rules.size());
+  for (const auto &[lhs, rhs] : this->rules) {
+    u32(lhs);
+    u32(rhs.size());
+    for (const auto &symbol : rhs)
+      u32(uint32_t(symbol.type == Symbol::Type::NonTerminal) << 31 | symbol.id);
+  }
+  u32(this->first.size());
+  for (const auto &set : this->first)
+    array(set);
+  array(this->itemOffsets);
+  array(this->kernelSizes);
+  array(this->items);
+  array(this->lookaheads);
+  return file.good();
+}
+
+bool TableCache::Load(const char *filename) {
+  PROFILE_FUNC;
+  *this = {};
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  bool ok = true;
+  auto u32 = [&]() {
+    uint32_t value = 0;
+    file.read(reinterpret_cast<char *>(&value), sizeof(value));
+    ok = ok && file.good();
+    return value;
+  };
+  // counts are checked against the file size before allocating
+  file.seekg(0, std::ios::end);
+  const uint64_t fileSize = file.tellg();
+  file.seekg(0);
+  auto count = [&](uint64_t elementSize) -> uint32_t {
+    auto n = u32();
+    ok = ok && n * elementSize <= fileSize;
+    return ok ? n : 0;
+  };
+  auto strings = [&](std::vector<std::string> &names) {
+    names.resize(count(4));
+    for (auto &name : names) {
+      name.resize(count(1));
+      file.read(name.data(), name.size());
+    }
+  };
+  auto array = [&](auto &values) {
+    values.resize(count(sizeof(values[0])));
+    file.read(
+        reinterpret_cast<char *>(values.data()),
+        values.size() * sizeof(values[0]));
+    ok = ok && file.good();
+  };
+
+  char magic[sizeof(CacheMagic) - 1];
+  file.read(magic, sizeof(magic));
+  if (!file.good() || !std::equal(magic, magic + sizeof(magic), CacheMagic))
+    return false;
+
+  strings(this->terminals);
+  strings(this->nonTerminals);
+  const auto terminalCount = this->terminals.size();
+  const auto nonTerminalCount = this->nonTerminals.size();
+  this->rules.resize(count(8));
+  for (auto &[lhs, rhs] : this->rules) {
+    lhs = u32();
+    ok = ok && lhs < nonTerminalCount;
+    rhs.resize(count(4));
+    for (auto &symbol : rhs) {
+      auto value = u32();
+      symbol.type = value >> 31 ? Symbol::Type::NonTerminal
+                                : Symbol::Type::Terminal;
+      symbol.id = value & ~(uint32_t(1) << 31);
+      ok = ok && symbol.id < (value >> 31 ? nonTerminalCount : terminalCount);
+    }
   }
+  this->first.resize(count(4));
+  for (auto &set : this->first) {
+    array(set);
+    for (auto terminal : set)
+      ok = ok && terminal < terminalCount;
+  }
+  array(this->itemOffsets);
+  array(this->kernelSizes);
+  array(this->items);
+  array(this->lookaheads);
+
+  // every state must refer to valid items of valid rules
+  const size_t words = (terminalCount + 63) / 64;
+  ok = ok && this->first.size() == nonTerminalCount &&
+       this->itemOffsets.size() == this->kernelSizes.size() + 1 &&
+       this->itemOffsets.back() == this->items.size() &&
+       this->lookaheads.size() == this->items.size() * words;
+  for (size_t i = 0; ok && i < this->kernelSizes.size(); ++i) {
+    ok = this->itemOffsets[i] <= this->itemOffsets[i + 1] &&
+         this->kernelSizes[i] <=
+             this->itemOffsets[i + 1] - this->itemOffsets[i];
+  }
+  for (size_t i = 0; ok && i < this->items.size(); ++i) {
+    const auto &item = this->items[i];
+    ok = item.rule < this->rules.size() &&
+         item.dot <= this->rules[item.rule].second.size();
+  }
+
+  if (!ok)
+    *this = {};
+  return ok;
 }
 
-void LRTable::WriteCSV(const char *filename, const Grammar &grammar) {
+LRTableMemory LRTable::MemoryUsage() const {
+  LRTableMemory memory{};
+  memory.rowHeaders = this->actions.capacity() * sizeof(this->actions[0]) +
+                      this->goTo.capacity() * sizeof(this->goTo[0]);
+  for (const auto &row : this->actions)
+    memory.actions += row.capacity() * sizeof(LRAction);
+  for (const auto &row : this->goTo)
+    memory.goTo += row.capacity() * sizeof(unsigned int);
+  memory.conflicts = this->conflicts.capacity() * sizeof(LRConflict);
+  memory.rows = this->actions.size() + this->goTo.size();
+  return memory;
+}
+
+bool LRTable::WriteCSV(const char *filename, const Grammar &grammar) {
   PROFILE_FUNC;
-  auto file = std::ofstream(filename);
+  OutputBuffer file(filename);
+  if (!file.IsOpen())
+    return false;
+
   file << "State,";
   for (const auto &terminal : grammar.terminals) {
     file << '"' << terminal << "\", ";
   }
-  file << std::endl;
+  file << '\n';
   unsigned int i = 0;
   for (const auto &row : this->actions) {
     file << i << ", ";
     for (const auto &col : row) {
       file << '"';
-      switch (col.type) {
-      case LRAction::Type::Error:
-        file << 'E';
-        break;
-      case LRAction::Type::Shift:
-        file << 'S' << col.num;
-        break;
-      case LRAction::Type::Reduce:
-        file << 'R' << col.num;
-        break;
-      case LRAction::Type::Accept:
-        file << 'A';
-        break;
-      default:
-        file << 'U';
-      }
+      WriteAction(file, col);
       file << "\", ";
     }
 
@@ -186,217 +1046,1372 @@ void LRTable::WriteCSV(const char *filename, const Grammar &grammar) {
       }
       file << "\", ";
     }
-    file << std::endl;
+    file << '\n';
   }
+  return true;
 }
 
-LRTable GenerateTable(const Grammar &grammar) {
+bool LRTable::WriteJSON(const char *filename, const Grammar &grammar) {
   PROFILE_FUNC;
-  LRTable table;
-  std::vector<std::vector<LRItem>> itemSets;
-  std::vector<std::pair<unsigned int, Symbol>> backtrack;
+  OutputBuffer file(filename);
+  if (!file.IsOpen())
+    return false;
 
-  if (grammar.rules.size() == 0) {
-    std::cerr << "No rules found in grammar" << std::endl;
+  file << "{\n\"terminals\": [";
+  for (unsigned int t = 0; t < grammar.terminals.size(); ++t) {
+    if (t != 0)
+      file << ", ";
+    file.JSONString(grammar.terminals[t]);
+  }
+  file << "],\n\"nonTerminals\": [";
+  for (unsigned int nt = 0; nt < grammar.nonTerminals.size(); ++nt) {
+    if (nt != 0)
+      file << ", ";
+    file.JSONString(grammar.nonTerminals[nt]);
   }
 
-  // state 0
-  itemSets.push_back({{.ruleID = 0, .dotPosition = 0, .endTerminal = 0}});
-  Closure(itemSets[0], grammar);
-  if (!benchmark_mode) {
-    std::cout << "I0:" << std::endl;
-    for (const auto &item : itemSets[0]) {
-      item.Display(grammar);
+  file << "],\n\"rules\": [";
+  for (unsigned int r = 0; r < grammar.rules.size(); ++r) {
+    file << (r == 0 ? "\n" : ",\n") << "{\"lhs\": " << grammar.rules[r].first
+         << ", \"rhs\": [";
+    for (unsigned int i = 0; i < grammar.rules[r].second.size(); ++i) {
+      const auto &symbol = grammar.rules[r].second[i];
+      if (i != 0)
+        file << ", ";
+      file << (symbol.type == Symbol::Type::Terminal ? "\"t" : "\"n")
+           << symbol.id << '"';
+    }
+    file << "]}";
+  }
+
+  // actions use the CSV notation, GOTOs are state numbers with 0 for none
+  file << "],\n\"actions\": [";
+  for (unsigned int row = 0; row < this->actions.size(); ++row) {
+    file << (row == 0 ? "\n[" : ",\n[");
+    for (unsigned int col = 0; col < this->actions[row].size(); ++col) {
+      if (col != 0)
+        file << ", ";
+      file << '"';
+      WriteAction(file, this->actions[row][col]);
+      file << '"';
+    }
+    file << ']';
+  }
+  file << "],\n\"goTo\": [";
+  for (unsigned int row = 0; row < this->goTo.size(); ++row) {
+    file << (row == 0 ? "\n[" : ",\n[");
+    for (unsigned int col = 0; col < this->goTo[row].size(); ++col) {
+      if (col != 0)
+        file << ", ";
+      file << this->goTo[row][col];
     }
+    file << ']';
   }
 
-  // this value is never used and only kept for correct offset
-  backtrack.push_back({0, {}});
+  file << "],\n\"conflicts\": [";
+  for (unsigned int i = 0; i < this->conflicts.size(); ++i) {
+    const auto &conflict = this->conflicts[i];
+    static const char *resolutions[] = {
+        "unresolved", "shift", "reduce", "error"};
+    file << (i == 0 ? "\n" : ",\n") << "{\"type\": \""
+         << (conflict.type == LRConflict::Type::ShiftReduce ? "shift-reduce"
+                                                           : "reduce-reduce")
+         << "\", \"resolution\": \""
+         << resolutions[static_cast<int>(conflict.resolution)]
+         << "\", \"state\": " << conflict.state
+         << ", \"terminal\": " << conflict.terminal
+         << ", \"rule\": " << conflict.rule << ", \"other\": " << conflict.other
+         << '}';
+  }
+  file << "]\n}\n";
+  return true;
+}
 
-  // calculate next states
-  for (unsigned int setid = 0; setid < itemSets.size(); ++setid) {
-    PROFILE_SCOPE("Item Set");
-    // copy to use as itemSets array maybe resized invalidating references
-    auto set = itemSets[setid];
-
-    // add new row for actions
-    table.actions.push_back(std::vector<LRAction>(
-        grammar.terminals.size(), {LRAction::Type::Error, 0}));
-
-    // add new row for goTo
-    table.goTo.push_back(
-        std::vector<unsigned int>(grammar.nonTerminals.size(), 0));
-
-    // handle reduce
-    for (const auto &item : set) {
-      auto next = item.GetNextSymbol(grammar);
-      if (next.type == Symbol::Type::Terminal && next.id == 0) {
-        if (table.actions[setid][item.endTerminal].type ==
-            LRAction::Type::Error) {
-          if (item.ruleID == 0) {
-            table.actions[setid][item.endTerminal] = {
-                .type = LRAction::Type::Accept, .num = item.ruleID};
-          } else {
-            table.actions[setid][item.endTerminal] = {
-                .type = LRAction::Type::Reduce, .num = item.ruleID};
-          }
-        } else {
-          switch (table.actions[setid][item.endTerminal].type) {
-          case LRAction::Type::Shift:
-            std::cout << ANSI_COLOR_RED
-                      << "Shift-Reduce conflict after reading (RTL):"
-                      << std::endl
-                      << ANSI_COLOR_MAGENTA
-                      << grammar.terminals[item.endTerminal]
-                      << ANSI_COLOR_RESET;
-            break;
-          case LRAction::Type::Reduce:
-            std::cout << ANSI_COLOR_RED
-                      << "Reduce-Reduce conflict after reading (RTL):"
-                      << std::endl
-                      << ANSI_COLOR_MAGENTA
-                      << grammar.terminals[item.endTerminal]
-                      << ANSI_COLOR_RESET;
-            break;
-          default:
-            break;
-          }
+// Decide a shift-reduce conflict the way yacc does, by comparing the
+// precedence of the rule with the precedence of the lookahead terminal
+static LRConflict::Resolution ResolveShiftReduce(
+    const Grammar &grammar, unsigned long rule, unsigned int terminal) {
+  const auto rulePrecedence = grammar.RulePrecedence(rule);
+  const auto terminalPrecedence = grammar.terminalPrecedence[terminal];
+  if (rulePrecedence.level == 0 || terminalPrecedence.level == 0)
+    return LRConflict::Resolution::Unresolved;
 
-          // provide example path on conflict
-          for (unsigned int i = setid; i != 0; i = backtrack[i].first) {
-            if (backtrack[i].second.id) {
-              std::cout << " ← " << i << " ← " << ANSI_COLOR_MAGENTA;
-              backtrack[i].second.Display(grammar);
-              std::cout << ANSI_COLOR_RESET;
-            }
-          }
-          std::cout << std::endl;
+  if (terminalPrecedence.level > rulePrecedence.level)
+    return LRConflict::Resolution::Shift;
+  if (terminalPrecedence.level < rulePrecedence.level)
+    return LRConflict::Resolution::Reduce;
+
+  switch (terminalPrecedence.associativity) {
+  case Precedence::Associativity::Left:
+    return LRConflict::Resolution::Reduce;
+  case Precedence::Associativity::Right:
+    return LRConflict::Resolution::Shift;
+  case Precedence::Associativity::NonAssoc:
+    break;
+  }
+  return LRConflict::Resolution::Error;
+}
+
+// Pager's weak compatibility of two kernels with the same core: for every
+// pair of items, lookaheads that would meet only across the two states
+// already meet within one of them. Merging such states adds no conflict that
+// the canonical states do not have.
+static bool WeaklyCompatible(const LRItem *a, const LRItem *b, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    for (size_t j = i + 1; j < size; ++j) {
+      if (!a[i].lookaheads.Intersects(b[j].lookaheads) &&
+          !b[i].lookaheads.Intersects(a[j].lookaheads))
+        continue;
+      if (!a[i].lookaheads.Intersects(a[j].lookaheads) &&
+          !b[i].lookaheads.Intersects(b[j].lookaheads))
+        return false;
+    }
+  }
+  return true;
+}
+
+static size_t CoreHash(const ItemSet &kernel) {
+  size_t h = kernel.size();
+  for (const auto &item : kernel) {
+    h = (h ^ ((size_t(item.ruleID) << 16 ^ item.dotPosition) *
+              0x9e3779b97f4a7c15)) *
+        0x100000001b3;
+  }
+  return h;
+}
+
+// only the kernel of a state is kept, the closure is computed when its row is
+// built
+static void KeepKernel(ItemSet &) {}
+
+namespace {
+
+// File written through a buffer, parts of it can be read back at any time
+class SpillFile {
+public:
+  SpillFile() = default;
+  ~SpillFile() {
+    if (this->fd >= 0)
+      close(this->fd);
+  }
+  SpillFile(const SpillFile &) = delete;
+  SpillFile &operator=(const SpillFile &) = delete;
+
+  // a file that is removed right away, it lives as long as it is open
+  bool CreateTemporary(const std::string &directory, size_t bufferSize) {
+    std::string name = directory + "/lrone-spill-XXXXXX";
+    this->fd = mkstemp(name.data());
+    if (this->fd < 0)
+      return false;
+    unlink(name.c_str());
+    this->buffer.reserve(bufferSize);
+    return true;
+  }
+  bool Create(const std::string &filename, size_t bufferSize) {
+    this->fd = open(
+        filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    this->buffer.reserve(bufferSize);
+    return this->fd >= 0;
+  }
+
+  // offset of the appended bytes
+  uint64_t Append(const void *data, size_t size) {
+    const uint64_t offset = this->Size();
+    const auto *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+      if (this->buffer.size() == this->buffer.capacity())
+        this->Flush();
+      const size_t part =
+          std::min(size, this->buffer.capacity() - this->buffer.size());
+      this->buffer.insert(this->buffer.end(), bytes, bytes + part);
+      bytes += part;
+      size -= part;
+    }
+    return offset;
+  }
+  void Read(uint64_t offset, void *data, size_t size) {
+    if (offset + size > this->written)
+      this->Flush();
+    if (pread(this->fd, data, size, offset) != ssize_t(size))
+      this->failed = true;
+  }
+  void Write(uint64_t offset, const void *data, size_t size) {
+    if (pwrite(this->fd, data, size, offset) != ssize_t(size))
+      this->failed = true;
+  }
+  void Flush() {
+    if (!this->buffer.empty() &&
+        pwrite(this->fd, this->buffer.data(), this->buffer.size(),
+               this->written) != ssize_t(this->buffer.size()))
+      this->failed = true;
+    this->written += this->buffer.size();
+    this->buffer.clear();
+  }
+
+  uint64_t Size() const { return this->written + this->buffer.size(); }
+  size_t BufferBytes() const { return this->buffer.capacity(); }
+
+  bool failed = false;
+
+private:
+  int fd = -1;
+  uint64_t written = 0;
+  std::vector<char> buffer;
+};
+
+// Header of the files of MappedTable, the rows follow it and the conflicts
+// follow the rows. Values are in host byte order.
+struct MappedHeader {
+  char magic[8];
+  uint32_t states;
+  uint32_t terminals;
+  uint32_t nonTerminals;
+  uint32_t conflicts;
+  uint64_t conflictOffset;
+};
+static_assert(sizeof(MappedHeader) == 32);
+constexpr char MappedMagic[8] = {'l', 'r', 'o', 'n', 'e', 'T', 'B', '1'};
+
+// conflicts follow the rows in this form
+struct MappedConflict {
+  uint32_t type;
+  uint32_t resolution;
+  uint32_t state;
+  uint32_t terminal;
+  uint64_t rule;
+  uint64_t other;
+};
+
+// States of a build under a memory cap. A kernel is written to the item set
+// file when its state is found and only its fingerprint and offset stay in
+// memory, the finished rows go to the table file in state order.
+class KernelSpill {
+public:
+  KernelSpill(size_t terminalCount, size_t bufferSize)
+      : words((terminalCount + 63) / 64), bufferSize(bufferSize) {}
+
+  bool Open(const std::string &directory, const std::string &filename) {
+    if (!this->itemSets.CreateTemporary(directory, this->bufferSize) ||
+        !this->table.Create(filename, this->bufferSize))
+      return false;
+    // the header is written when the table is done
+    MappedHeader header{};
+    this->table.Append(&header, sizeof(header));
+    this->slots.assign(1024, {0, NoState});
+    return true;
+  }
+
+  // state of a sorted kernel, a new one is spilled
+  unsigned int State(const ItemSet &kernel) {
+    this->encoded.clear();
+    this->encoded.push_back(kernel.size());
+    for (const auto &item : kernel) {
+      this->encoded.push_back(uint64_t(item.ruleID) << 32 | item.dotPosition);
+      this->encoded.insert(
+          this->encoded.end(), item.lookaheads.words.begin(),
+          item.lookaheads.words.end());
+    }
+    uint64_t hash = 0;
+    for (auto word : this->encoded)
+      hash = (hash ^ word ^ (hash >> 29)) * 0x9e3779b97f4a7c15;
+
+    const size_t mask = this->slots.size() - 1;
+    size_t slot = hash & mask;
+    for (; this->slots[slot].state != NoState; slot = (slot + 1) & mask) {
+      if (this->slots[slot].hash != hash)
+        continue;
+      // fingerprints can collide, the kernel on disk decides
+      const auto state = this->slots[slot].state;
+      if (this->offsets[state + 1] - this->offsets[state] !=
+          this->encoded.size() * sizeof(uint64_t))
+        continue;
+      this->stored.resize(this->encoded.size());
+      this->itemSets.Read(
+          this->offsets[state], this->stored.data(),
+          this->stored.size() * sizeof(uint64_t));
+      this->itemSetReads += this->stored.size() * sizeof(uint64_t);
+      if (this->stored == this->encoded)
+        return state;
+    }
+
+    const unsigned int state = this->offsets.size() - 1;
+    this->slots[slot] = {hash, state};
+    this->itemSets.Append(
+        this->encoded.data(), this->encoded.size() * sizeof(uint64_t));
+    this->offsets.push_back(this->itemSets.Size());
+    if (this->offsets.size() > this->slots.size() / 2)
+      this->Rehash();
+    return state;
+  }
+
+  unsigned int States() const { return this->offsets.size() - 1; }
+
+  // kernel of a state in the scratch arena
+  void Kernel(unsigned int state, ItemSet &kernel, Arena &scratch) {
+    this->stored.resize(
+        (this->offsets[state + 1] - this->offsets[state]) / sizeof(uint64_t));
+    this->itemSets.Read(
+        this->offsets[state], this->stored.data(),
+        this->stored.size() * sizeof(uint64_t));
+    const auto *word = this->stored.data();
+    const size_t size = *word++;
+    kernel.clear();
+    kernel.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+      const uint64_t core = *word++;
+      TerminalSet lookaheads(0, &scratch);
+      lookaheads.words.assign(word, word + this->words);
+      word += this->words;
+      kernel.push_back({
+          .ruleID = uint32_t(core >> 32),
+          .dotPosition = uint32_t(core),
+          .lookaheads = std::move(lookaheads),
+      });
+    }
+  }
+
+  void WriteRow(
+      const std::vector<LRAction> &actions,
+      const std::vector<unsigned int> &goTo) {
+    this->row.clear();
+    for (const auto &action : actions)
+      this->row.push_back(uint32_t(action.num) << 2 | uint32_t(action.type));
+    this->row.insert(this->row.end(), goTo.begin(), goTo.end());
+    this->table.Append(this->row.data(), this->row.size() * sizeof(uint32_t));
+  }
+
+  // conflicts and header, false if a file could not be written
+  bool Finish(const LRTable &conflicts, size_t terminals, size_t nonTerminals) {
+    MappedHeader header{};
+    std::copy(std::begin(MappedMagic), std::end(MappedMagic), header.magic);
+    header.states = this->States();
+    header.terminals = terminals;
+    header.nonTerminals = nonTerminals;
+    header.conflicts = conflicts.conflicts.size();
+    header.conflictOffset = this->table.Size();
+    for (const auto &conflict : conflicts.conflicts) {
+      MappedConflict record{
+          uint32_t(conflict.type), uint32_t(conflict.resolution),
+          conflict.state,          conflict.terminal,
+          conflict.rule,           conflict.other};
+      this->table.Append(&record, sizeof(record));
+    }
+    this->table.Flush();
+    this->table.Write(0, &header, sizeof(header));
+    return !this->Failed();
+  }
+
+  bool Failed() const { return this->itemSets.failed || this->table.failed; }
+
+  // heap bytes held, the buffers included
+  size_t Bytes() const {
+    return this->slots.capacity() * sizeof(Slot) +
+           this->offsets.capacity() * sizeof(uint64_t) +
+           (this->encoded.capacity() + this->stored.capacity()) *
+               sizeof(uint64_t) +
+           this->row.capacity() * sizeof(uint32_t) +
+           this->itemSets.BufferBytes() + this->table.BufferBytes();
+  }
+
+  uint64_t ItemSetBytes() const { return this->itemSets.Size(); }
+  uint64_t itemSetReads = 0;
+
+private:
+  static constexpr uint32_t NoState = ~0u;
+
+  void Rehash() {
+    std::vector<Slot> old(this->slots.size() * 2, {0, NoState});
+    old.swap(this->slots);
+    const size_t mask = this->slots.size() - 1;
+    for (const auto &entry : old) {
+      if (entry.state == NoState)
+        continue;
+      size_t slot = entry.hash & mask;
+      while (this->slots[slot].state != NoState)
+        slot = (slot + 1) & mask;
+      this->slots[slot] = entry;
+    }
+  }
+
+  struct Slot {
+    uint64_t hash;
+    uint32_t state;
+  };
+  // open addressing, at most half full
+  std::vector<Slot> slots;
+  // kernel of state i from offsets[i] to offsets[i + 1] in the item set file,
+  // its item count followed by rule << 32 | dot and the lookahead words of
+  // every item
+  std::vector<uint64_t> offsets{0};
+  const size_t words;
+  const size_t bufferSize;
+  std::vector<uint64_t> encoded, stored;
+  std::vector<uint32_t> row;
+  SpillFile itemSets, table;
+};
+
+// States of the canonical LR(1) automaton found so far and the rows of the
+// table built for them. States are numbered in the order they are found.
+// In minimal mode a kernel whose core is already known is merged into a
+// weakly compatible state instead (Pager), so only kernels are kept and rows
+// of states whose lookaheads grew are built again.
+class StateBuilder {
+public:
+  StateBuilder(
+      const Grammar &grammar, LRTable &table, bool report,
+      bool minimal = false);
+
+  // Create state 0 from the start rule
+  template <typename Complete> void Start(Complete complete);
+
+  // Looks up the state with the given kernel. A new state gets empty rows
+  // and keeps the item set left by complete(kernel) in the states arena.
+  template <typename Complete>
+  unsigned int
+  State(ItemSet &kernel, unsigned int from, Symbol symbol, Complete complete);
+
+  // Fill the rows of a state from its closure
+  template <typename Complete>
+  void AddRow(unsigned int setid, const ItemSet &set, Complete complete);
+
+  // closure and rows of a state that only kept its kernel
+  void Build(unsigned int state);
+  // display an unresolved conflict with a path to its state
+  void Report(const LRConflict &conflict) const;
+
+  const Grammar &grammar;
+  LRTable &table;
+  // accepted item sets stay in the states arena until the table is done,
+  // everything else is allocated in scratch which is reset for every state
+  Arena states, scratch;
+  ClosureTables tables;
+  // a deque keeps references to item sets valid while states are added
+  std::pmr::deque<ItemSet> itemSets;
+  std::pmr::vector<std::pair<unsigned int, Symbol>> backtrack;
+  std::pmr::unordered_map<KernelKey, unsigned int, KernelHash> kernels;
+  std::pmr::vector<unsigned int> kernelSizes;
+  bool report; // display conflicts as they are found
+
+  const bool minimal;
+  // states by the hash of their core
+  std::pmr::unordered_multimap<size_t, unsigned int> cores;
+  // targets of the transitions of each built state in the order AddRow takes
+  // them, a rebuilt row keeps its targets
+  std::pmr::deque<std::pmr::vector<unsigned int>> successors;
+  std::pmr::vector<bool> built;
+  // built states whose lookaheads grew since, to be built again
+  std::pmr::vector<unsigned int> grown;
+  std::pmr::vector<bool> queued;
+  unsigned int distinctCores = 0;
+  unsigned int merged = 0;
+  unsigned int rebuilt = 0;
+
+  // row being built by AddRow
+  std::vector<LRAction> actions;
+  std::vector<unsigned int> goTo;
+  // kernels and rows go to disk instead, see GenerateSpilledTable
+  KernelSpill *spill = nullptr;
+
+private:
+  // state for a kernel found from the given state in minimal mode
+  unsigned int MinimalState(ItemSet &kernel, unsigned int from, Symbol symbol);
+  // add the lookaheads of a kernel with the same core, false if none was new
+  bool Merge(unsigned int state, const ItemSet &kernel);
+  // the target of a transition of the state being built
+  template <typename Complete>
+  unsigned int Target(
+      ItemSet &kernel, unsigned int from, Symbol symbol, size_t transition,
+      Complete complete);
+
+  void DisplayPath(unsigned int setid) const;
+  void DisplayConflict(const char *type, unsigned int terminal) const;
+};
+
+StateBuilder::StateBuilder(
+    const Grammar &grammar, LRTable &table, bool report, bool minimal)
+    : grammar(grammar), table(table), tables(grammar, &states),
+      itemSets(&states), backtrack(&states), kernels(&states),
+      kernelSizes(&states), report(report), minimal(minimal), cores(&states),
+      successors(&states), built(&states), grown(&states), queued(&states) {}
+
+template <typename Complete> void StateBuilder::Start(Complete complete) {
+  // the backtrack entry of state 0 is never used and only kept for offset
+  ItemSet kernel(&this->scratch);
+  TerminalSet startLookahead(this->grammar.terminals.size(), &this->scratch);
+  startLookahead.Set(0);
+  kernel.push_back(
+      {.ruleID = 0, .dotPosition = 0, .lookaheads = std::move(startLookahead)});
+  this->State(kernel, 0, {.type = Symbol::Type::Terminal, .id = 0}, complete);
+}
+
+template <typename Complete>
+unsigned int StateBuilder::State(
+    ItemSet &kernel, unsigned int from, Symbol symbol, Complete complete) {
+  if (this->minimal)
+    return this->MinimalState(kernel, from, symbol);
+  std::sort(kernel.begin(), kernel.end());
+  if (this->spill)
+    return this->spill->State(kernel);
+  auto found = this->kernels.find({kernel.data(), kernel.size()});
+  if (found != this->kernels.end())
+    return found->second;
+
+  const unsigned int id = this->itemSets.size();
+  const auto kernelSize = kernel.size();
+  complete(kernel);
+
+  auto &set = this->itemSets.emplace_back();
+  set.reserve(kernel.size());
+  for (const auto &item : kernel) {
+    set.push_back({
+        .ruleID = item.ruleID,
+        .dotPosition = item.dotPosition,
+        .lookaheads = TerminalSet(item.lookaheads, &this->states),
+    });
+  }
+  this->kernels.emplace(KernelKey{set.data(), kernelSize}, id);
+  this->kernelSizes.push_back(kernelSize);
+  this->backtrack.push_back({from, symbol});
+  this->table.actions.emplace_back();
+  this->table.goTo.emplace_back();
+  return id;
+}
+
+unsigned int StateBuilder::MinimalState(
+    ItemSet &kernel, unsigned int from, Symbol symbol) {
+  std::sort(kernel.begin(), kernel.end());
+  const auto h = CoreHash(kernel);
+  bool knownCore = false;
+  auto [candidate, last] = this->cores.equal_range(h);
+  for (; candidate != last; ++candidate) {
+    const auto state = candidate->second;
+    const auto &set = this->itemSets[state];
+    if (set.size() != kernel.size() ||
+        !std::equal(
+            set.begin(), set.end(), kernel.begin(),
+            [](const LRItem &a, const LRItem &b) {
+              return a.ruleID == b.ruleID && a.dotPosition == b.dotPosition;
+            }))
+      continue;
+    knownCore = true;
+    if (!WeaklyCompatible(set.data(), kernel.data(), kernel.size()))
+      continue;
+    if (!std::equal(set.begin(), set.end(), kernel.begin()))
+      ++this->merged;
+    this->Merge(state, kernel);
+    return state;
+  }
+
+  const unsigned int id = this->itemSets.size();
+  auto &set = this->itemSets.emplace_back();
+  set.reserve(kernel.size());
+  for (const auto &item : kernel) {
+    set.push_back({
+        .ruleID = item.ruleID,
+        .dotPosition = item.dotPosition,
+        .lookaheads = TerminalSet(item.lookaheads, &this->states),
+    });
+  }
+  this->cores.emplace(h, id);
+  this->distinctCores += !knownCore;
+  this->kernelSizes.push_back(kernel.size());
+  this->backtrack.push_back({from, symbol});
+  this->successors.emplace_back();
+  this->built.push_back(false);
+  this->queued.push_back(false);
+  this->table.actions.emplace_back();
+  this->table.goTo.emplace_back();
+  return id;
+}
+
+bool StateBuilder::Merge(unsigned int state, const ItemSet &kernel) {
+  auto &set = this->itemSets[state];
+  bool grew = false;
+  for (size_t i = 0; i < kernel.size(); ++i)
+    grew |= set[i].lookaheads.Merge(kernel[i].lookaheads);
+  if (grew && this->built[state] && !this->queued[state]) {
+    this->queued[state] = true;
+    this->grown.push_back(state);
+  }
+  return grew;
+}
+
+template <typename Complete>
+unsigned int StateBuilder::Target(
+    ItemSet &kernel, unsigned int from, Symbol symbol, size_t transition,
+    Complete complete) {
+  if (!this->minimal)
+    return this->State(kernel, from, symbol, complete);
+
+  auto &targets = this->successors[from];
+  if (transition < targets.size()) {
+    // the row is built again after the lookaheads grew, they flow on to the
+    // same target as its core did not change
+    std::sort(kernel.begin(), kernel.end());
+    this->Merge(targets[transition], kernel);
+    return targets[transition];
+  }
+  const auto target = this->State(kernel, from, symbol, complete);
+  // the deque may have grown, from is indexed again
+  this->successors[from].push_back(target);
+  return target;
+}
+
+void StateBuilder::Build(unsigned int state) {
+  this->scratch.Reset();
+  ItemSet set(&this->scratch);
+  for (const auto &item : this->itemSets[state]) {
+    set.push_back({
+        .ruleID = item.ruleID,
+        .dotPosition = item.dotPosition,
+        .lookaheads = TerminalSet(item.lookaheads, &this->scratch),
+    });
+  }
+  Closure(set, this->grammar, this->tables, &this->scratch);
+
+  if (this->minimal) {
+    if (this->built[state]) {
+      // found again while the row is built
+      std::erase_if(this->table.conflicts, [&](const LRConflict &conflict) {
+        return conflict.state == state;
+      });
+      ++this->rebuilt;
+    }
+    this->built[state] = true;
+    this->queued[state] = false;
+  }
+  this->AddRow(state, set, KeepKernel);
+}
+
+// provide example path on conflict
+void StateBuilder::DisplayPath(unsigned int setid) const {
+  auto &out = Out();
+  for (unsigned int i = setid; i != 0; i = this->backtrack[i].first) {
+    if (this->backtrack[i].second.id) {
+      out << " ← " << i << " ← ";
+      out.Color(ANSI_COLOR_MAGENTA);
+      this->backtrack[i].second.Display(this->grammar);
+      out.Color(ANSI_COLOR_RESET);
+    }
+  }
+  out << '\n';
+}
+
+void StateBuilder::Report(const LRConflict &conflict) const {
+  this->DisplayConflict(
+      conflict.type == LRConflict::Type::ShiftReduce ? "Shift-Reduce"
+                                                     : "Reduce-Reduce",
+      conflict.terminal);
+  this->DisplayPath(conflict.state);
+}
+
+// report a conflict found after reading up to the given terminal
+void StateBuilder::DisplayConflict(
+    const char *type, unsigned int terminal) const {
+  auto &out = Out();
+  out.Color(ANSI_COLOR_RED) << type << " conflict after reading (RTL):\n";
+  out.Color(ANSI_COLOR_MAGENTA) << this->grammar.terminals[terminal];
+  out.Color(ANSI_COLOR_RESET);
+}
+
+template <typename Complete>
+void StateBuilder::AddRow(
+    unsigned int setid, const ItemSet &set, Complete complete) {
+  const auto &grammar = this->grammar;
+  auto &table = this->table;
+  // the row is built apart as new states append rows to the table
+  auto &actions = this->actions;
+  auto &goTo = this->goTo;
+  actions.assign(grammar.terminals.size(), {LRAction::Type::Error, 0});
+  goTo.assign(grammar.nonTerminals.size(), 0);
+
+  // handle reduce
+  for (const auto &item : set) {
+    auto next = item.GetNextSymbol(grammar);
+    if (next.type != Symbol::Type::Terminal || next.id != 0)
+      continue;
+
+    item.lookaheads.ForEach([&](unsigned int endTerminal) {
+      auto &action = actions[endTerminal];
+      if (action.type == LRAction::Type::Error) {
+        if (item.ruleID == 0) {
+          action = {.type = LRAction::Type::Accept, .num = item.ruleID};
+        } else {
+          action = {.type = LRAction::Type::Reduce, .num = item.ruleID};
+        }
+      } else {
+        switch (action.type) {
+        case LRAction::Type::Shift:
+          if (this->report)
+            this->DisplayConflict("Shift-Reduce", endTerminal);
+          table.conflicts.push_back({
+              .type = LRConflict::Type::ShiftReduce,
+              .resolution = LRConflict::Resolution::Unresolved,
+              .state = setid,
+              .terminal = endTerminal,
+              .rule = item.ruleID,
+              .other = action.num,
+          });
+          break;
+        case LRAction::Type::Reduce:
+          if (this->report)
+            this->DisplayConflict("Reduce-Reduce", endTerminal);
+          table.conflicts.push_back({
+              .type = LRConflict::Type::ReduceReduce,
+              .resolution = LRConflict::Resolution::Unresolved,
+              .state = setid,
+              .terminal = endTerminal,
+              .rule = action.num,
+              .other = item.ruleID,
+          });
+          break;
+        default:
+          break;
         }
+
+        if (this->report)
+          this->DisplayPath(setid);
       }
+    });
+  }
+
+  // group the items by the symbol after the dot, non-terminals before
+  // terminals and each in ascending order as states are numbered that way
+  const unsigned int nonTerminalCount = grammar.nonTerminals.size();
+  std::pmr::vector<std::pair<unsigned int, unsigned int>> transitions(
+      &this->scratch);
+  for (unsigned int i = 0; i < set.size(); ++i) {
+    auto next = set[i].GetNextSymbol(grammar);
+    if (next.type == Symbol::Type::NonTerminal) {
+      transitions.push_back({next.id, i});
+    } else if (next.id != 0) {
+      transitions.push_back({nonTerminalCount + next.id, i});
+    }
+  }
+  std::sort(transitions.begin(), transitions.end());
+
+  size_t transition = 0;
+  for (size_t begin = 0, end; begin < transitions.size(); begin = end) {
+    const auto key = transitions[begin].first;
+    for (end = begin; end < transitions.size(); ++end) {
+      if (transitions[end].first != key)
+        break;
+    }
+
+    ItemSet newSet(&this->scratch);
+    newSet.reserve(end - begin);
+    for (auto i = begin; i < end; ++i) {
+      const auto &item = set[transitions[i].second];
+      newSet.push_back({
+          .ruleID = item.ruleID,
+          .dotPosition = item.dotPosition + 1,
+          .lookaheads = TerminalSet(item.lookaheads, &this->scratch),
+      });
     }
 
     // handle non-terminal GOTOs
-    for (unsigned int nonTerminal = 1;
-         nonTerminal < grammar.nonTerminals.size(); ++nonTerminal) {
-      std::vector<LRItem> newSet;
+    if (key < nonTerminalCount) {
+      auto target = this->Target(
+          newSet, setid, {.type = Symbol::Type::NonTerminal, .id = key},
+          transition++, complete);
+      goTo[key] = target;
+      continue;
+    }
 
-      for (const auto &item : set) {
-        auto next = item.GetNextSymbol(grammar);
-        if (next.type == Symbol::Type::NonTerminal && next.id == nonTerminal) {
-          auto newitem = item;
-          newitem.dotPosition += 1;
-          newSet.push_back(newitem);
+    // handle terminal GOTOs
+    const unsigned int terminal = key - nonTerminalCount;
+    auto target = this->Target(
+        newSet, setid, {.type = Symbol::Type::Terminal, .id = terminal},
+        transition++, complete);
+    if (actions[terminal].type == LRAction::Type::Error) {
+      actions[terminal] = {.type = LRAction::Type::Shift, .num = target};
+    } else if (actions[terminal].type == LRAction::Type::Reduce) {
+      auto rule = actions[terminal].num;
+      LRConflict conflict = {
+          .type = LRConflict::Type::ShiftReduce,
+          .resolution = ResolveShiftReduce(grammar, rule, terminal),
+          .state = setid,
+          .terminal = terminal,
+          .rule = rule,
+          .other = target,
+      };
+      table.conflicts.push_back(conflict);
+
+      switch (conflict.resolution) {
+      case LRConflict::Resolution::Shift:
+        actions[terminal] = {.type = LRAction::Type::Shift, .num = target};
+        break;
+      case LRConflict::Resolution::Error:
+        actions[terminal] = {.type = LRAction::Type::Error, .num = 0};
+        break;
+      case LRConflict::Resolution::Reduce:
+        break;
+      case LRConflict::Resolution::Unresolved:
+        if (this->report) {
+          this->DisplayConflict("Shift-Reduce", terminal);
+          this->DisplayPath(setid);
         }
+        break;
       }
+    }
+  }
 
-      if (newSet.size() == 0)
-        continue;
+  if (this->spill) {
+    this->spill->WriteRow(actions, goTo);
+  } else {
+    // the previous rows are empty or rebuilt ones, their storage is reused
+    table.actions[setid].swap(actions);
+    table.goTo[setid].swap(goTo);
+  }
+}
 
-      Closure(newSet, grammar);
-      auto targetSet = std::find(itemSets.begin(), itemSets.end(), newSet);
+} // namespace
 
-      if (targetSet == itemSets.end()) {
-        table.goTo[setid][nonTerminal] = itemSets.size();
+LRTable GenerateTable(
+    const Grammar &grammar, TableCache *cache, RebuildStats *stats,
+    bool display) {
+  PROFILE_FUNC;
+  LRTable table;
+  StateBuilder builder(grammar, table, display);
 
-        if (!benchmark_mode) {
-          std::cout << 'I' << itemSets.size() << ':' << std::endl;
-          for (const auto &item : newSet) {
-            item.Display(grammar);
-          }
-        }
+  std::optional<GrammarDiff> diff;
+  std::optional<ClosureReuse> reuse;
+  if (cache) {
+    diff.emplace(grammar, *cache);
+    if (diff->compatible)
+      reuse.emplace(grammar, *cache, *diff);
+  }
+  unsigned int closuresReused = 0;
+  unsigned int closuresComputed = 0;
 
-        itemSets.push_back(newSet);
-        backtrack.push_back({
-            setid,
-            {.type = Symbol::Type::NonTerminal, .id = nonTerminal},
-        });
-      } else {
-        table.goTo[setid][nonTerminal] = targetSet - itemSets.begin();
+  if (display && grammar.rules.size() == 0) {
+    Out() << "No rules found in grammar\n";
+  }
+
+  // the closure is computed as soon as a state is found and kept with it
+  auto complete = [&](ItemSet &kernel) {
+    if (reuse && reuse->Complete(kernel)) {
+      ++closuresReused;
+    } else {
+      Closure(kernel, grammar, builder.tables, &builder.scratch);
+      ++closuresComputed;
+    }
+    if (display) {
+      Out() << 'I' << builder.itemSets.size() << ":\n";
+      for (const auto &item : kernel) {
+        item.Display(grammar);
       }
     }
+  };
+  builder.Start(complete);
 
-    // handle terminal GOTOs
-    for (unsigned int terminal = 1; terminal < grammar.terminals.size();
-         ++terminal) {
-      std::vector<LRItem> newSet;
+  // calculate next states
+  for (unsigned int setid = 0; setid < builder.itemSets.size(); ++setid) {
+    PROFILE_SCOPE("Item Set");
+    builder.scratch.Reset();
+    builder.AddRow(setid, builder.itemSets[setid], complete);
+  }
 
+  Out().Flush();
+
+  if (stats) {
+    stats->closuresReused = closuresReused;
+    stats->closuresComputed = closuresComputed;
+  }
+  if (cache) {
+    reuse.reset();
+    cache->terminals = grammar.terminals;
+    cache->nonTerminals = grammar.nonTerminals;
+    cache->rules = grammar.rules;
+    cache->first = grammar.first;
+    cache->kernelSizes.assign(
+        builder.kernelSizes.begin(), builder.kernelSizes.end());
+    cache->itemOffsets.clear();
+    cache->items.clear();
+    cache->lookaheads.clear();
+    for (const auto &set : builder.itemSets) {
+      cache->itemOffsets.push_back(cache->items.size());
       for (const auto &item : set) {
-        auto next = item.GetNextSymbol(grammar);
-        if (next.type == Symbol::Type::Terminal && next.id == terminal) {
-          auto newitem = item;
-          newitem.dotPosition += 1;
-          newSet.push_back(newitem);
-        }
+        cache->items.push_back({item.ruleID, item.dotPosition});
+        cache->lookaheads.insert(
+            cache->lookaheads.end(), item.lookaheads.words.begin(),
+            item.lookaheads.words.end());
       }
+    }
+    cache->itemOffsets.push_back(cache->items.size());
+  }
+  return table;
+}
 
-      if (newSet.size() == 0)
-        continue;
+LRTable GenerateMinimalTable(
+    const Grammar &grammar, MinimalStats *stats, bool display) {
+  PROFILE_FUNC;
+  LRTable table;
+  // conflicts of rows that are built again are reported once at the end
+  StateBuilder builder(grammar, table, false, true);
 
-      Closure(newSet, grammar);
-      auto targetSet = std::find(itemSets.begin(), itemSets.end(), newSet);
-      if (targetSet == itemSets.end()) { // Not found
-        if (table.actions[setid][terminal].type == LRAction::Type::Error) {
-          table.actions[setid][terminal] = {
-              .type = LRAction::Type::Shift, .num = itemSets.size()};
-        } else if (
-            table.actions[setid][terminal].type == LRAction::Type::Reduce) {
-          std::cout << ANSI_COLOR_RED
-                    << "Shift-Reduce conflict after reading (RTL):" << std::endl
-                    << ANSI_COLOR_MAGENTA << grammar.terminals[terminal]
-                    << ANSI_COLOR_RESET;
-
-          // provide example path on conflict
-          for (unsigned int i = setid; i != 0; i = backtrack[i].first) {
-            if (backtrack[i].second.id) {
-              std::cout << " ← " << i << " ← " << ANSI_COLOR_MAGENTA;
-              backtrack[i].second.Display(grammar);
-              std::cout << ANSI_COLOR_RESET;
-            }
+  if (display && grammar.rules.size() == 0) {
+    Out() << "No rules found in grammar\n";
+  }
+
+  // new states are built in the order they are found, a state whose
+  // lookaheads grew after it was built is built again first
+  builder.Start(KeepKernel);
+  for (unsigned int next = 0;;) {
+    PROFILE_SCOPE("Item Set");
+    unsigned int state;
+    if (!builder.grown.empty()) {
+      state = builder.grown.back();
+      builder.grown.pop_back();
+    } else if (next < builder.itemSets.size()) {
+      state = next++;
+    } else {
+      break;
+    }
+    builder.Build(state);
+  }
+
+  if (display) {
+    // the final lookaheads are only known now
+    for (unsigned int state = 0; state < builder.itemSets.size(); ++state) {
+      builder.scratch.Reset();
+      ItemSet set(&builder.scratch);
+      for (const auto &item : builder.itemSets[state]) {
+        set.push_back({
+            .ruleID = item.ruleID,
+            .dotPosition = item.dotPosition,
+            .lookaheads = TerminalSet(item.lookaheads, &builder.scratch),
+        });
+      }
+      Closure(set, grammar, builder.tables, &builder.scratch);
+      Out() << 'I' << state << ":\n";
+      for (const auto &item : set)
+        item.Display(grammar);
+    }
+  }
+
+  // rows built again may have found their conflicts in a different order
+  std::stable_sort(
+      table.conflicts.begin(), table.conflicts.end(),
+      [](const LRConflict &a, const LRConflict &b) {
+        return a.state < b.state;
+      });
+  if (display) {
+    for (const auto &conflict : table.conflicts) {
+      if (conflict.resolution == LRConflict::Resolution::Unresolved)
+        builder.Report(conflict);
+    }
+  }
+  Out().Flush();
+  if (stats) {
+    stats->cores = builder.distinctCores;
+    stats->merged = builder.merged;
+    stats->rebuilt = builder.rebuilt;
+  }
+  return table;
+}
+
+Error GenerateSpilledTable(
+    const Grammar &grammar, const std::string &filename,
+    const SpillOptions &options, SpillStats *stats) {
+  PROFILE_FUNC;
+  // the conflicts are kept in memory until they are appended
+  LRTable table;
+  StateBuilder builder(grammar, table, false);
+  KernelSpill spill(
+      grammar.terminals.size(),
+      std::clamp<size_t>(options.memoryCap / 16, 1 << 16, 1 << 22));
+  if (!spill.Open(options.directory, filename)) {
+    return {
+        Error::Code::WriteFailed,
+        "Failed to create the table file " + filename +
+            " or an item set file in " + options.directory};
+  }
+  builder.spill = &spill;
+
+  size_t memory = 0;
+  auto fail = [&](Error error) {
+    unlink(filename.c_str());
+    return error;
+  };
+
+  builder.Start(KeepKernel);
+  for (unsigned int state = 0; state < spill.States(); ++state) {
+    PROFILE_SCOPE("Item Set");
+    builder.scratch.Reset();
+    ItemSet set(&builder.scratch);
+    spill.Kernel(state, set, builder.scratch);
+    Closure(set, grammar, builder.tables, &builder.scratch);
+    builder.AddRow(state, set, KeepKernel);
+
+    memory = std::max(
+        memory, builder.states.Allocated() + builder.scratch.Allocated() +
+                    spill.Bytes() +
+                    table.conflicts.capacity() * sizeof(LRConflict) +
+                    builder.actions.capacity() * sizeof(LRAction) +
+                    builder.goTo.capacity() * sizeof(unsigned int));
+    if (memory > options.memoryCap) {
+      return fail(
+          {Error::Code::MemoryCap,
+           "The table construction needs more than " +
+               std::to_string(options.memoryCap) + " bytes at state " +
+               std::to_string(state) + ", " +
+               std::to_string(spill.States()) + " states found so far"});
+    }
+    if (spill.Failed())
+      break;
+  }
+
+  if (!spill.Finish(
+          table, grammar.terminals.size(), grammar.nonTerminals.size())) {
+    return fail(
+        {Error::Code::WriteFailed,
+         "Failed to write the table file " + filename + " or an item set "
+         "file in " + options.directory});
+  }
+  if (stats) {
+    stats->states = spill.States();
+    stats->itemSetBytes = spill.ItemSetBytes();
+    stats->itemSetReads = spill.itemSetReads;
+    stats->memory = memory;
+  }
+  return {};
+}
+
+MappedTable::MappedTable() = default;
+MappedTable::~MappedTable() = default;
+MappedTable::MappedTable(MappedTable &&other) noexcept = default;
+MappedTable &MappedTable::operator=(MappedTable &&other) noexcept = default;
+
+Error MappedTable::Open(const std::string &filename, MappedTable &table) {
+  PROFILE_FUNC;
+  table = MappedTable();
+  auto file = std::make_unique<MappedFile>(filename.c_str());
+  if (!file->IsOpen())
+    return {Error::Code::OpenFailed, "Failed to open table file " + filename};
+
+  // the rows are trusted, only the layout is checked so that they are not
+  // all read from disk here
+  MappedHeader header;
+  const auto invalid = Error{
+      Error::Code::InvalidInput, "Not a valid table file: " + filename};
+  if (file->Size() < sizeof(header))
+    return invalid;
+  std::copy_n(file->Data(), sizeof(header), reinterpret_cast<char *>(&header));
+  const uint64_t rowSize = uint64_t(header.terminals) + header.nonTerminals;
+  if (!std::equal(
+          std::begin(MappedMagic), std::end(MappedMagic), header.magic) ||
+      header.conflictOffset !=
+          sizeof(header) + uint64_t(header.states) * rowSize * 4 ||
+      header.conflictOffset + uint64_t(header.conflicts) *
+                                  sizeof(MappedConflict) !=
+          file->Size())
+    return invalid;
+
+  table.rows =
+      reinterpret_cast<const uint32_t *>(file->Data() + sizeof(header));
+  table.rowSize = rowSize;
+  table.states = header.states;
+  table.terminals = header.terminals;
+  table.nonTerminals = header.nonTerminals;
+  for (uint32_t i = 0; i < header.conflicts; ++i) {
+    MappedConflict record;
+    std::copy_n(
+        file->Data() + header.conflictOffset + i * sizeof(record),
+        sizeof(record), reinterpret_cast<char *>(&record));
+    table.conflicts.push_back({
+        .type = LRConflict::Type(record.type),
+        .resolution = LRConflict::Resolution(record.resolution),
+        .state = record.state,
+        .terminal = record.terminal,
+        .rule = record.rule,
+        .other = record.other,
+    });
+  }
+  table.file = std::move(file);
+  return {};
+}
+
+size_t MappedTable::FileBytes() const {
+  return this->file ? this->file->Size() : 0;
+}
+
+LRTable MappedTable::Load() const {
+  LRTable table;
+  table.actions.resize(this->states);
+  table.goTo.resize(this->states);
+  for (unsigned int s = 0; s < this->states; ++s) {
+    table.actions[s].reserve(this->terminals);
+    for (unsigned int t = 0; t < this->terminals; ++t)
+      table.actions[s].push_back(this->Action(s, t));
+    table.goTo[s].reserve(this->nonTerminals);
+    for (unsigned int nt = 0; nt < this->nonTerminals; ++nt)
+      table.goTo[s].push_back(this->GoTo(s, nt));
+  }
+  table.conflicts = this->conflicts;
+  return table;
+}
+
+struct LazyStates {
+  LazyStates(const Grammar &grammar, LRTable &table)
+      : builder(grammar, table, false) {}
+
+  StateBuilder builder;
+};
+
+LazyTable::LazyTable(const Grammar &grammar)
+    : states(std::make_unique<LazyStates>(grammar, this->table)) {
+  PROFILE_FUNC;
+  this->states->builder.Start(KeepKernel);
+}
+
+LazyTable::~LazyTable() = default;
+
+void LazyTable::Expand(unsigned int state) {
+  if (this->Visited(state))
+    return;
+  PROFILE_FUNC;
+  this->states->builder.Build(state);
+  ++this->visited;
+}
+
+size_t LazyTable::ItemSetBytes() const {
+  return this->states->builder.states.Allocated();
+}
+
+static bool IsUnitRule(const Grammar &grammar, unsigned long rule) {
+  const auto &rhs = grammar.rules[rule].second;
+  return rule != 0 && rhs.size() == 1 &&
+         rhs[0].type == Symbol::Type::NonTerminal;
+}
+
+unsigned int EliminateUnitRules(LRTable &table, const Grammar &grammar) {
+  PROFILE_FUNC;
+  constexpr unsigned int NoState = ~0u;
+  const auto originalStates = table.actions.size();
+
+  // A state q = goTo[p][B] that reduces A → B on some terminal would pop back
+  // to p and continue in goTo[p][A]. The replacement for q takes those actions
+  // from goTo[p][A] and keeps its own elsewhere, so error detection is not
+  // delayed. Rows are identified by q and the state used for every terminal.
+  std::map<std::vector<unsigned int>, unsigned int> replacements;
+
+  enum class Status : char { Pending, Active, Done };
+  std::vector<std::vector<Status>> status(
+      table.goTo.size(),
+      std::vector<Status>(grammar.nonTerminals.size(), Status::Pending));
+
+  std::function<unsigned int(unsigned int, unsigned int)> resolve =
+      [&](unsigned int p, unsigned int nt) -> unsigned int {
+    const unsigned int q = table.goTo[p][nt];
+    if (q == 0 || status[p][nt] != Status::Pending) {
+      // no transition, already resolved or a cycle of unit rules
+      return q;
+    }
+    status[p][nt] = Status::Active;
+
+    std::vector<unsigned int> key{q};
+    bool unitReduce = false;
+    for (unsigned int t = 0; t < grammar.terminals.size(); ++t) {
+      const auto action = table.actions[q][t];
+      unsigned int target = NoState;
+      if (action.type == LRAction::Type::Reduce &&
+          IsUnitRule(grammar, action.num)) {
+        target = resolve(p, grammar.rules[action.num].first);
+        unitReduce = true;
+      }
+      key.push_back(target);
+    }
+
+    unsigned int result = q;
+    if (unitReduce) {
+      auto found = replacements.find(key);
+      if (found != replacements.end()) {
+        result = found->second;
+      } else {
+        auto actions = table.actions[q];
+        auto goTo = table.goTo[q];
+        std::vector<unsigned int> targets;
+        bool compatible = true;
+
+        for (unsigned int t = 0; t < grammar.terminals.size(); ++t) {
+          const auto target = key[t + 1];
+          if (target == NoState)
+            continue;
+          if (target == 0) { // missing goTo, keep the reduction
+            compatible = false;
+            break;
+          }
+          actions[t] = table.actions[target][t];
+          if (std::find(targets.begin(), targets.end(), target) ==
+              targets.end()) {
+            targets.push_back(target);
           }
-          std::cout << std::endl;
         }
 
-        if (!benchmark_mode) {
-          std::cout << 'I' << itemSets.size() << ':' << std::endl;
-          for (const auto &item : newSet) {
-            item.Display(grammar);
+        // the new state continues as either symbol, so it needs both GOTOs
+        for (auto target : targets) {
+          for (unsigned int col = 1; col < goTo.size() && compatible; ++col) {
+            const auto next = table.goTo[target][col];
+            if (next == 0)
+              continue;
+            if (goTo[col] != 0 && goTo[col] != next)
+              compatible = false;
+            goTo[col] = next;
           }
         }
 
-        itemSets.push_back(newSet);
-        backtrack.push_back({
-            setid,
-            {.type = Symbol::Type::Terminal, .id = terminal},
-        });
-      } else {
-        LRAction new_action = {
-            .type = LRAction::Type::Shift,
-            .num = (unsigned int)(targetSet - itemSets.begin()),
-        };
-        if (table.actions[setid][terminal].type == LRAction::Type::Error) {
-          table.actions[setid][terminal] = new_action;
-        } else if (
-            table.actions[setid][terminal].type == LRAction::Type::Reduce) {
-          std::cout << ANSI_COLOR_RED
-                    << "Shift-Reduce conflict after reading (RTL):" << std::endl
-                    << ANSI_COLOR_MAGENTA << grammar.terminals[terminal]
-                    << ANSI_COLOR_RESET;
-
-          // provide example path on conflict
-          for (unsigned int i = setid; i != 0; i = backtrack[i].first) {
-            if (backtrack[i].second.id) {
-              std::cout << " ← " << i << " ← " << ANSI_COLOR_MAGENTA;
-              backtrack[i].second.Display(grammar);
-              std::cout << ANSI_COLOR_RESET;
-            }
+        if (compatible) {
+          result = NoState;
+          for (auto target : targets) {
+            if (table.actions[target] == actions && table.goTo[target] == goTo)
+              result = target;
+          }
+          if (result == NoState) {
+            result = table.actions.size();
+            table.actions.push_back(std::move(actions));
+            table.goTo.push_back(std::move(goTo));
+            status.push_back(std::vector<Status>(
+                grammar.nonTerminals.size(), Status::Pending));
           }
-          std::cout << std::endl;
         }
+        replacements[key] = result;
       }
     }
+
+    table.goTo[p][nt] = result;
+    status[p][nt] = Status::Done;
+    return result;
+  };
+
+  for (unsigned int p = 0; p < table.goTo.size(); ++p) {
+    for (unsigned int nt = 1; nt < grammar.nonTerminals.size(); ++nt) {
+      resolve(p, nt);
+    }
   }
 
-  return table;
+  return table.actions.size() - originalStates;
+}
+
+TableProfile::TableProfile(const LRTable &table)
+    : terminals(table.actions.empty() ? 0 : table.actions[0].size()),
+      nonTerminals(table.goTo.empty() ? 0 : table.goTo[0].size()),
+      actions(table.actions.size() * this->terminals, 0),
+      goTo(table.goTo.size() * this->nonTerminals, 0) {}
+
+uint64_t TableProfile::StateVisits(unsigned int state) const {
+  uint64_t visits = 0;
+  for (size_t t = 0; t < this->terminals; ++t)
+    visits += this->actions[state * this->terminals + t];
+  for (size_t nt = 0; nt < this->nonTerminals; ++nt)
+    visits += this->goTo[state * this->nonTerminals + nt];
+  return visits;
+}
+
+TableLayout ProfileLayout(
+    const LRTable &table, const TableProfile &profile, bool columns) {
+  PROFILE_FUNC;
+  const unsigned int states = table.actions.size();
+  TableLayout layout;
+  layout.states.reserve(states);
+  std::vector<bool> placed(states, false);
+
+  // the most used shift or goTo out of a state into one not placed yet
+  auto hottestSuccessor = [&](unsigned int state) {
+    unsigned int best = 0;
+    uint64_t bestCount = 0;
+    for (size_t t = 0; t < profile.terminals; ++t) {
+      const auto &action = table.actions[state][t];
+      const auto count = profile.actions[state * profile.terminals + t];
+      if (action.type == LRAction::Type::Shift && count > bestCount &&
+          !placed[action.num]) {
+        best = action.num;
+        bestCount = count;
+      }
+    }
+    for (size_t nt = 0; nt < profile.nonTerminals; ++nt) {
+      const auto target = table.goTo[state][nt];
+      const auto count = profile.goTo[state * profile.nonTerminals + nt];
+      if (target != 0 && count > bestCount && !placed[target]) {
+        best = target;
+        bestCount = count;
+      }
+    }
+    return best; // 0 is placed first, so it means none
+  };
+  auto chain = [&](unsigned int state) {
+    for (; !placed[state]; state = hottestSuccessor(state)) {
+      placed[state] = true;
+      layout.states.push_back(state);
+    }
+  };
+
+  std::vector<uint64_t> visits(states);
+  std::vector<unsigned int> visited;
+  for (unsigned int s = 0; s < states; ++s) {
+    visits[s] = profile.StateVisits(s);
+    if (visits[s] != 0)
+      visited.push_back(s);
+  }
+  std::stable_sort(visited.begin(), visited.end(), [&](auto a, auto b) {
+    return visits[a] > visits[b];
+  });
+  if (states != 0)
+    chain(0);
+  for (auto s : visited)
+    chain(s);
+  for (unsigned int s = 0; s < states; ++s) {
+    if (!placed[s])
+      layout.states.push_back(s);
+  }
+
+  layout.terminals.resize(profile.terminals);
+  std::iota(layout.terminals.begin(), layout.terminals.end(), 0);
+  if (columns && profile.terminals > 1) {
+    std::vector<uint64_t> lookups(profile.terminals, 0);
+    for (size_t i = 0; i < profile.actions.size(); ++i)
+      lookups[i % profile.terminals] += profile.actions[i];
+    std::stable_sort(
+        layout.terminals.begin() + 1, layout.terminals.end(),
+        [&](auto a, auto b) { return lookups[a] > lookups[b]; });
+  }
+  return layout;
+}
+
+LRTable PermuteTable(const LRTable &table, const TableLayout &layout) {
+  PROFILE_FUNC;
+  std::vector<unsigned int> newState(layout.states.size());
+  for (unsigned int s = 0; s < layout.states.size(); ++s)
+    newState[layout.states[s]] = s;
+  std::vector<unsigned int> newTerminal(layout.terminals.size());
+  for (unsigned int t = 0; t < layout.terminals.size(); ++t)
+    newTerminal[layout.terminals[t]] = t;
+
+  LRTable permuted;
+  permuted.actions.reserve(table.actions.size());
+  permuted.goTo.reserve(table.goTo.size());
+  for (auto old : layout.states) {
+    const auto &actions = table.actions[old];
+    auto &row = permuted.actions.emplace_back(actions.size());
+    for (unsigned int t = 0; t < row.size(); ++t) {
+      row[t] = actions[layout.terminals[t]];
+      if (row[t].type == LRAction::Type::Shift)
+        row[t].num = newState[row[t].num];
+    }
+    // a missing goTo stays 0 as state 0 keeps its number
+    auto &goTo = permuted.goTo.emplace_back(table.goTo[old]);
+    for (auto &target : goTo)
+      target = newState[target];
+  }
+
+  permuted.conflicts = table.conflicts;
+  for (auto &conflict : permuted.conflicts) {
+    conflict.state = newState[conflict.state];
+    conflict.terminal = newTerminal[conflict.terminal];
+    if (conflict.type == LRConflict::Type::ShiftReduce)
+      conflict.other = newState[conflict.other];
+  }
+  return permuted;
 }
 
 } // namespace lrone
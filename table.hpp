@@ -3,16 +3,22 @@
 
 #include "grammar.hpp"
 
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace lrone {
 
+// An LR(1) item core together with all of its lookahead terminals
 struct LRItem {
   unsigned int ruleID;
   unsigned int dotPosition;
-  unsigned int endTerminal;
+  TerminalSet lookaheads;
 
   bool operator==(const LRItem &rhs) const;
+  bool operator<(const LRItem &rhs) const; // orders by core only
+  size_t Hash() const;
 
   Symbol GetNextSymbol(const Grammar &grammar) const;
   void Display(const Grammar &grammar) const;
@@ -25,14 +31,256 @@ struct LRAction {
   bool operator==(const LRAction &rhs) const;
 };
 
+struct LRConflict {
+  enum class Type { ShiftReduce, ReduceReduce } type;
+  // what ended up in the table, Unresolved keeps the first action
+  enum class Resolution { Unresolved, Shift, Reduce, Error } resolution;
+  unsigned int state;
+  unsigned int terminal;
+  unsigned long rule;  // rule of the (first) reduction
+  unsigned long other; // shift target or the other rule
+};
+
+// Heap bytes held by a parsing table. Every row of actions and goTo is a
+// separate allocation, rowHeaders are the vectors pointing to them.
+struct LRTableMemory {
+  size_t actions;
+  size_t goTo;
+  size_t rowHeaders;
+  size_t conflicts;
+  size_t rows;
+
+  size_t Total() const {
+    return this->actions + this->goTo + this->rowHeaders + this->conflicts;
+  }
+};
+
 struct LRTable {
   std::vector<std::vector<LRAction>> actions;
   std::vector<std::vector<unsigned int>> goTo;
+  std::vector<LRConflict> conflicts;
 
   void Display(const Grammar &grammar);
-  void WriteCSV(const char *filename, const Grammar &grammar);
+  void DisplayConflicts(const Grammar &grammar);
+  // false if the file could not be created
+  bool WriteCSV(const char *filename, const Grammar &grammar);
+  bool WriteJSON(const char *filename, const Grammar &grammar);
+  LRTableMemory MemoryUsage() const;
+};
+
+// Grammar, FIRST sets and item sets of a previous build, kept to rebuild the
+// table after the grammar was edited
+struct TableCache {
+  std::vector<std::string> terminals;
+  std::vector<std::string> nonTerminals;
+  std::vector<Grammar::Rule> rules;
+  std::vector<std::vector<unsigned int>> first;
+
+  // closure of every state stored flat, state i owns the items from
+  // itemOffsets[i] to itemOffsets[i + 1] and its sorted kernel comes first
+  struct Item {
+    uint32_t rule;
+    uint32_t dot;
+  };
+  std::vector<uint32_t> itemOffsets;
+  std::vector<uint32_t> kernelSizes;
+  std::vector<Item> items;
+  // lookahead words of all items, (terminals + 63) / 64 per item
+  std::vector<uint64_t> lookaheads;
+
+  // false if the file is missing or not a cache of this version
+  bool Load(const char *filename);
+  bool Save(const char *filename) const;
+};
+
+struct RebuildStats {
+  // same terminals and non-terminals only extended, otherwise everything
+  // is computed again
+  bool compatible;
+  unsigned int changedNonTerminals; // with a different list of rules
+  unsigned int firstReused;
+  unsigned int firstComputed;
+  unsigned int closuresReused;
+  unsigned int closuresComputed;
+};
+
+// Calculate FIRST like Grammar::Calculate, taking the sets that do not depend
+// on changed rules from the cache
+RebuildStats CalculateIncremental(Grammar &grammar, const TableCache &cache);
+
+// With a cache the closures of kernels that neither reach changed rules nor
+// depend on changed FIRST sets are copied from it, the table is the same as
+// without one. The cache is replaced by this build afterwards. With display
+// the item sets and the conflicts are printed as they are found.
+LRTable GenerateTable(
+    const Grammar &grammar, TableCache *cache = nullptr,
+    RebuildStats *stats = nullptr, bool display = false);
+
+struct MinimalStats {
+  unsigned int cores;   // distinct cores, the number of LALR(1) states
+  unsigned int merged;  // kernels added to a state with other lookaheads
+  unsigned int rebuilt; // rows built again after their lookaheads grew
+};
+
+// Minimal LR(1) table: a state found with the core of an existing one is
+// merged into it when the two are weakly compatible (Pager), which cannot
+// add conflicts. The table accepts the same inputs as the canonical one with
+// close to the number of LALR(1) states, errors are still detected before
+// the terminal is shifted. States are numbered in the order they are found.
+LRTable GenerateMinimalTable(
+    const Grammar &grammar, MinimalStats *stats = nullptr,
+    bool display = false);
+
+struct SpillOptions {
+  // bytes the construction may hold in memory
+  size_t memoryCap;
+  // where the item sets are spilled, the file is removed when done
+  std::string directory = "/tmp";
+};
+
+struct SpillStats {
+  unsigned int states;
+  // item set bytes written to and read back from disk, kernels are read
+  // again to tell states with the same fingerprint apart
+  uint64_t itemSetBytes;
+  uint64_t itemSetReads;
+  // most bytes held by the construction at once, within the cap
+  size_t memory;
+};
+
+// Canonical LR(1) table built under a memory cap and written to a file that
+// MappedTable opens. Found states keep only a fingerprint of their kernel in
+// memory, the kernels are spilled to disk until their rows are built and
+// every row is written to the file when it is done. The table is the same as
+// GenerateTable builds. Fails with Error::Code::MemoryCap once the
+// fingerprints, closure tables and the state being built need more than the
+// cap.
+Error GenerateSpilledTable(
+    const Grammar &grammar, const std::string &filename,
+    const SpillOptions &options, SpillStats *stats = nullptr);
+
+class MappedFile;
+
+// Parsing table in a file written by GenerateSpilledTable, mapped read-only
+// so only the rows a parse reaches are read from disk. The row of a state
+// holds an action per terminal packed into 32 bits, the type in the lowest
+// two bits and the target state or rule above them, followed by its goTo
+// entries.
+class MappedTable {
+public:
+  MappedTable();
+  ~MappedTable();
+  MappedTable(MappedTable &&other) noexcept;
+  MappedTable &operator=(MappedTable &&other) noexcept;
+
+  // the file can be removed once it is open
+  static Error Open(const std::string &filename, MappedTable &table);
+
+  inline LRAction Action(unsigned int state, unsigned int terminal) const {
+    const uint32_t packed = this->rows[state * this->rowSize + terminal];
+    return {LRAction::Type(packed & 3), packed >> 2};
+  }
+  inline unsigned int GoTo(unsigned int state, unsigned int nonTerminal) const {
+    return this->rows[state * this->rowSize + this->terminals + nonTerminal];
+  }
+
+  unsigned int States() const { return this->states; }
+  unsigned int Terminals() const { return this->terminals; }
+  unsigned int NonTerminals() const { return this->nonTerminals; }
+  const std::vector<LRConflict> &Conflicts() const { return this->conflicts; }
+  size_t FileBytes() const;
+
+  // copy of the whole table in memory, to display or export it
+  LRTable Load() const;
+
+private:
+  std::unique_ptr<MappedFile> file;
+  const uint32_t *rows = nullptr;
+  size_t rowSize = 0;
+  unsigned int states = 0;
+  unsigned int terminals = 0;
+  unsigned int nonTerminals = 0;
+  std::vector<LRConflict> conflicts;
+};
+
+struct LazyStates;
+
+// Parsing table whose rows are built the first time the parser reaches a
+// state. Only the kernels of the states found so far are kept, the closure
+// of a state is computed when its row is built. States are numbered in the
+// order they are found, so the numbers differ from GenerateTable.
+class LazyTable {
+public:
+  explicit LazyTable(const Grammar &grammar);
+  ~LazyTable();
+  LazyTable(const LazyTable &) = delete;
+  LazyTable &operator=(const LazyTable &) = delete;
+
+  // build the rows of a state unless it was visited before
+  void Expand(unsigned int state);
+  bool Visited(unsigned int state) const {
+    return !this->table.actions[state].empty();
+  }
+
+  // states whose rows are built, out of the states found as their targets
+  unsigned int StatesVisited() const { return this->visited; }
+  unsigned int StatesFound() const { return this->table.actions.size(); }
+  // heap bytes of the kernels and lookup structures, rows are in table
+  size_t ItemSetBytes() const;
+
+  // rows of states that were not visited yet are empty
+  LRTable table;
+
+private:
+  std::unique_ptr<LazyStates> states;
+  unsigned int visited = 0;
 };
 
-LRTable GenerateTable(const Grammar &grammar);
+// Bypass reductions by unit rules (A → B) by redirecting the goTo entry on B
+// to a state that already behaves as if B was reduced to A. Such reductions
+// are no longer performed by the parser. Returns the number of added states.
+unsigned int EliminateUnitRules(LRTable &table, const Grammar &grammar);
+
+// How often the parses of a corpus used each cell of a parsing table, counted
+// by ParseWith<ProfiledParse<...>>. The cells are stored row after row.
+struct TableProfile {
+  TableProfile() = default;
+  explicit TableProfile(const LRTable &table);
+
+  inline void CountAction(unsigned int state, unsigned int terminal) {
+    ++this->actions[state * this->terminals + terminal];
+  }
+  inline void CountGoTo(unsigned int state, unsigned int nonTerminal) {
+    ++this->goTo[state * this->nonTerminals + nonTerminal];
+  }
+  // lookups in both rows of the state
+  uint64_t StateVisits(unsigned int state) const;
+
+  size_t terminals = 0;
+  size_t nonTerminals = 0;
+  std::vector<uint64_t> actions;
+  std::vector<uint64_t> goTo;
+};
+
+// Order of the states and terminals of a permuted table, the old id of every
+// new one. State 0, where every parse starts, and $ keep their ids.
+struct TableLayout {
+  std::vector<unsigned int> states;
+  std::vector<unsigned int> terminals;
+};
+
+// States laid out along the hot paths of the profile: from the most visited
+// state not placed yet the most used transition to another such state is
+// followed until there is none, starting with state 0. States the corpus did
+// not visit keep their order at the end. With columns the terminals are
+// ordered by their number of lookups, otherwise they keep their ids.
+TableLayout ProfileLayout(
+    const LRTable &table, const TableProfile &profile, bool columns);
+
+// Copy of the table with its rows and columns in the order of the layout,
+// allocated in that order so the rows of hot states are close in memory.
+// With the terminals of the grammar renumbered by PermuteTerminals it parses
+// every input exactly like the original table.
+LRTable PermuteTable(const LRTable &table, const TableLayout &layout);
 
 } // namespace lrone